@@ -0,0 +1,534 @@
+#include "analysis.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char *const BLOCK_EXIT_NAMES[NUM_BLOCK_EXITS] =
+    {"falls through", "jumps", "skips", "calls", "returns", "jumps indirect", "halts", "traps"};
+
+// Working state of an analysis
+typedef struct
+{
+    const Chip *chip;
+    ControlFlowGraph *graph;
+    bool is_opcode[MEMORY_SIZE]; // an opcode reached by the disassembly starts here
+    bool is_leader[MEMORY_SIZE]; // a block starts here
+    bool is_entry[MEMORY_SIZE];  // a function starts here
+    bool is_queued[MEMORY_SIZE];
+    uint16_t worklist[MEMORY_SIZE];
+    size_t worklist_size;
+} Analysis;
+
+// How an opcode ends its block, if it does
+typedef struct
+{
+    BlockExit exit;
+    uint16_t targets[MAX_BLOCK_SUCCESSORS];
+    uint8_t num_targets;
+    uint16_t callee;
+} Ending;
+
+// Returns the opcode at the given address
+static opcode _fetch(const Chip *chip, uint16_t address);
+
+// Returns the length in bytes of the opcode: 4 for Fx00 nnnn, else 2
+static int _length(opcode op);
+
+// Returns true if the opcode at `address` ends its block, filling in
+// how.
+static bool _ends_block(const Chip *chip, opcode op, uint16_t address, Ending *ending);
+
+// Marks the address as the start of a block and queues it for
+// disassembly.
+static void _queue(Analysis *analysis, uint16_t address);
+
+// Disassembles everything reachable from the queued addresses.
+static void _disassemble(Analysis *analysis);
+
+// Splits the disassembled opcodes into blocks, and marks code and data.
+static bool _build_blocks(Analysis *analysis);
+
+// Walks the blocks of each function, filling in the functions and the
+// call graph.
+static bool _build_functions(Analysis *analysis);
+
+// Marks the loop headers with a depth-first walk from each function.
+static bool _find_loops(ControlFlowGraph *graph);
+
+// Marks `count` bytes from `address` on with the flag.
+static void _mark(ControlFlowGraph *graph, uint16_t address, int count, uint8_t flag);
+
+// qsort comparator ordering CallEdges by caller, then callee.
+static int _compare_calls(const void *lhs, const void *rhs);
+
+ControlFlowGraph *AnalyzeROM(const Chip *chip)
+{
+    Analysis *analysis = (Analysis *)(calloc(1, sizeof(Analysis)));
+    ControlFlowGraph *graph = (ControlFlowGraph *)(calloc(1, sizeof(ControlFlowGraph)));
+    if (!analysis || !graph)
+    {
+        free(analysis);
+        free(graph);
+        return NULL;
+    }
+    analysis->chip = chip;
+    analysis->graph = graph;
+
+    analysis->is_entry[MEMORY_START] = true;
+    _queue(analysis, MEMORY_START);
+    _disassemble(analysis);
+    bool built = _build_blocks(analysis) && _build_functions(analysis) && _find_loops(graph);
+    free(analysis);
+    if (!built)
+    {
+        FreeControlFlowGraph(graph);
+        return NULL;
+    }
+    return graph;
+}
+
+void FreeControlFlowGraph(ControlFlowGraph *graph)
+{
+    free(graph->blocks);
+    free(graph->functions);
+    free(graph->calls);
+    free(graph);
+}
+
+void WriteControlFlowGraph(const ControlFlowGraph *graph, const Chip *chip, FILE *file)
+{
+    size_t code_bytes = 0;
+    size_t data_bytes = 0;
+    for (int i = 0; i < MEMORY_SIZE; i++)
+    {
+        code_bytes += (graph->byte_flags[i] & BYTE_CODE) != 0;
+        data_bytes += (graph->byte_flags[i] & BYTE_DATA) != 0;
+    }
+    fprintf(file, "# %zu blocks, %zu functions, %zu calls, %zu loops, "
+                  "%zu code bytes, %zu data bytes\n",
+            graph->num_blocks, graph->num_functions, graph->num_calls, graph->num_loops,
+            code_bytes, data_bytes);
+
+    size_t call = 0;
+    for (size_t f = 0; f < graph->num_functions; f++)
+    {
+        const Function *function = &graph->functions[f];
+        fprintf(file, "\nfunction 0x%03X: %u blocks%s\n", function->entry,
+                function->num_blocks, function->returns ? ", returns" : "");
+        for (; call < graph->num_calls && graph->calls[call].caller == function->entry; call++)
+        {
+            fprintf(file, "  calls 0x%03X\n", graph->calls[call].callee);
+        }
+    }
+
+    for (size_t b = 0; b < graph->num_blocks; b++)
+    {
+        const BasicBlock *block = &graph->blocks[b];
+        fprintf(file, "\nblock 0x%03X: %u opcodes, %s", block->start, block->length,
+                BLOCK_EXIT_NAMES[block->exit]);
+        if (block->exit == BLOCK_CALLS)
+        {
+            fprintf(file, " 0x%03X", block->callee);
+        }
+        for (int s = 0; s < block->num_successors; s++)
+        {
+            fprintf(file, "%s0x%03X", s ? ", " : " -> ",
+                    graph->blocks[block->successors[s]].start);
+        }
+        fprintf(file, "%s\n", block->is_loop_header ? " (loop header)" : "");
+        uint16_t address = block->start;
+        for (int i = 0; i < block->length; i++)
+        {
+            opcode op = _fetch(chip, address);
+            fprintf(file, "  0x%03X  %04X", address, op);
+            if (_length(op) == 4)
+            {
+                fprintf(file, " %04X", _fetch(chip, address + 2));
+            }
+            fprintf(file, "\n");
+            address = MEMORY_ADDRESS(address + _length(op));
+        }
+    }
+
+    fprintf(file, "\n");
+    for (int start = 0; start < MEMORY_SIZE;)
+    {
+        int end = start;
+        while (end < MEMORY_SIZE && (graph->byte_flags[end] & BYTE_DATA))
+        {
+            end++;
+        }
+        if (end > start)
+        {
+            fprintf(file, "data 0x%03X-0x%03X\n", start, end - 1);
+        }
+        start = end + 1;
+    }
+}
+
+static opcode _fetch(const Chip *chip, uint16_t address)
+{
+    return (chip->memory[MEMORY_ADDRESS(address)] << 8) |
+           chip->memory[MEMORY_ADDRESS(address + 1)];
+}
+
+static int _length(opcode op)
+{
+    return (op & 0xF0FF) == 0xF000 ? 4 : 2;
+}
+
+static bool _ends_block(const Chip *chip, opcode op, uint16_t address, Ending *ending)
+{
+    uint16_t next = MEMORY_ADDRESS(address + _length(op));
+    uint16_t nnn = op & 0xFFF;
+    ending->num_targets = 0;
+    ending->callee = 0;
+
+    OpcodeHandler handler = DecodeOpcode(op);
+    if (!handler)
+    {
+        ending->exit = BLOCK_TRAPS;
+    }
+    else if (handler == ReturnFromSubroutine)
+    {
+        ending->exit = BLOCK_RETURNS;
+    }
+    else if (handler == ExitInterpreter)
+    {
+        ending->exit = BLOCK_HALTS;
+    }
+    else if (handler == JumpToOpcodeAddress)
+    {
+        ending->exit = nnn == address ? BLOCK_HALTS : BLOCK_JUMPS;
+        ending->targets[ending->num_targets++] = nnn;
+    }
+    else if (handler == CallOpcodeSubroutine)
+    {
+        ending->exit = BLOCK_CALLS;
+        ending->targets[ending->num_targets++] = next;
+        ending->callee = nnn;
+    }
+    else if (handler == JumpToOpcodeRegisterSum)
+    {
+        ending->exit = BLOCK_JUMPS_INDIRECT;
+    }
+    else if (handler == SkipIfByteEqualToRegister || handler == SkipIfByteNotEqualToRegister ||
+             handler == SkipIfRegistersEqual || handler == SkipIfUnequalRegisters ||
+             handler == SkipIfKeyPressed || handler == SkipIfKeyNotPressed)
+    {
+        ending->exit = BLOCK_SKIPS;
+        ending->targets[ending->num_targets++] = next;
+        ending->targets[ending->num_targets++] = MEMORY_ADDRESS(next + _length(_fetch(chip, next)));
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static void _queue(Analysis *analysis, uint16_t address)
+{
+    address = MEMORY_ADDRESS(address);
+    analysis->is_leader[address] = true;
+    if (!analysis->is_queued[address])
+    {
+        analysis->is_queued[address] = true;
+        analysis->worklist[analysis->worklist_size++] = address;
+    }
+}
+
+static void _disassemble(Analysis *analysis)
+{
+    while (analysis->worklist_size > 0)
+    {
+        uint16_t address = analysis->worklist[--analysis->worklist_size];
+        while (true)
+        {
+            // Running into opcodes already disassembled from elsewhere
+            // starts a block there, so no opcode is in two blocks.
+            if (analysis->is_opcode[address])
+            {
+                analysis->is_leader[address] = true;
+                break;
+            }
+            analysis->is_opcode[address] = true;
+            opcode op = _fetch(analysis->chip, address);
+            Ending ending;
+            if (_ends_block(analysis->chip, op, address, &ending))
+            {
+                for (int i = 0; i < ending.num_targets; i++)
+                {
+                    _queue(analysis, ending.targets[i]);
+                }
+                if (ending.exit == BLOCK_CALLS)
+                {
+                    analysis->is_entry[ending.callee] = true;
+                    _queue(analysis, ending.callee);
+                }
+                break;
+            }
+            address = MEMORY_ADDRESS(address + _length(op));
+        }
+    }
+}
+
+static bool _build_blocks(Analysis *analysis)
+{
+    ControlFlowGraph *graph = analysis->graph;
+    for (int address = 0; address < MEMORY_SIZE; address++)
+    {
+        graph->block_at[address] = -1;
+        graph->num_blocks += analysis->is_leader[address];
+    }
+    graph->blocks = (BasicBlock *)(calloc(graph->num_blocks ? graph->num_blocks : 1,
+                                          sizeof(BasicBlock)));
+    if (!graph->blocks)
+    {
+        return false;
+    }
+
+    // Every reached opcode is reached from a leader, and belongs to the
+    // block of the closest leader before it.
+    uint32_t index = 0;
+    for (int start = 0; start < MEMORY_SIZE; start++)
+    {
+        if (!analysis->is_leader[start])
+        {
+            continue;
+        }
+        BasicBlock *block = &graph->blocks[index];
+        block->start = start;
+        int32_t i_value = -1; // I, if an Annn or F000 in this block set it
+        int num_planes = 1;   // planes drawn on, unless an Fn01 in this block changed them
+        uint16_t address = start;
+        while (true)
+        {
+            opcode op = _fetch(analysis->chip, address);
+            uint8_t x = (op >> 8) & 0xF;
+            uint8_t y = (op >> 4) & 0xF;
+            graph->block_at[address] = index;
+            _mark(graph, address, _length(op), BYTE_CODE);
+            block->length++;
+
+            if ((op & 0xF000) == 0xA000 || (op & 0xF0FF) == 0xF000)
+            {
+                i_value = (op & 0xF000) == 0xA000 ? op & 0xFFF : _fetch(analysis->chip, address + 2);
+                _mark(graph, i_value, 1, BYTE_DATA);
+            }
+            else if ((op & 0xF0FF) == 0xF001)
+            {
+                num_planes = __builtin_popcount(x & ALL_PLANES);
+            }
+            else if (i_value >= 0 && (op & 0xF000) == 0xD000)
+            {
+                _mark(graph, i_value, num_planes * ((op & 0xF) ? (op & 0xF) : 32), BYTE_DATA);
+            }
+            else if (i_value >= 0 && ((op & 0xF00F) == 0x5002 || (op & 0xF00F) == 0x5003))
+            {
+                _mark(graph, i_value, abs(x - y) + 1, BYTE_DATA);
+            }
+            else if (i_value >= 0 && (op & 0xF0FF) == 0xF002)
+            {
+                _mark(graph, i_value, AUDIO_PATTERN_SIZE, BYTE_DATA);
+            }
+            else if (i_value >= 0 && (op & 0xF0FF) == 0xF033)
+            {
+                _mark(graph, i_value, 3, BYTE_DATA);
+            }
+            else if (i_value >= 0 && ((op & 0xF0FF) == 0xF055 || (op & 0xF0FF) == 0xF065))
+            {
+                _mark(graph, i_value, x + 1, BYTE_DATA);
+            }
+            else if ((op & 0xF0FF) == 0xF01E || (op & 0xF0FF) == 0xF029 || (op & 0xF0FF) == 0xF030)
+            {
+                i_value = -1;
+            }
+
+            Ending ending;
+            uint16_t next = MEMORY_ADDRESS(address + _length(op));
+            if (_ends_block(analysis->chip, op, address, &ending))
+            {
+                block->exit = ending.exit;
+                block->callee = ending.callee;
+                block->num_successors = ending.num_targets;
+                for (int s = 0; s < ending.num_targets; s++)
+                {
+                    block->successors[s] = ending.targets[s];
+                }
+                break;
+            }
+            if (analysis->is_leader[next])
+            {
+                block->exit = BLOCK_FALLS_THROUGH;
+                block->num_successors = 1;
+                block->successors[0] = next;
+                break;
+            }
+            address = next;
+        }
+        index++;
+    }
+
+    // Successors hold addresses until every block has its index.
+    for (size_t b = 0; b < graph->num_blocks; b++)
+    {
+        BasicBlock *block = &graph->blocks[b];
+        for (int s = 0; s < block->num_successors; s++)
+        {
+            block->successors[s] = graph->block_at[block->successors[s]];
+        }
+    }
+    return true;
+}
+
+static bool _build_functions(Analysis *analysis)
+{
+    ControlFlowGraph *graph = analysis->graph;
+    for (int address = 0; address < MEMORY_SIZE; address++)
+    {
+        graph->num_functions += analysis->is_entry[address];
+    }
+    graph->functions = (Function *)(calloc(graph->num_functions, sizeof(Function)));
+    size_t calls_capacity = 64;
+    graph->calls = (CallEdge *)(malloc(calls_capacity * sizeof(CallEdge)));
+    uint32_t *visited = (uint32_t *)(calloc(graph->num_blocks + 1, sizeof(uint32_t)));
+    uint32_t *callee_seen = (uint32_t *)(calloc(MEMORY_SIZE, sizeof(uint32_t)));
+    uint32_t *pending = (uint32_t *)(malloc((graph->num_blocks + 1) * sizeof(uint32_t)));
+    if (!graph->functions || !graph->calls || !visited || !callee_seen || !pending)
+    {
+        free(visited);
+        free(callee_seen);
+        free(pending);
+        return false;
+    }
+
+    size_t f = 0;
+    for (int entry = 0; entry < MEMORY_SIZE; entry++)
+    {
+        if (!analysis->is_entry[entry])
+        {
+            continue;
+        }
+        // Stamps are function numbers from 1, so nothing needs clearing.
+        uint32_t stamp = f + 1;
+        Function *function = &graph->functions[f++];
+        function->entry = entry;
+
+        size_t num_pending = 0;
+        pending[num_pending++] = graph->block_at[entry];
+        visited[graph->block_at[entry]] = stamp;
+        while (num_pending > 0)
+        {
+            const BasicBlock *block = &graph->blocks[pending[--num_pending]];
+            function->num_blocks++;
+            function->returns |= block->exit == BLOCK_RETURNS;
+            if (block->exit == BLOCK_CALLS && callee_seen[block->callee] != stamp)
+            {
+                callee_seen[block->callee] = stamp;
+                if (graph->num_calls == calls_capacity)
+                {
+                    calls_capacity *= 2;
+                    CallEdge *calls = realloc(graph->calls, calls_capacity * sizeof(CallEdge));
+                    if (!calls)
+                    {
+                        free(visited);
+                        free(callee_seen);
+                        free(pending);
+                        return false;
+                    }
+                    graph->calls = calls;
+                }
+                graph->calls[graph->num_calls++] = (CallEdge){entry, block->callee};
+            }
+            for (int s = 0; s < block->num_successors; s++)
+            {
+                uint32_t successor = block->successors[s];
+                if (visited[successor] != stamp)
+                {
+                    visited[successor] = stamp;
+                    pending[num_pending++] = successor;
+                }
+            }
+        }
+    }
+    qsort(graph->calls, graph->num_calls, sizeof(CallEdge), _compare_calls);
+
+    free(visited);
+    free(callee_seen);
+    free(pending);
+    return true;
+}
+
+static bool _find_loops(ControlFlowGraph *graph)
+{
+    // 0: not walked yet, 1: on the walk's path, 2: done
+    uint8_t *state = (uint8_t *)(calloc(graph->num_blocks + 1, sizeof(uint8_t)));
+    uint32_t *path = (uint32_t *)(malloc((graph->num_blocks + 1) * sizeof(uint32_t)));
+    uint8_t *next_successor = (uint8_t *)(malloc(graph->num_blocks + 1));
+    if (!state || !path || !next_successor)
+    {
+        free(state);
+        free(path);
+        free(next_successor);
+        return false;
+    }
+
+    for (size_t f = 0; f < graph->num_functions; f++)
+    {
+        uint32_t root = graph->block_at[graph->functions[f].entry];
+        if (state[root])
+        {
+            continue;
+        }
+        size_t depth = 0;
+        path[depth] = root;
+        next_successor[depth++] = 0;
+        state[root] = 1;
+        while (depth > 0)
+        {
+            BasicBlock *block = &graph->blocks[path[depth - 1]];
+            if (next_successor[depth - 1] == block->num_successors)
+            {
+                state[path[--depth]] = 2;
+                continue;
+            }
+            uint32_t successor = block->successors[next_successor[depth - 1]++];
+            if (state[successor] == 1 && !graph->blocks[successor].is_loop_header)
+            {
+                graph->blocks[successor].is_loop_header = true;
+                graph->num_loops++;
+            }
+            else if (state[successor] == 0)
+            {
+                state[successor] = 1;
+                path[depth] = successor;
+                next_successor[depth++] = 0;
+            }
+        }
+    }
+
+    free(state);
+    free(path);
+    free(next_successor);
+    return true;
+}
+
+static void _mark(ControlFlowGraph *graph, uint16_t address, int count, uint8_t flag)
+{
+    for (int i = 0; i < count; i++)
+    {
+        graph->byte_flags[MEMORY_ADDRESS(address + i)] |= flag;
+    }
+}
+
+static int _compare_calls(const void *lhs, const void *rhs)
+{
+    const CallEdge *left = lhs;
+    const CallEdge *right = rhs;
+    if (left->caller != right->caller)
+    {
+        return left->caller - right->caller;
+    }
+    return left->callee - right->callee;
+}
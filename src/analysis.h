@@ -0,0 +1,95 @@
+#ifndef _ANALYSIS_H
+#define _ANALYSIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip.h"
+#include "opcodes.h"
+
+// Static analysis of a loaded ROM. Starting from MEMORY_START, opcodes
+// are disassembled recursively, following jumps, calls and both sides
+// of skips, into a control-flow graph of basic blocks, a call graph
+// and the loops between them. Bytes are marked as code if an opcode
+// reached this way starts on them, and as data if an opcode reads them
+// through an I set by an Annn or F000 nnnn earlier in the same block.
+//
+// The analysis sees memory as it was when it ran: code a ROM writes at
+// run time, and the targets of Bnnn, which depend on V0, are not found.
+
+// Block exits have at most this many successors: both sides of a skip
+#define MAX_BLOCK_SUCCESSORS 2
+
+// How a basic block ends.
+typedef enum
+{
+    BLOCK_FALLS_THROUGH,  // into a block that something else jumps to
+    BLOCK_JUMPS,          // 1nnn
+    BLOCK_SKIPS,          // 3xkk, 4xkk, 5xy0, 9xy0, Ex9E or ExA1
+    BLOCK_CALLS,          // 2nnn; its successor is the return address
+    BLOCK_RETURNS,        // 00EE
+    BLOCK_JUMPS_INDIRECT, // Bnnn, to unknown targets
+    BLOCK_HALTS,          // 1nnn to itself, or 00FD
+    BLOCK_TRAPS,          // an unknown opcode
+    NUM_BLOCK_EXITS,
+} BlockExit;
+
+extern const char *const BLOCK_EXIT_NAMES[NUM_BLOCK_EXITS];
+
+// Flags for each byte of memory
+#define BYTE_CODE 1
+#define BYTE_DATA 2
+
+typedef struct
+{
+    uint16_t start;  // address of the first opcode
+    uint16_t length; // number of opcodes
+    BlockExit exit;
+    uint32_t successors[MAX_BLOCK_SUCCESSORS]; // block indices
+    uint8_t num_successors;
+    uint16_t callee;     // entry of the called function, for BLOCK_CALLS
+    bool is_loop_header; // the target of a back edge in a depth-first walk
+} BasicBlock;
+
+// A subroutine, or the ROM's entry point: the blocks reachable from
+// its entry without following calls.
+typedef struct
+{
+    uint16_t entry;
+    uint32_t num_blocks;
+    bool returns; // has a reachable 00EE
+} Function;
+
+typedef struct
+{
+    uint16_t caller; // function entries
+    uint16_t callee;
+} CallEdge;
+
+typedef struct
+{
+    uint8_t byte_flags[MEMORY_SIZE];  // BYTE_CODE and BYTE_DATA
+    int32_t block_at[MEMORY_SIZE];    // block of the opcode starting there, or -1
+    BasicBlock *blocks;               // in address order
+    size_t num_blocks;
+    Function *functions;              // in address order
+    size_t num_functions;
+    CallEdge *calls;                  // distinct, ordered by caller then callee
+    size_t num_calls;
+    size_t num_loops;                 // blocks that are loop headers
+} ControlFlowGraph;
+
+// Analyzes the Chip-8's memory, normally right after LoadROM. Returns
+// NULL on failure.
+ControlFlowGraph *AnalyzeROM(const Chip *chip);
+
+// Frees the graph.
+void FreeControlFlowGraph(ControlFlowGraph *graph);
+
+// Writes the functions, call graph, blocks with their opcodes, and
+// data ranges as text.
+void WriteControlFlowGraph(const ControlFlowGraph *graph, const Chip *chip, FILE *file);
+
+#endif
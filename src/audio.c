@@ -0,0 +1,222 @@
+#include "audio.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Events that arrive later than this many samples re-anchor the
+// emulated timeline to the device's.
+#define MAX_LATENESS (4 * AUDIO_BUFFER_SAMPLES)
+
+// Claims the next slot in the ring for an event at the given cycle, or
+// returns NULL and counts a dropped event if the ring is full.
+static ToneEvent *_claim_event(Audio *audio, uint64_t cycle);
+
+// Publishes the slot returned by _claim_event to the audio callback.
+static void _publish_event(Audio *audio);
+
+// Fills the device's buffer; runs on SDL's audio thread.
+static void _audio_callback(void *userdata, Uint8 *stream, int length);
+
+Audio *InitializeAudio(uint64_t cycles_per_second)
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+    {
+        fprintf(stderr, "error initializing audio: %s\n", SDL_GetError());
+        return NULL;
+    }
+
+    Audio *audio = (Audio *)(calloc(1, sizeof(Audio)));
+    audio->cycles_per_second = cycles_per_second;
+    SDL_AtomicSet(&audio->head, 0);
+    SDL_AtomicSet(&audio->tail, 0);
+    SDL_AtomicSet(&audio->dropped_events, 0);
+    SDL_AtomicSet(&audio->underruns, 0);
+    SDL_AtomicSet(&audio->samples_played, 0);
+    audio->consumed = SDL_CreateSemaphore(0);
+
+    SDL_AudioSpec desired;
+    SDL_AudioSpec obtained;
+    SDL_zero(desired);
+    desired.freq = AUDIO_SAMPLE_RATE;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = AUDIO_BUFFER_SAMPLES;
+    desired.callback = _audio_callback;
+    desired.userdata = audio;
+
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained,
+                                        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (audio->device == 0)
+    {
+        fprintf(stderr, "error opening audio device: %s\n", SDL_GetError());
+        SDL_DestroySemaphore(audio->consumed);
+        free(audio);
+        return NULL;
+    }
+    audio->sample_rate = obtained.freq;
+    SDL_PauseAudioDevice(audio->device, 0);
+    return audio;
+}
+
+void PushToneEvent(Audio *audio, uint64_t cycle, bool on)
+{
+    ToneEvent *event = _claim_event(audio, cycle);
+    if (!event)
+    {
+        return;
+    }
+    event->on = on;
+    event->is_pattern = false;
+    _publish_event(audio);
+}
+
+void PushPatternEvent(Audio *audio, uint64_t cycle, const uint8_t pattern[AUDIO_PATTERN_SIZE],
+                      uint8_t pitch)
+{
+    ToneEvent *event = _claim_event(audio, cycle);
+    if (!event)
+    {
+        return;
+    }
+    // XO-CHIP plays 4000 * 2^((pitch - 64) / 48) bits per second.
+    double rate = 4000.0 * exp2((pitch - DEFAULT_AUDIO_PITCH) / 48.0);
+    event->is_pattern = true;
+    memcpy(event->pattern, pattern, AUDIO_PATTERN_SIZE);
+    event->step = (uint32_t)(rate * 65536.0 / audio->sample_rate);
+    _publish_event(audio);
+}
+
+uint32_t GetAudioUnderruns(Audio *audio)
+{
+    return (uint32_t)SDL_AtomicGet(&audio->underruns);
+}
+
+uint32_t GetSamplesPlayed(Audio *audio)
+{
+    return (uint32_t)SDL_AtomicGet(&audio->samples_played);
+}
+
+void WaitForAudio(Audio *audio, uint32_t timeout_ms)
+{
+    SDL_SemWaitTimeout(audio->consumed, timeout_ms);
+}
+
+void AudioSoundHook(void *audio, uint64_t cycle, bool on)
+{
+    PushToneEvent(audio, cycle, on);
+}
+
+void AudioSoundPatternHook(void *audio, uint64_t cycle, const uint8_t pattern[AUDIO_PATTERN_SIZE],
+                           uint8_t pitch)
+{
+    PushPatternEvent(audio, cycle, pattern, pitch);
+}
+
+void CleanUpAudio(Audio *audio)
+{
+    SDL_CloseAudioDevice(audio->device);
+    SDL_DestroySemaphore(audio->consumed);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    free(audio);
+}
+
+static ToneEvent *_claim_event(Audio *audio, uint64_t cycle)
+{
+    int head = SDL_AtomicGet(&audio->head);
+    int tail = SDL_AtomicGet(&audio->tail);
+    if ((unsigned)(head - tail) >= TONE_RING_SIZE)
+    {
+        SDL_AtomicAdd(&audio->dropped_events, 1);
+        return NULL;
+    }
+    ToneEvent *event = &audio->ring[head & (TONE_RING_SIZE - 1)];
+    event->sample = cycle * audio->sample_rate / audio->cycles_per_second;
+    return event;
+}
+
+static void _publish_event(Audio *audio)
+{
+    // Make the event visible before the new head.
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&audio->head, SDL_AtomicGet(&audio->head) + 1);
+}
+
+static void _audio_callback(void *userdata, Uint8 *stream, int length)
+{
+    Audio *audio = userdata;
+    Sint16 *samples = (Sint16 *)stream;
+    int count = length / sizeof(Sint16);
+    const uint32_t period = audio->sample_rate / AUDIO_TONE_HZ;
+
+    int head = SDL_AtomicGet(&audio->head);
+    SDL_MemoryBarrierAcquire();
+    int tail = SDL_AtomicGet(&audio->tail);
+
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t now = audio->sample_clock + i;
+        while (tail != head)
+        {
+            const ToneEvent *event = &audio->ring[tail & (TONE_RING_SIZE - 1)];
+            if (!audio->synced ||
+                (int64_t)(event->sample + audio->offset) < (int64_t)now - MAX_LATENESS)
+            {
+                // Play emulated time one buffer behind the device so that
+                // events from the next emulated frame arrive in time.
+                if (audio->synced)
+                {
+                    SDL_AtomicAdd(&audio->underruns, 1);
+                }
+                audio->offset = (int64_t)now + AUDIO_BUFFER_SAMPLES - (int64_t)event->sample;
+                audio->synced = true;
+            }
+            if ((int64_t)(event->sample + audio->offset) > (int64_t)now)
+            {
+                break;
+            }
+            if (event->is_pattern)
+            {
+                memcpy(audio->pattern, event->pattern, AUDIO_PATTERN_SIZE);
+                audio->pattern_step = event->step;
+                audio->has_pattern = true;
+            }
+            else
+            {
+                if (event->on && !audio->tone_on)
+                {
+                    audio->phase = 0;
+                    audio->pattern_phase = 0;
+                }
+                audio->tone_on = event->on;
+            }
+            tail++;
+        }
+
+        if (audio->tone_on && audio->has_pattern)
+        {
+            uint32_t bit = (audio->pattern_phase >> 16) % (AUDIO_PATTERN_SIZE * 8);
+            bool high = audio->pattern[bit / 8] & (0x80 >> (bit % 8));
+            samples[i] = high ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            audio->pattern_phase += audio->pattern_step;
+        }
+        else if (audio->tone_on)
+        {
+            samples[i] = audio->phase < period / 2 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            audio->phase = (audio->phase + 1) % period;
+        }
+        else
+        {
+            samples[i] = 0;
+        }
+    }
+    audio->sample_clock += count;
+    SDL_AtomicSet(&audio->tail, tail);
+
+    SDL_AtomicAdd(&audio->samples_played, count);
+    // One pending wakeup is enough for the single waiter.
+    if (SDL_SemValue(audio->consumed) == 0)
+    {
+        SDL_SemPost(audio->consumed);
+    }
+}
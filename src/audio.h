@@ -0,0 +1,103 @@
+#ifndef _AUDIO_H
+#define _AUDIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#include "chip.h"
+
+// The Chip-8 buzzer.
+//
+// The emulation thread pushes tone on/off events stamped with the
+// Chip-8's cycle count into a lock-free single-producer, single-consumer
+// ring. SDL's audio callback converts each stamp to a sample position
+// and switches the square wave at exactly that sample, so the tone's
+// timing does not depend on when the emulation thread happened to run.
+// Once an XO-CHIP ROM loads an audio pattern, the tone plays that
+// pattern's bits, one per step at a rate set by its pitch, instead.
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_BUFFER_SAMPLES 256
+#define AUDIO_TONE_HZ 440
+#define AUDIO_VOLUME 3000
+
+// Must be a power of two.
+#define TONE_RING_SIZE 256
+
+typedef struct
+{
+    uint64_t sample; // emulated time of the event, in samples
+    bool on;
+    bool is_pattern; // sets the pattern and step instead of switching the tone
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    uint32_t step; // pattern bits per sample, in 16.16 fixed point
+} ToneEvent;
+
+typedef struct
+{
+    SDL_AudioDeviceID device;
+    int sample_rate;
+    uint64_t cycles_per_second;
+
+    // The ring. head is only written by the emulation thread,
+    // tail only by the audio callback.
+    ToneEvent ring[TONE_RING_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    SDL_atomic_t dropped_events;
+    SDL_atomic_t underruns; // events that arrived too late to play on time
+
+    // Samples consumed by the device so far, wrapping at 2^32, and a
+    // semaphore posted after every callback. Used for audio-clock pacing.
+    SDL_atomic_t samples_played;
+    SDL_sem *consumed;
+
+    // Owned by the audio callback.
+    bool tone_on;
+    uint32_t phase;        // samples into the current square wave period
+    bool has_pattern;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    uint32_t pattern_step;
+    uint32_t pattern_phase; // bits into the pattern, in 16.16 fixed point
+    uint64_t sample_clock; // samples written to the device so far
+    int64_t offset;        // device sample = event sample + offset
+    bool synced;
+} Audio;
+
+// Opens the default audio device with a small buffer and starts its
+// callback. `cycles_per_second` is the emulated instruction rate used to
+// turn cycle stamps into time. Returns NULL if there is no usable device.
+Audio *InitializeAudio(uint64_t cycles_per_second);
+
+// Queues a tone change at the given cycle. Must only be called from one
+// thread. Events are dropped if the callback has fallen far behind.
+void PushToneEvent(Audio *audio, uint64_t cycle, bool on);
+
+// Queues a new audio pattern and pitch at the given cycle, under the
+// same conditions as PushToneEvent.
+void PushPatternEvent(Audio *audio, uint64_t cycle, const uint8_t pattern[AUDIO_PATTERN_SIZE],
+                      uint8_t pitch);
+
+// Returns the number of tone events that reached the device too late
+// and had to be re-anchored, i.e. emulation fell behind the device.
+uint32_t GetAudioUnderruns(Audio *audio);
+
+// Returns the number of samples the device has consumed, modulo 2^32.
+uint32_t GetSamplesPlayed(Audio *audio);
+
+// Blocks until the device consumes its next buffer, or `timeout_ms`
+// milliseconds pass.
+void WaitForAudio(Audio *audio, uint32_t timeout_ms);
+
+// A SoundHook that forwards to PushToneEvent; pass the Audio as context.
+void AudioSoundHook(void *audio, uint64_t cycle, bool on);
+
+// A SoundPatternHook that forwards to PushPatternEvent.
+void AudioSoundPatternHook(void *audio, uint64_t cycle, const uint8_t pattern[AUDIO_PATTERN_SIZE],
+                           uint8_t pitch);
+
+// Closes the audio device.
+void CleanUpAudio(Audio *audio);
+
+#endif
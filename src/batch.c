@@ -0,0 +1,256 @@
+#include "batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "movie.h"
+#include "predecode.h"
+#include "threadpool.h"
+
+typedef struct
+{
+    const BatchJob *job;
+    const ROMImage *rom; // NULL if it could not be read up front
+    BatchResult *result;
+    uint32_t cycles_per_frame;
+} BatchTask;
+
+// Runs the BatchTask given as argument. Used as a pool task.
+static void _run_task(void *argument);
+
+// Runs the job, loading its ROM from its rom_data, else from `rom`, or
+// from its rom_path if `rom` is NULL.
+static void _run_job(const BatchJob *job, const ROMImage *rom, BatchResult *result,
+                     uint32_t cycles_per_frame);
+
+// Reads every distinct ROM path of the jobs without rom_data once,
+// pointing roms[i] at the image for jobs[i], or NULL if it could not be
+// read. Returns the images, to be freed by the caller.
+static ROMImage *_read_roms(const BatchJob *jobs, size_t num_jobs, const ROMImage **roms);
+
+// qsort comparator ordering BatchJob pointers by ROM path.
+static int _compare_rom_paths(const void *lhs, const void *rhs);
+
+// Returns a monotonic timestamp in nanoseconds.
+static uint64_t _now_ns();
+
+void RunBatch(const BatchJob *jobs, BatchResult *results, size_t num_jobs,
+              int num_threads, uint32_t cycles_per_frame)
+{
+    BatchTask *tasks = (BatchTask *)(malloc(num_jobs * sizeof(BatchTask)));
+    const ROMImage **roms = (const ROMImage **)(calloc(num_jobs, sizeof(ROMImage *)));
+    ROMImage *images = roms ? _read_roms(jobs, num_jobs, roms) : NULL;
+    ThreadPool *pool = CreateThreadPool(num_threads);
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        tasks[i].job = &jobs[i];
+        tasks[i].rom = roms ? roms[i] : NULL;
+        tasks[i].result = &results[i];
+        tasks[i].cycles_per_frame = cycles_per_frame;
+        if (pool)
+        {
+            SubmitTask(pool, _run_task, &tasks[i]);
+        }
+        else
+        {
+            _run_task(&tasks[i]);
+        }
+    }
+    if (pool)
+    {
+        DestroyThreadPool(pool);
+    }
+    free(images);
+    free(roms);
+    free(tasks);
+}
+
+void RunBatchJob(const BatchJob *job, BatchResult *result,
+                 uint32_t cycles_per_frame)
+{
+    _run_job(job, NULL, result, cycles_per_frame);
+}
+
+static void _run_job(const BatchJob *job, const ROMImage *rom, BatchResult *result,
+                     uint32_t cycles_per_frame)
+{
+    memset(result, 0, sizeof(BatchResult));
+    uint64_t start = _now_ns();
+
+    InputMovie movie = {NULL, 0};
+    if (job->movie_path && !LoadInputMovie(&movie, job->movie_path))
+    {
+        return;
+    }
+
+    ROMImage image;
+    ROMError error = ROM_OK;
+    const uint8_t *rom_data = job->rom_data;
+    size_t rom_size = job->rom_size;
+    if (!rom_data && !rom)
+    {
+        error = ReadROMImage(&image, job->rom_path);
+        rom = &image;
+    }
+    if (!rom_data)
+    {
+        rom_data = rom->data;
+        rom_size = rom->size;
+    }
+    Chip *chip = InitializeChip();
+    if (error == ROM_OK)
+    {
+        error = LoadROMFromBuffer(chip, rom_data, rom_size);
+    }
+    if (error != ROM_OK)
+    {
+        result->rom_error = error;
+        FreeChip(chip);
+        FreeInputMovie(&movie);
+        return;
+    }
+
+    uint64_t max_frames = job->cycle_budget / cycles_per_frame;
+    if (job->frame_hashes &&
+        (max_frames > SIZE_MAX / sizeof(uint64_t) ||
+         !(result->frame_hashes = (uint64_t *)(malloc(max_frames * sizeof(uint64_t))))))
+    {
+        result->out_of_memory = true;
+        FreeChip(chip);
+        FreeInputMovie(&movie);
+        return;
+    }
+    chip->quirk_profile = job->quirk_profile;
+    SeedChip(chip, job->seed);
+    result->loaded = true;
+
+    Backend backend = BACKEND_SWITCH;
+    uint64_t rom_hash = 0;
+    size_t preloaded = 0;
+    if (job->predecode_directory)
+    {
+        backend = BACKEND_PREDECODED;
+        rom_hash = HashROM(rom_data, rom_size);
+        preloaded = LoadPredecodeCache(chip, job->predecode_directory, rom_hash);
+    }
+
+    size_t cursor = 0;
+    StopReason reason = STOP_BUDGET_EXHAUSTED;
+    uint64_t frame = 0;
+    for (; frame < max_frames; frame++)
+    {
+        ApplyInputMovie(&movie, &cursor, frame, chip);
+        reason = RunCyclesWithBackend(chip, cycles_per_frame, backend);
+        if (reason == STOP_TRAPPED)
+        {
+            break;
+        }
+        TickTimers(chip);
+        if (result->frame_hashes)
+        {
+            result->frame_hashes[frame] = HashScreen(chip);
+        }
+        if (job->shared_framebuffer)
+        {
+            PublishFrame(job->shared_framebuffer, job->shared_slot, chip);
+        }
+    }
+    // Spend whatever is left of the budget on a partial frame.
+    if (reason != STOP_TRAPPED)
+    {
+        ApplyInputMovie(&movie, &cursor, frame, chip);
+        reason = RunCyclesWithBackend(chip, job->cycle_budget - max_frames * cycles_per_frame,
+                                      backend);
+    }
+
+    result->num_frames = frame;
+    result->stop_reason = reason;
+    result->trap = chip->trap;
+    result->cycles = chip->cycle_count;
+    result->final_hash = HashChipState(chip);
+
+    if (job->predecode_directory && chip->predecode &&
+        CountDecodedEntries(chip->predecode) > preloaded)
+    {
+        SavePredecodeCache(chip, job->predecode_directory, rom_hash);
+    }
+    FreeChip(chip);
+    FreeInputMovie(&movie);
+    result->elapsed_ns = _now_ns() - start;
+}
+
+void FreeBatchResults(BatchResult *results, size_t num_jobs)
+{
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        free(results[i].frame_hashes);
+        results[i].frame_hashes = NULL;
+    }
+}
+
+static void _run_task(void *argument)
+{
+    BatchTask *task = argument;
+    _run_job(task->job, task->rom, task->result, task->cycles_per_frame);
+}
+
+static ROMImage *_read_roms(const BatchJob *jobs, size_t num_jobs, const ROMImage **roms)
+{
+    const BatchJob **sorted = (const BatchJob **)(malloc(num_jobs * sizeof(BatchJob *)));
+    if (!sorted)
+    {
+        return NULL;
+    }
+    size_t num_sorted = 0;
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        if (!jobs[i].rom_data)
+        {
+            sorted[num_sorted++] = &jobs[i];
+        }
+    }
+    qsort(sorted, num_sorted, sizeof(BatchJob *), _compare_rom_paths);
+
+    size_t num_images = 0;
+    for (size_t i = 0; i < num_sorted; i++)
+    {
+        num_images += i == 0 || strcmp(sorted[i]->rom_path, sorted[i - 1]->rom_path) != 0;
+    }
+    ROMImage *images = (ROMImage *)(malloc(num_images * sizeof(ROMImage)));
+    if (!images)
+    {
+        free(sorted);
+        return NULL;
+    }
+
+    size_t next = 0;
+    const ROMImage *image = NULL;
+    for (size_t i = 0; i < num_sorted; i++)
+    {
+        if (i == 0 || strcmp(sorted[i]->rom_path, sorted[i - 1]->rom_path) != 0)
+        {
+            image = ReadROMImage(&images[next], sorted[i]->rom_path) == ROM_OK
+                        ? &images[next]
+                        : NULL;
+            next++;
+        }
+        roms[sorted[i] - jobs] = image;
+    }
+    free(sorted);
+    return images;
+}
+
+static int _compare_rom_paths(const void *lhs, const void *rhs)
+{
+    const BatchJob *left = *(const BatchJob *const *)lhs;
+    const BatchJob *right = *(const BatchJob *const *)rhs;
+    return strcmp(left->rom_path, right->rom_path);
+}
+
+static uint64_t _now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
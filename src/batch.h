@@ -0,0 +1,65 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip.h"
+#include "opcodes.h"
+#include "sharedframe.h"
+
+// One headless run of a ROM.
+typedef struct
+{
+    const char *rom_path;
+    // If set, the ROM is loaded from these bytes, e.g. in a ROMArchive,
+    // instead of from rom_path, which then only names it.
+    const uint8_t *rom_data;
+    size_t rom_size;
+    uint32_t seed;
+    const char *movie_path; // NULL to run without input
+    // Emulated time to run for, in opcodes. Fewer opcodes execute
+    // while the ROM waits for a key.
+    uint64_t cycle_budget;
+    QuirkProfile quirk_profile; // chosen for the ROM, usually QUIRKS_DEFAULT
+    // If set, every frame is published to this slot of the segment.
+    SharedFramebuffer *shared_framebuffer;
+    uint32_t shared_slot;
+    // If set, the job runs on the predecoded backend, starting from the
+    // ROM's cache saved in this directory, if any, and saving the cache
+    // back if the run decoded more of the ROM.
+    const char *predecode_directory;
+    bool frame_hashes; // record HashScreen after every frame
+} BatchJob;
+
+typedef struct
+{
+    bool loaded;            // false if the ROM or movie could not be loaded
+    ROMError rom_error;     // why the ROM could not be loaded, if it was not
+    bool out_of_memory;     // the frame hashes could not be allocated
+    StopReason stop_reason;
+    Trap trap;
+    uint64_t cycles;        // opcodes actually executed
+    uint64_t final_hash;    // HashChipState after the run
+    uint64_t *frame_hashes; // HashScreen after every completed frame, if requested
+    uint64_t num_frames;
+    uint64_t elapsed_ns;
+} BatchResult;
+
+// Runs every job on a work-stealing pool of `num_threads` workers
+// (one per core if not positive). Writes the result of jobs[i] into
+// results[i]. Each job executes `cycles_per_frame` opcodes per frame.
+// Every distinct ROM path without rom_data is read once, up front, and
+// loaded from memory by the jobs that run it.
+void RunBatch(const BatchJob *jobs, BatchResult *results, size_t num_jobs,
+              int num_threads, uint32_t cycles_per_frame);
+
+// Runs a single job on the calling thread.
+void RunBatchJob(const BatchJob *job, BatchResult *result,
+                 uint32_t cycles_per_frame);
+
+// Frees the frame hashes held by the results.
+void FreeBatchResults(BatchResult *results, size_t num_jobs);
+
+#endif
@@ -0,0 +1,95 @@
+#include "benchroms.h"
+
+// Register arithmetic and logic in a tight loop.
+static const uint8_t ALU_ROM[] =
+    {
+        0x60, 0x01, // 200: LD V0, 1
+        0x61, 0x03, // 202: LD V1, 3
+        0x80, 0x14, // 204: ADD V0, V1
+        0x81, 0x05, // 206: SUB V1, V0
+        0x82, 0x02, // 208: AND V2, V0
+        0x83, 0x13, // 20A: XOR V3, V1
+        0x84, 0x06, // 20C: SHR V4
+        0x85, 0x0E, // 20E: SHL V5
+        0x72, 0x01, // 210: ADD V2, 1
+        0x81, 0x21, // 212: OR V1, V2
+        0x30, 0x00, // 214: SE V0, 0
+        0x12, 0x04, // 216: JP 204
+        0x12, 0x00, // 218: JP 200
+};
+
+// Full-height sprites drawn across the screen.
+static const uint8_t SPRITE_ROM[] =
+    {
+        0xA0, 0x50, // 200: LD I, font
+        0xD0, 0x1F, // 202: DRW V0, V1, 15
+        0x70, 0x07, // 204: ADD V0, 7
+        0x71, 0x03, // 206: ADD V1, 3
+        0x12, 0x02, // 208: JP 202
+};
+
+// Nested subroutine calls and returns.
+static const uint8_t CALL_ROM[] =
+    {
+        0x22, 0x08, // 200: CALL 208
+        0x22, 0x08, // 202: CALL 208
+        0x12, 0x00, // 204: JP 200
+        0x00, 0x00, // 206:
+        0x22, 0x0C, // 208: CALL 20C
+        0x00, 0xEE, // 20A: RET
+        0x70, 0x01, // 20C: ADD V0, 1
+        0x00, 0xEE, // 20E: RET
+};
+
+// Copies all sixteen registers to memory and back.
+static const uint8_t MEMORY_ROM[] =
+    {
+        0xA4, 0x00, // 200: LD I, 400
+        0xFF, 0x55, // 202: LD [I], VF
+        0xFF, 0x65, // 204: LD VF, [I]
+        0x70, 0x01, // 206: ADD V0, 1
+        0x12, 0x00, // 208: JP 200
+};
+
+// Rewrites the instruction at 20A on every iteration before running it.
+static const uint8_t SELF_MODIFYING_ROM[] =
+    {
+        0xA2, 0x0A, // 200: LD I, 20A
+        0x60, 0x60, // 202: LD V0, 60
+        0x71, 0x01, // 204: ADD V1, 1
+        0xF1, 0x55, // 206: LD [I], V1  (20A becomes LD V0, V1's value)
+        0x72, 0x01, // 208: ADD V2, 1
+        0x00, 0x00, // 20A: rewritten above
+        0x12, 0x00, // 20C: JP 200
+};
+
+// Common idioms: register setup, a counting loop and a table lookup.
+static const uint8_t IDIOM_ROM[] =
+    {
+        0x60, 0x00, // 200: LD V0, 0
+        0x61, 0x02, // 202: LD V1, 2
+        0x70, 0x01, // 204: ADD V0, 1
+        0x30, 0x20, // 206: SE V0, 20
+        0x12, 0x04, // 208: JP 204
+        0xA4, 0x00, // 20A: LD I, 400
+        0xF1, 0x1E, // 20C: ADD I, V1
+        0xF3, 0x65, // 20E: LD V3, [I]
+        0x12, 0x00, // 210: JP 200
+};
+
+const BenchROM BENCH_ROMS[] =
+    {
+        {"alu", ALU_ROM, sizeof(ALU_ROM)},
+        {"sprite", SPRITE_ROM, sizeof(SPRITE_ROM)},
+        {"call", CALL_ROM, sizeof(CALL_ROM)},
+        {"memory", MEMORY_ROM, sizeof(MEMORY_ROM)},
+        {"self-modifying", SELF_MODIFYING_ROM, sizeof(SELF_MODIFYING_ROM)},
+        {"idioms", IDIOM_ROM, sizeof(IDIOM_ROM)},
+};
+
+const size_t NUM_BENCH_ROMS = sizeof(BENCH_ROMS) / sizeof(BENCH_ROMS[0]);
+
+void LoadBenchROM(Chip *chip, const BenchROM *rom)
+{
+    LoadROMFromBuffer(chip, rom->data, rom->size);
+}
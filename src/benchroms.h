@@ -0,0 +1,25 @@
+#ifndef _BENCHROMS_H
+#define _BENCHROMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip.h"
+
+// Small synthetic ROMs that each stress one part of the core, for
+// benchmarking. Every ROM loops forever.
+
+typedef struct
+{
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+} BenchROM;
+
+extern const BenchROM BENCH_ROMS[];
+extern const size_t NUM_BENCH_ROMS;
+
+// Copies the ROM into the Chip-8's memory at MEMORY_START.
+void LoadBenchROM(Chip *chip, const BenchROM *rom);
+
+#endif
@@ -1,18 +1,58 @@
 #include "chip.h"
+#include "predecode.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Checks that a file at the given filename exists,
-// and is a suitable size for the CHIP-8 machine.
-// Returns file pointer if the file exists, as well as
-// setting the output parameter. Otherwise crashes.
-static FILE *CheckValidROM(const char *filename, int *file_size);
+// Maps the ROM file with the given filename read-only, checking that
+// it is a regular file that fits in memory. On success sets `data`
+// and `size`; unmap with _unmap_rom.
+static ROMError _map_rom(const char *filename, const uint8_t **data, size_t *size);
 
-// Loads the font set into the Chip-8.
+// Unmaps a ROM mapped by _map_rom.
+static void _unmap_rom(const uint8_t *data, size_t size);
+
+// Loads the font sets into the Chip-8.
 static void LoadFontSet(Chip *chip);
 
+// Returns the 32 bits with a zero inserted above each, so bit i moves
+// to bit 2i.
+static uint64_t _spread_bits(uint32_t bits);
+
+// Returns the 32 bits with each one doubled, as 64 bits.
+static uint64_t _double_bits(uint32_t bits);
+
+// Returns the 32 bits in the odd positions of `bits`, undoing
+// _double_bits.
+static uint32_t _halve_bits(uint64_t bits);
+
+// Folds `size` bytes at `data` into the FNV-1a hash `hash`.
+static uint64_t _fnv1a(uint64_t hash, const void *data, size_t size);
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+const char *const TRAP_NAMES[NUM_TRAPS] =
+    {"none", "unknown opcode", "stack overflow", "stack underflow", "exited"};
+
+const char *const ROM_ERROR_NAMES[NUM_ROM_ERRORS] =
+    {"ok", "could not open", "not a regular file", "too large", "could not read"};
+
+#define QUIRK_PROFILE_NAME(profile, name, quirks) name,
+#define QUIRK_PROFILE_FLAGS(profile, name, quirks) quirks,
+
+const char *const QUIRK_PROFILE_NAMES[NUM_QUIRK_PROFILES] = {QUIRK_PROFILES(QUIRK_PROFILE_NAME)};
+const uint8_t QUIRK_PROFILE_QUIRKS[NUM_QUIRK_PROFILES] = {QUIRK_PROFILES(QUIRK_PROFILE_FLAGS)};
+
+// Used when a Chip-8 is seeded with 0, which xorshift cannot leave.
+#define DEFAULT_RNG_STATE 0x9e3779b9
+
 static const uint8_t FONT_SET[FONT_SET_LENGTH] =
     {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -33,55 +73,305 @@ static const uint8_t FONT_SET[FONT_SET_LENGTH] =
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+static const uint8_t BIG_FONT_SET[BIG_FONT_SET_LENGTH] =
+    {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
 Chip *InitializeChip()
 {
     Chip *chip = (Chip *)(calloc(1, sizeof(Chip)));
     chip->program_counter = MEMORY_START;
     // TODO: assume registers and stack are part of struct?
     chip->memory = calloc(MEMORY_SIZE, sizeof(uint8_t));
+    chip->rng_state = DEFAULT_RNG_STATE;
+    chip->planes = 1;
+    chip->audio_pitch = DEFAULT_AUDIO_PITCH;
     LoadFontSet(chip);
     return chip;
 }
 
+Chip *CloneChip(const Chip *chip)
+{
+    Chip *clone = (Chip *)(malloc(sizeof(Chip)));
+    if (!clone)
+    {
+        return NULL;
+    }
+    *clone = *chip;
+    clone->memory = malloc(MEMORY_SIZE);
+    if (!clone->memory)
+    {
+        free(clone);
+        return NULL;
+    }
+    memcpy(clone->memory, chip->memory, MEMORY_SIZE);
+    clone->predecode = NULL;
+    memset(clone->code_pages, 0, sizeof(clone->code_pages));
+    return clone;
+}
+
+void CopyChip(Chip *destination, const Chip *source)
+{
+    // Keep decoded code that the copy leaves unchanged.
+    for (int page = 0; page < NUM_CODE_PAGES; page++)
+    {
+        uint16_t start = page << CODE_PAGE_SHIFT;
+        uint16_t size = 1 << CODE_PAGE_SHIFT;
+        if ((destination->code_pages[page / 64] & (1ULL << (page % 64))) &&
+            memcmp(destination->memory + start, source->memory + start, size) != 0)
+        {
+            InvalidateCode(destination, start, size);
+        }
+    }
+
+    uint8_t *memory = destination->memory;
+    PredecodeCache *predecode = destination->predecode;
+    uint64_t code_pages[NUM_CODE_PAGE_WORDS];
+    memcpy(code_pages, destination->code_pages, sizeof(code_pages));
+    *destination = *source;
+    destination->memory = memory;
+    destination->predecode = predecode;
+    memcpy(destination->code_pages, code_pages, sizeof(code_pages));
+    memcpy(memory, source->memory, MEMORY_SIZE);
+}
+
 void FreeChip(Chip *chip)
 {
+    if (chip->predecode)
+    {
+        FreePredecodeCache(chip->predecode);
+    }
     free(chip->memory);
     free(chip);
 }
 
-void LoadROM(Chip *chip, const char *filename)
+ROMError LoadROM(Chip *chip, const char *filename)
+{
+    const uint8_t *data;
+    size_t size;
+    ROMError error = _map_rom(filename, &data, &size);
+    if (error != ROM_OK)
+    {
+        return error;
+    }
+    error = LoadROMFromBuffer(chip, data, size);
+    _unmap_rom(data, size);
+    return error;
+}
+
+ROMError LoadROMFromBuffer(Chip *chip, const uint8_t *data, size_t size)
+{
+    if (size > MAX_ROM_SIZE)
+    {
+        return ROM_TOO_LARGE;
+    }
+    memcpy(chip->memory + MEMORY_START, data, size);
+    InvalidateCode(chip, MEMORY_START, size);
+    return ROM_OK;
+}
+
+ROMError ReadROMImage(ROMImage *image, const char *filename)
+{
+    const uint8_t *data;
+    size_t size;
+    ROMError error = _map_rom(filename, &data, &size);
+    if (error != ROM_OK)
+    {
+        return error;
+    }
+    memcpy(image->data, data, size);
+    image->size = size;
+    _unmap_rom(data, size);
+    return ROM_OK;
+}
+
+static ROMError _map_rom(const char *filename, const uint8_t **data, size_t *size)
 {
-    int file_size;
-    FILE *rom = CheckValidROM(filename, &file_size);
-    uint8_t *memory = chip->memory;
-    // Load ROM into RAM
-    // TODO: Error check both these function calls
-    fread(memory + MEMORY_START, file_size, 1, rom);
-    fclose(rom);
+    int file = open(filename, O_RDONLY);
+    if (file < 0)
+    {
+        return ROM_OPEN_FAILED;
+    }
+    struct stat info;
+    ROMError error = ROM_OK;
+    if (fstat(file, &info) != 0)
+    {
+        error = ROM_OPEN_FAILED;
+    }
+    else if (!S_ISREG(info.st_mode))
+    {
+        error = ROM_NOT_A_FILE;
+    }
+    else if (info.st_size > MAX_ROM_SIZE)
+    {
+        error = ROM_TOO_LARGE;
+    }
+    else if (info.st_size == 0)
+    {
+        // An empty ROM, which cannot be mapped
+        static const uint8_t EMPTY[1];
+        *data = EMPTY;
+        *size = 0;
+    }
+    else
+    {
+        void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping == MAP_FAILED)
+        {
+            error = ROM_READ_FAILED;
+        }
+        else
+        {
+            *data = (const uint8_t *)(mapping);
+            *size = info.st_size;
+        }
+    }
+    close(file);
+    return error;
 }
 
-FILE *CheckValidROM(const char *filename, int *file_size)
+static void _unmap_rom(const uint8_t *data, size_t size)
 {
-    FILE *file = fopen(filename, "rb");
-    // Check for errors opening the file
-    if (file == NULL)
+    if (size > 0)
     {
-        fprintf(stderr, "Could not open %s.\n", filename);
-        exit(EXIT_FAILURE);
+        munmap((void *)data, size);
     }
+}
 
-    // Check that ROM has valid size
-    fseek(file, 0L, SEEK_END);
-    int rom_size = ftell(file);
-    if (rom_size > MEMORY_SIZE - MEMORY_START)
+QuirkProfile FindQuirkProfile(const char *name)
+{
+    QuirkProfile profile = 0;
+    while (profile < NUM_QUIRK_PROFILES && strcmp(QUIRK_PROFILE_NAMES[profile], name) != 0)
     {
-        fclose(file);
-        fprintf(stderr, "%s is too large!\n", filename);
-        exit(EXIT_FAILURE);
+        profile++;
     }
-    fseek(file, 0L, SEEK_SET);
-    *file_size = rom_size;
-    return file;
+    return profile;
+}
+
+void SeedChip(Chip *chip, uint32_t seed)
+{
+    chip->rng_state = seed ? seed : DEFAULT_RNG_STATE;
+}
+
+uint8_t NextRandomByte(Chip *chip)
+{
+    uint32_t x = chip->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip->rng_state = x;
+    return x >> 24;
+}
+
+void TickTimers(Chip *chip)
+{
+    if (chip->delay_timer > 0)
+    {
+        chip->delay_timer--;
+    }
+    if (chip->sound_timer > 0)
+    {
+        chip->sound_timer--;
+        if (chip->sound_timer == 0 && chip->sound_hook)
+        {
+            chip->sound_hook(chip->sound_context, chip->cycle_count, false);
+        }
+    }
+}
+
+uint64_t HashChipState(const Chip *chip)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = _fnv1a(hash, chip->registers, sizeof(chip->registers));
+    hash = _fnv1a(hash, &chip->address_register, sizeof(chip->address_register));
+    hash = _fnv1a(hash, &chip->delay_timer, sizeof(chip->delay_timer));
+    hash = _fnv1a(hash, &chip->sound_timer, sizeof(chip->sound_timer));
+    hash = _fnv1a(hash, &chip->program_counter, sizeof(chip->program_counter));
+    hash = _fnv1a(hash, chip->stack, sizeof(chip->stack));
+    hash = _fnv1a(hash, &chip->stack_pointer, sizeof(chip->stack_pointer));
+    hash = _fnv1a(hash, chip->memory, MEMORY_SIZE);
+    hash = _fnv1a(hash, chip->rpl_flags, sizeof(chip->rpl_flags));
+    hash = _fnv1a(hash, &chip->has_audio_pattern, sizeof(chip->has_audio_pattern));
+    hash = _fnv1a(hash, chip->audio_pattern, sizeof(chip->audio_pattern));
+    hash = _fnv1a(hash, &chip->audio_pitch, sizeof(chip->audio_pitch));
+    hash = _fnv1a(hash, &chip->planes, sizeof(chip->planes));
+    hash = _fnv1a(hash, &chip->high_resolution, sizeof(chip->high_resolution));
+    hash = _fnv1a(hash, chip->screen, sizeof(chip->screen));
+    return hash;
+}
+
+uint64_t HashScreen(const Chip *chip)
+{
+    uint64_t hash = _fnv1a(FNV_OFFSET_BASIS, &chip->high_resolution, sizeof(chip->high_resolution));
+    return _fnv1a(hash, chip->screen, sizeof(chip->screen));
+}
+
+int GetScreenWidth(const Chip *chip)
+{
+    return chip->high_resolution ? HIRES_DISPLAY_WIDTH_IN_PIXELS : DISPLAY_WIDTH_IN_PIXELS;
+}
+
+int GetScreenHeight(const Chip *chip)
+{
+    return chip->high_resolution ? HIRES_DISPLAY_HEIGHT_IN_PIXELS : DISPLAY_HEIGHT_IN_PIXELS;
+}
+
+ScreenRow GetDisplayRow(const Chip *chip, int plane, int y)
+{
+    if (chip->high_resolution)
+    {
+        return chip->screen[plane][y];
+    }
+    uint64_t row = chip->screen[plane][y / 2] >> 64;
+    return (ScreenRow)_double_bits(row >> 32) << 64 | _double_bits(row);
+}
+
+uint64_t GetLowResolutionRow(const Chip *chip, int plane, int y)
+{
+    if (!chip->high_resolution)
+    {
+        return chip->screen[plane][y] >> 64;
+    }
+    ScreenRow row = chip->screen[plane][y * 2];
+    return (uint64_t)_halve_bits(row >> 64) << 32 | _halve_bits(row);
+}
+
+void UnpackScreen(const Chip *chip,
+                  uint8_t pixels[HIRES_DISPLAY_HEIGHT_IN_PIXELS][HIRES_DISPLAY_WIDTH_IN_PIXELS])
+{
+    memset(pixels, 0, HIRES_DISPLAY_HEIGHT_IN_PIXELS * HIRES_DISPLAY_WIDTH_IN_PIXELS);
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        for (int i = 0; i < HIRES_DISPLAY_HEIGHT_IN_PIXELS; i++)
+        {
+            ScreenRow row = GetDisplayRow(chip, plane, i);
+            for (int j = 0; j < HIRES_DISPLAY_WIDTH_IN_PIXELS; j++)
+            {
+                pixels[i][j] |= ((row >> (SCREEN_ROW_BITS - 1 - j)) & 1) << plane;
+            }
+        }
+    }
+}
+
+uint64_t HashROM(const uint8_t *data, size_t size)
+{
+    return _fnv1a(FNV_OFFSET_BASIS, data, size);
 }
 
 void _PrintMemory(Chip *chip)
@@ -97,11 +387,16 @@ void _PrintMemory(Chip *chip)
 void _PrintDisplay(Chip *chip)
 {
     printf("DISPLAY:\n");
-    for (int i = 0; i < DISPLAY_HEIGHT_IN_PIXELS; i++)
+    for (int i = 0; i < GetScreenHeight(chip); i++)
     {
-        for (int j = 0; j < DISPLAY_WIDTH_IN_PIXELS; j++)
+        for (int j = 0; j < GetScreenWidth(chip); j++)
         {
-            printf("%d ", chip->screen[i][j]);
+            int color = 0;
+            for (int plane = 0; plane < NUM_PLANES; plane++)
+            {
+                color |= ((chip->screen[plane][i] >> (SCREEN_ROW_BITS - 1 - j)) & 1) << plane;
+            }
+            printf("%d ", color);
         }
         printf("\n");
     }
@@ -114,4 +409,45 @@ static void LoadFontSet(Chip *chip)
     {
         chip->memory[i + FONT_SET_START] = FONT_SET[i];
     }
+    for (int i = 0; i < BIG_FONT_SET_LENGTH; i++)
+    {
+        chip->memory[i + BIG_FONT_SET_START] = BIG_FONT_SET[i];
+    }
+}
+
+static uint64_t _spread_bits(uint32_t bits)
+{
+    uint64_t spread = bits;
+    spread = (spread | (spread << 16)) & 0x0000FFFF0000FFFFULL;
+    spread = (spread | (spread << 8)) & 0x00FF00FF00FF00FFULL;
+    spread = (spread | (spread << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    spread = (spread | (spread << 2)) & 0x3333333333333333ULL;
+    return (spread | (spread << 1)) & 0x5555555555555555ULL;
+}
+
+static uint64_t _double_bits(uint32_t bits)
+{
+    uint64_t spread = _spread_bits(bits);
+    return spread | (spread << 1);
+}
+
+static uint32_t _halve_bits(uint64_t bits)
+{
+    bits = (bits >> 1) & 0x5555555555555555ULL;
+    bits = (bits | (bits >> 1)) & 0x3333333333333333ULL;
+    bits = (bits | (bits >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    bits = (bits | (bits >> 4)) & 0x00FF00FF00FF00FFULL;
+    bits = (bits | (bits >> 8)) & 0x0000FFFF0000FFFFULL;
+    return bits | (bits >> 16);
+}
+
+static uint64_t _fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
 }
\ No newline at end of file
@@ -1,21 +1,146 @@
 #ifndef _CHIP_H
 #define _CHIP_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #define NUM_REGISTERS 16
-#define MEMORY_SIZE 4096
+#define MEMORY_SIZE 65536
 #define STACK_SIZE 16
 #define MEMORY_START 0x200
+#define MAX_ROM_SIZE (MEMORY_SIZE - MEMORY_START)
 
 #define FONT_SET_LENGTH 80
 #define FONT_SET_START 0x50
 #define FONT_SPRITE_SIZE 0x5
 
+// SUPER-CHIP's 8x10 digits, for Fx30
+#define BIG_FONT_SET_LENGTH 160
+#define BIG_FONT_SET_START (FONT_SET_START + FONT_SET_LENGTH)
+#define BIG_FONT_SPRITE_SIZE 10
+
 #define DISPLAY_WIDTH_IN_PIXELS 64
 #define DISPLAY_HEIGHT_IN_PIXELS 32
 
+// SUPER-CHIP's high resolution, which is also the size of the screen
+// buffer and of the frames shown to the user
+#define HIRES_DISPLAY_WIDTH_IN_PIXELS 128
+#define HIRES_DISPLAY_HEIGHT_IN_PIXELS 64
+
+// One row of the screen, one bit per pixel with the leftmost pixel in
+// the most significant bit. In low resolution only the top 64 bits of
+// the first 32 rows are used, and the rest stay clear.
+typedef unsigned __int128 ScreenRow;
+
+#define SCREEN_ROW_BITS 128
+
+// XO-CHIP's bitplanes. Each is a separate screen; a pixel's color is
+// the set of planes it is lit in, and Fn01 picks the planes that
+// 00E0, the scrolls and Dxyn act on.
+#define NUM_PLANES 2
+#define ALL_PLANES ((1 << NUM_PLANES) - 1)
+
+// The RPL user flags, saved and restored by Fx75 and Fx85. SUPER-CHIP
+// had 8 and XO-CHIP has 16.
+#define NUM_RPL_FLAGS 16
+
+// XO-CHIP's audio: F002 loads a pattern of 128 one-bit samples, played
+// while the sound timer runs at 4000 * 2^((pitch - 64) / 48) samples
+// per second, with the pitch set by Fx3A.
+#define AUDIO_PATTERN_SIZE 16
+#define DEFAULT_AUDIO_PITCH 64
+
+#define NUM_KEYS 16
+
+// Guest addresses wrap around memory, so every access made through
+// MEMORY_ADDRESS is in bounds without a branch, whatever I and the
+// program counter hold. MEMORY_SIZE must be a power of two.
+#define MEMORY_MASK (MEMORY_SIZE - 1)
+#define MEMORY_ADDRESS(address) ((address) & MEMORY_MASK)
+
+// Memory is split into pages of 64 bytes for tracking which parts hold
+// predecoded code, with one bit per page in 64-bit words.
+#define CODE_PAGE_SHIFT 6
+#define NUM_CODE_PAGES (MEMORY_SIZE >> CODE_PAGE_SHIFT)
+#define NUM_CODE_PAGE_WORDS (NUM_CODE_PAGES / 64)
+
+// Reasons a Chip-8 can stop executing on its own. The opcode that
+// traps does not execute, so the program counter stays at it.
+typedef enum
+{
+    TRAP_NONE,
+    TRAP_UNKNOWN_OPCODE,
+    TRAP_STACK_OVERFLOW,  // 2nnn with all STACK_SIZE - 1 levels in use
+    TRAP_STACK_UNDERFLOW, // 00EE with an empty stack
+    TRAP_EXITED,          // 00FD: the ROM asked to exit
+    NUM_TRAPS,
+} Trap;
+
+extern const char *const TRAP_NAMES[NUM_TRAPS];
+
+// Behaviors in which CHIP-8 interpreters disagree, as bit flags. With
+// none set, a Chip-8 behaves like ninechipper always has.
+#define QUIRK_SHIFT_USES_VY 0x01         // 8xy6 and 8xyE shift Vy into Vx, not Vx in place
+#define QUIRK_LOAD_STORE_ADVANCES_I 0x02 // Fx55 and Fx65 leave I past the last register
+#define QUIRK_JUMP_USES_VX 0x04          // Bxnn jumps to xnn + Vx, not nnn + V0
+#define QUIRK_SPRITES_CLIP 0x08          // Dxyn clips sprites at the screen's edges, not wraps
+#define QUIRK_LOGIC_RESETS_VF 0x10       // 8xy1, 8xy2 and 8xy3 set VF to 0
+
+// Sets of quirks that ROMs are written for, as X(profile, name, quirks).
+// The core is compiled once per profile, with its quirks as constants.
+#define QUIRK_PROFILES(X)                                                  \
+    X(QUIRKS_DEFAULT, "default", 0)                                        \
+    X(QUIRKS_COSMAC_VIP, "vip",                                            \
+      QUIRK_SHIFT_USES_VY | QUIRK_LOAD_STORE_ADVANCES_I | QUIRK_SPRITES_CLIP | \
+          QUIRK_LOGIC_RESETS_VF)                                           \
+    X(QUIRKS_SUPER_CHIP, "schip", QUIRK_JUMP_USES_VX | QUIRK_SPRITES_CLIP)          \
+    X(QUIRKS_XO_CHIP, "xochip", QUIRK_SHIFT_USES_VY | QUIRK_LOAD_STORE_ADVANCES_I)
+
+#define QUIRK_PROFILE_ENUMERATOR(profile, name, quirks) profile,
+
+typedef enum
+{
+    QUIRK_PROFILES(QUIRK_PROFILE_ENUMERATOR)
+    NUM_QUIRK_PROFILES,
+} QuirkProfile;
+
+extern const char *const QUIRK_PROFILE_NAMES[NUM_QUIRK_PROFILES];
+extern const uint8_t QUIRK_PROFILE_QUIRKS[NUM_QUIRK_PROFILES];
+
+// Reasons a ROM can fail to load.
+typedef enum
+{
+    ROM_OK,
+    ROM_OPEN_FAILED, // the file does not exist or cannot be opened
+    ROM_NOT_A_FILE,  // a directory or other non-regular file
+    ROM_TOO_LARGE,   // larger than MAX_ROM_SIZE
+    ROM_READ_FAILED, // the file could not be mapped
+    NUM_ROM_ERRORS,
+} ROMError;
+
+extern const char *const ROM_ERROR_NAMES[NUM_ROM_ERRORS];
+
+// A ROM's contents, read once to be loaded into many Chip-8s.
+typedef struct
+{
+    uint8_t data[MAX_ROM_SIZE];
+    size_t size;
+} ROMImage;
+
+// Decoded opcodes cached by the predecoded backend; see predecode.h.
+typedef struct PredecodeCache PredecodeCache;
+
+// Called when the sound timer starts or stops, with the chip's
+// cycle_count at that moment. Not called by the lockstep engine.
+typedef void (*SoundHook)(void *context, uint64_t cycle, bool on);
+
+// Called when F002 or Fx3A changes the audio pattern or pitch, with the
+// new ones and the chip's cycle_count. Not called by the lockstep
+// engine.
+typedef void (*SoundPatternHook)(void *context, uint64_t cycle,
+                                 const uint8_t pattern[AUDIO_PATTERN_SIZE], uint8_t pitch);
+
 typedef struct
 {
     uint8_t registers[NUM_REGISTERS];
@@ -26,7 +151,24 @@ typedef struct
     uint16_t stack[STACK_SIZE];
     uint8_t stack_pointer;
     uint8_t *memory;
-    uint8_t screen[DISPLAY_HEIGHT_IN_PIXELS][DISPLAY_WIDTH_IN_PIXELS];
+    ScreenRow screen[NUM_PLANES][HIRES_DISPLAY_HEIGHT_IN_PIXELS];
+    bool high_resolution;  // set by 00FF, cleared by 00FE
+    uint8_t planes;        // bit p is set if Fn01 selected plane p
+    uint8_t rpl_flags[NUM_RPL_FLAGS];
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint8_t audio_pitch;
+    bool has_audio_pattern; // F002 has run, so the pattern replaces the buzzer
+    uint16_t keypad;       // bit k is set while key k is held down
+    uint32_t rng_state;    // xorshift32 state used by Cxkk
+    uint64_t cycle_count;  // number of opcodes executed so far
+    Trap trap;
+    bool waiting_for_key;  // blocked in Fx0A until a key is held
+    QuirkProfile quirk_profile; // QUIRKS_DEFAULT unless chosen for the ROM
+    SoundHook sound_hook;  // optional
+    SoundPatternHook sound_pattern_hook; // optional
+    void *sound_context;   // passed to both sound hooks
+    PredecodeCache *predecode; // created on first predecoded run
+    uint64_t code_pages[NUM_CODE_PAGE_WORDS]; // one bit per page holding predecoded code
     bool needs_drawing;
 } Chip;
 
@@ -35,13 +177,78 @@ typedef struct
 // that has not ran any ROM code.
 Chip *InitializeChip();
 
+// Allocates and returns a copy of the given Chip-8, including
+// its memory but not its predecode cache. Returns NULL if out of memory.
+Chip *CloneChip(const Chip *chip);
+
+// Copies the state and memory of `source` into `destination`,
+// keeping the destination's memory and predecode cache. Used to restore
+// a Chip-8 from a snapshot taken with CloneChip.
+void CopyChip(Chip *destination, const Chip *source);
+
 // Frees the given Chip-8.
 void FreeChip(Chip *chip);
 
-// Loads a ROM with the given filename into the Chip-8.
-// Crashes if the ROM is too large, or if there is an
-// error opening the ROM.
-void LoadROM(Chip *chip, const char *filename);
+// Loads the ROM file with the given filename into the Chip-8, mapping
+// it into memory and copying it once. Leaves the Chip-8 unchanged and
+// returns the reason if it cannot be loaded.
+ROMError LoadROM(Chip *chip, const char *filename);
+
+// Loads `size` bytes of ROM from `data` into the Chip-8. Leaves the
+// Chip-8 unchanged and returns ROM_TOO_LARGE if they do not fit.
+ROMError LoadROMFromBuffer(Chip *chip, const uint8_t *data, size_t size);
+
+// Reads the ROM file with the given filename into `image`, for loading
+// with LoadROMFromBuffer. Returns the reason if it cannot be read.
+ROMError ReadROMImage(ROMImage *image, const char *filename);
+
+// Returns the profile with the given name, e.g. from a command line,
+// or NUM_QUIRK_PROFILES if there is none.
+QuirkProfile FindQuirkProfile(const char *name);
+
+// Seeds the Chip-8's random number generator. Two Chip-8s running
+// the same ROM with the same seed and input behave identically.
+void SeedChip(Chip *chip, uint32_t seed);
+
+// Returns the next byte from the Chip-8's random number generator.
+uint8_t NextRandomByte(Chip *chip);
+
+// Decrements the delay and sound timers if they are nonzero.
+// Should be called at 60 Hz of emulated time.
+void TickTimers(Chip *chip);
+
+// Returns a 64-bit FNV-1a hash of the Chip-8's architectural state:
+// registers, timers, program counter, stack, memory, RPL flags, audio
+// pattern and screen.
+uint64_t HashChipState(const Chip *chip);
+
+// Returns a 64-bit FNV-1a hash of the Chip-8's screen buffer, all
+// planes of it, and resolution.
+uint64_t HashScreen(const Chip *chip);
+
+// Returns the width and height of the screen in its current
+// resolution, in pixels.
+int GetScreenWidth(const Chip *chip);
+int GetScreenHeight(const Chip *chip);
+
+// Returns row `y` of the plane as shown at high resolution: in low
+// resolution, every pixel is doubled in both directions.
+ScreenRow GetDisplayRow(const Chip *chip, int plane, int y);
+
+// Returns row `y` of the plane as shown at low resolution, in the
+// low 64 bits: in high resolution, the top-left pixel of each 2x2
+// block of row 2y and 2y + 1.
+uint64_t GetLowResolutionRow(const Chip *chip, int plane, int y);
+
+// Writes the screen as shown at high resolution into `pixels`, one
+// byte per pixel holding its color: bit p is set if it is lit in
+// plane p, so ROMs that draw to one plane only give 0 and 1.
+void UnpackScreen(const Chip *chip,
+                  uint8_t pixels[HIRES_DISPLAY_HEIGHT_IN_PIXELS][HIRES_DISPLAY_WIDTH_IN_PIXELS]);
+
+// Returns a 64-bit FNV-1a hash of `size` bytes of ROM, which names the
+// ROM's contents in archives and caches.
+uint64_t HashROM(const uint8_t *data, size_t size);
 
 // Prints the contents of the Chip-8's memory to stdout.
 void _PrintMemory(Chip *chip);
@@ -1,8 +1,41 @@
 #include <SDL2/SDL.h>
+#include <ctype.h>
 #include <stdint.h>
 
 #include "display.h"
 
+#define GLYPH_WIDTH 3
+#define GLYPH_HEIGHT 5
+#define OVERLAY_SCALE 2
+#define OVERLAY_MARGIN 4
+
+// ARGB for each pixel color: off, plane 0, plane 1, both planes
+static const uint32_t PALETTE[1 << NUM_PLANES] = {0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFFC0C0C0};
+
+// 3x5 pixel glyphs for ' ' to 'Z', one row per byte, leftmost pixel
+// in bit 2. Lowercase letters are drawn as uppercase.
+static const uint8_t OVERLAY_FONT['Z' - ' ' + 1][GLYPH_HEIGHT] =
+    {
+        {0, 0, 0, 0, 0}, {2, 2, 2, 0, 2}, {5, 5, 0, 0, 0}, {5, 7, 5, 7, 5}, // ' ' ! " #
+        {3, 6, 2, 3, 6}, {5, 1, 2, 4, 5}, {2, 5, 2, 5, 3}, {2, 2, 0, 0, 0}, // $ % & '
+        {1, 2, 2, 2, 1}, {4, 2, 2, 2, 4}, {0, 5, 2, 5, 0}, {0, 2, 7, 2, 0}, // ( ) * +
+        {0, 0, 0, 2, 4}, {0, 0, 7, 0, 0}, {0, 0, 0, 0, 2}, {1, 1, 2, 4, 4}, // , - . /
+        {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7}, // 0 1 2 3
+        {5, 5, 7, 1, 1}, {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1}, // 4 5 6 7
+        {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}, {0, 2, 0, 2, 0}, {0, 2, 0, 2, 4}, // 8 9 : ;
+        {1, 2, 4, 2, 1}, {0, 7, 0, 7, 0}, {4, 2, 1, 2, 4}, {7, 1, 3, 0, 2}, // < = > ?
+        {7, 5, 7, 4, 7}, {2, 5, 7, 5, 5}, {6, 5, 6, 5, 6}, {3, 4, 4, 4, 3}, // @ A B C
+        {6, 5, 5, 5, 6}, {7, 4, 6, 4, 7}, {7, 4, 6, 4, 4}, {3, 4, 5, 5, 3}, // D E F G
+        {5, 5, 7, 5, 5}, {7, 2, 2, 2, 7}, {1, 1, 1, 5, 2}, {5, 5, 6, 5, 5}, // H I J K
+        {4, 4, 4, 4, 7}, {5, 7, 7, 5, 5}, {6, 5, 5, 5, 5}, {2, 5, 5, 5, 2}, // L M N O
+        {6, 5, 6, 4, 4}, {2, 5, 5, 6, 3}, {6, 5, 6, 5, 5}, {3, 4, 2, 1, 6}, // P Q R S
+        {7, 2, 2, 2, 2}, {5, 5, 5, 5, 7}, {5, 5, 5, 5, 2}, {5, 5, 7, 7, 5}, // T U V W
+        {5, 5, 2, 5, 5}, {5, 5, 2, 2, 2}, {7, 1, 2, 4, 7},                  // X Y Z
+};
+
+// Draws `text` over a translucent box in the top left corner.
+static void _draw_overlay(Display *display, const char *text);
+
 Display *InitializeDisplay()
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
@@ -26,7 +59,8 @@ Display *InitializeDisplay()
 
     display->window = win;
 
-    SDL_Renderer *renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+    SDL_Renderer *renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED |
+                                                             SDL_RENDERER_PRESENTVSYNC);
 
     if (!renderer)
     {
@@ -36,8 +70,13 @@ Display *InitializeDisplay()
 
     display->renderer = renderer;
 
+    SDL_RendererInfo info;
+    display->vsync = SDL_GetRendererInfo(renderer, &info) == 0 &&
+                     (info.flags & SDL_RENDERER_PRESENTVSYNC);
+    display->show_overlay = false;
+
     SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
-                                             DISPLAY_WIDTH_IN_PIXELS, DISPLAY_HEIGHT_IN_PIXELS);
+                                             HIRES_DISPLAY_WIDTH_IN_PIXELS, HIRES_DISPLAY_HEIGHT_IN_PIXELS);
     if (!texture)
     {
         fprintf(stderr, "error creating texture: %s\n", SDL_GetError());
@@ -49,7 +88,7 @@ Display *InitializeDisplay()
     return display;
 }
 
-bool ProcessEvents(Chip *chip)
+bool ProcessEvents(Display *display, Input *input)
 {
     SDL_Event event;
     while (SDL_PollEvent(&event))
@@ -58,35 +97,40 @@ bool ProcessEvents(Chip *chip)
         {
         case SDL_QUIT:
             return false;
+        case SDL_KEYDOWN:
+            if (event.key.keysym.scancode == OVERLAY_TOGGLE_KEY && !event.key.repeat)
+            {
+                display->show_overlay = !display->show_overlay;
+            }
+            HandleKeyEvent(input, &event.key);
+            break;
+        case SDL_KEYUP:
+            HandleKeyEvent(input, &event.key);
+            break;
         }
     }
     return true;
 }
 
-void RenderDisplay(Display *display, Chip *chip)
+void RenderDisplay(Display *display,
+                   const uint8_t screen[HIRES_DISPLAY_HEIGHT_IN_PIXELS][HIRES_DISPLAY_WIDTH_IN_PIXELS],
+                   const char *overlay)
 {
-    SDL_RenderClear(display->renderer);
-    SDL_Rect rect;
-    for (int i = 0; i < DISPLAY_HEIGHT_IN_PIXELS; i++)
+    for (int i = 0; i < HIRES_DISPLAY_HEIGHT_IN_PIXELS; i++)
     {
-        for (int j = 0; j < DISPLAY_WIDTH_IN_PIXELS; j++)
+        for (int j = 0; j < HIRES_DISPLAY_WIDTH_IN_PIXELS; j++)
         {
-            uint8_t current_pixel = chip->screen[i][j];
-            rect.x = i * DISPLAY_SCALE;
-            rect.y = j * DISPLAY_SCALE;
-            rect.w = DISPLAY_SCALE;
-            rect.h = DISPLAY_SCALE;
-            if (current_pixel == 0x1)
-            {
-                SDL_SetRenderDrawColor(display->renderer, 0xff, 0xff, 0xff, SDL_ALPHA_OPAQUE);
-            }
-            else
-            {
-                SDL_SetRenderDrawColor(display->renderer, 0x0, 0x0, 0x0, SDL_ALPHA_OPAQUE);
-            }
-            SDL_RenderDrawRect(display->renderer, &rect);
+            display->pixels[i][j] = PALETTE[screen[i][j] & ALL_PLANES];
         }
     }
+    SDL_UpdateTexture(display->texture, NULL, display->pixels,
+                      sizeof(display->pixels[0]));
+    SDL_RenderClear(display->renderer);
+    SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+    if (overlay)
+    {
+        _draw_overlay(display, overlay);
+    }
     SDL_RenderPresent(display->renderer);
 }
 
@@ -97,4 +141,63 @@ void CleanUpDisplay(Display *display)
     SDL_DestroyWindow(display->window);
     SDL_Quit();
     free(display);
+}
+
+static void _draw_overlay(Display *display, const char *text)
+{
+    const int advance = (GLYPH_WIDTH + 1) * OVERLAY_SCALE;
+    const int line_height = (GLYPH_HEIGHT + 2) * OVERLAY_SCALE;
+
+    int columns = 0;
+    int lines = 0;
+    int column = 0;
+    for (const char *c = text; *c; c++)
+    {
+        column = *c == '\n' ? 0 : column + 1;
+        lines += *c == '\n';
+        columns = column > columns ? column : columns;
+    }
+    lines += column > 0;
+
+    SDL_Rect box = {0, 0, columns * advance + 2 * OVERLAY_MARGIN,
+                    lines * line_height + 2 * OVERLAY_MARGIN};
+    SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(display->renderer, 0, 0, 0, 192);
+    SDL_RenderFillRect(display->renderer, &box);
+
+    SDL_SetRenderDrawColor(display->renderer, 0, 255, 0, 255);
+    int x = OVERLAY_MARGIN;
+    int y = OVERLAY_MARGIN;
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '\n')
+        {
+            x = OVERLAY_MARGIN;
+            y += line_height;
+            continue;
+        }
+        char upper = toupper((unsigned char)*c);
+        if (upper >= ' ' && upper <= 'Z')
+        {
+            SDL_Rect pixels[GLYPH_WIDTH * GLYPH_HEIGHT];
+            int count = 0;
+            const uint8_t *glyph = OVERLAY_FONT[upper - ' '];
+            for (int row = 0; row < GLYPH_HEIGHT; row++)
+            {
+                for (int bit = 0; bit < GLYPH_WIDTH; bit++)
+                {
+                    if (glyph[row] & (4 >> bit))
+                    {
+                        pixels[count++] = (SDL_Rect){x + bit * OVERLAY_SCALE,
+                                                     y + row * OVERLAY_SCALE,
+                                                     OVERLAY_SCALE, OVERLAY_SCALE};
+                    }
+                }
+            }
+            SDL_RenderFillRects(display->renderer, pixels, count);
+        }
+        x += advance;
+    }
+    SDL_SetRenderDrawColor(display->renderer, 0, 0, 0, 255);
+    SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_NONE);
 }
\ No newline at end of file
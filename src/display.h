@@ -5,26 +5,39 @@
 #include <SDL2/SDL.h>
 
 #include "chip.h"
+#include "input.h"
 
 #define DISPLAY_SCALE 10
 
 #define DISPLAY_TITLE "ninechipper"
 
+// Key that shows and hides the statistics overlay
+#define OVERLAY_TOGGLE_KEY SDL_SCANCODE_F1
+
 typedef struct
 {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    uint32_t pixels[HIRES_DISPLAY_HEIGHT_IN_PIXELS][HIRES_DISPLAY_WIDTH_IN_PIXELS];
+    bool vsync;
+    bool show_overlay;
 } Display;
 
 // Create and set up the SDL Window
 Display *InitializeDisplay();
 
-// Process game events, updates keyboard
-bool ProcessEvents(Chip *chip);
-
-// Render current state of Chip8 to screen
-void RenderDisplay(Display *display, Chip *chip);
+// Process all pending events, feeding key events to `input` and
+// toggling the overlay on OVERLAY_TOGGLE_KEY.
+// Call once per host frame. Returns false once the user quits.
+bool ProcessEvents(Display *display, Input *input);
+
+// Render a screen unpacked by UnpackScreen to the window, with `overlay` text
+// drawn over its top left corner unless it is NULL. Blocks until the
+// next vertical blank if the renderer supports vsync.
+void RenderDisplay(Display *display,
+                   const uint8_t screen[HIRES_DISPLAY_HEIGHT_IN_PIXELS][HIRES_DISPLAY_WIDTH_IN_PIXELS],
+                   const char *overlay);
 
 // Cleans up resources upon exit
 void CleanUpDisplay(Display *display);
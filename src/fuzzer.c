@@ -0,0 +1,220 @@
+#include "fuzzer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+
+// Events past this many in an input's movie are ignored
+#define MAX_MOVIE_EVENTS 4096
+
+const char *const FUZZ_RESULT_NAMES[NUM_FUZZ_RESULTS] =
+    {"ok", "hang", "trapped", "pc-out-of-range", "memory-out-of-range",
+     "stack-overflow", "stack-underflow"};
+
+struct FuzzTarget
+{
+    Chip *snapshot;
+    Chip *chip;
+    uint8_t *coverage;
+    uint64_t cycle_budget;
+    uint32_t cycles_per_frame;
+    uint16_t previous_location; // of the last opcode, for edge coverage
+    MovieEvent events[MAX_MOVIE_EVENTS];
+    InputMovie movie;
+};
+
+// Restores the Chip-8 from the snapshot and loads the input's ROM and movie
+static void _load(FuzzTarget *target, const uint8_t *data, size_t size);
+
+// Checks and executes one opcode. Returns false, filling in the
+// report's result, if the input has finished.
+static bool _step(FuzzTarget *target, Chip *chip, FuzzReport *report);
+
+// Returns the result of running `op` in the Chip-8's current state:
+// FUZZ_OK if it is safe to run, else the kind of crash it would cause
+static FuzzResult _check(const Chip *chip, opcode op);
+
+FuzzTarget *CreateFuzzTarget(uint8_t *coverage, uint64_t cycle_budget,
+                             uint32_t cycles_per_frame)
+{
+    FuzzTarget *target = (FuzzTarget *)(calloc(1, sizeof(FuzzTarget)));
+    if (!target)
+    {
+        return NULL;
+    }
+    target->snapshot = InitializeChip();
+    target->chip = CloneChip(target->snapshot);
+    target->coverage = coverage;
+    target->cycle_budget = cycle_budget;
+    target->cycles_per_frame = cycles_per_frame;
+    target->movie.events = target->events;
+    return target;
+}
+
+void FreeFuzzTarget(FuzzTarget *target)
+{
+    FreeChip(target->snapshot);
+    FreeChip(target->chip);
+    free(target);
+}
+
+void RunFuzzInput(FuzzTarget *target, const uint8_t *data, size_t size,
+                  FuzzReport *report)
+{
+    _load(target, data, size);
+    Chip *chip = target->chip;
+    report->result = FUZZ_HANG;
+    report->pc = chip->program_counter;
+    report->op = 0;
+
+    size_t cursor = 0;
+    bool running = true;
+    for (uint32_t frame = 0; running && chip->cycle_count < target->cycle_budget; frame++)
+    {
+        ApplyInputMovie(&target->movie, &cursor, frame, chip);
+        for (uint32_t i = 0; i < target->cycles_per_frame && running &&
+                             chip->cycle_count < target->cycle_budget;
+             i++)
+        {
+            running = _step(target, chip, report);
+            if (chip->waiting_for_key)
+            {
+                break;
+            }
+        }
+        // Nothing can release a Chip-8 waiting for a key once the
+        // movie has ended with no key held.
+        if (running && chip->waiting_for_key && !chip->keypad &&
+            cursor == target->movie.count)
+        {
+            report->result = FUZZ_OK;
+            running = false;
+        }
+        TickTimers(chip);
+    }
+    report->cycles = chip->cycle_count;
+}
+
+static void _load(FuzzTarget *target, const uint8_t *data, size_t size)
+{
+    size_t rom_size = size;
+    const uint8_t *movie = NULL;
+    for (size_t i = 0; i + MOVIE_MARKER_LENGTH <= size; i++)
+    {
+        if (memcmp(data + i, MOVIE_MARKER, MOVIE_MARKER_LENGTH) == 0)
+        {
+            rom_size = i;
+            movie = data + i + MOVIE_MARKER_LENGTH;
+            break;
+        }
+    }
+
+    target->movie.count = 0;
+    if (movie)
+    {
+        uint32_t frame = 0;
+        const uint8_t *end = data + size;
+        for (; movie + MOVIE_EVENT_SIZE <= end && target->movie.count < MAX_MOVIE_EVENTS;
+             movie += MOVIE_EVENT_SIZE)
+        {
+            frame += movie[0];
+            MovieEvent *event = &target->events[target->movie.count++];
+            event->frame = frame;
+            event->keypad = (movie[1] << 8) | movie[2];
+        }
+    }
+
+    Chip *chip = target->chip;
+    CopyChip(chip, target->snapshot);
+    LoadROMFromBuffer(chip, data, rom_size < MAX_ROM_SIZE ? rom_size : MAX_ROM_SIZE);
+    target->previous_location = 0;
+}
+
+static bool _step(FuzzTarget *target, Chip *chip, FuzzReport *report)
+{
+    uint16_t pc = chip->program_counter;
+    report->pc = pc;
+    if (pc + 1 >= MEMORY_SIZE)
+    {
+        report->result = FUZZ_PC_OUT_OF_RANGE;
+        return false;
+    }
+    opcode op = (chip->memory[pc] << 8) | chip->memory[pc + 1];
+    report->op = op;
+    // F000 nnnn is the only opcode four bytes long.
+    if ((op & 0xF0FF) == 0xF000 && pc + 3 >= MEMORY_SIZE)
+    {
+        report->result = FUZZ_PC_OUT_OF_RANGE;
+        return false;
+    }
+
+    // AFL-style edges: the previous location is halved so that A -> B
+    // and B -> A, and A -> A and B -> B, count as different edges.
+    uint16_t location = (pc * 40503u) & (COVERAGE_MAP_SIZE - 1);
+    target->coverage[location ^ target->previous_location]++;
+    target->previous_location = location >> 1;
+
+    FuzzResult result = _check(chip, op);
+    if (result != FUZZ_OK)
+    {
+        report->result = result;
+        return false;
+    }
+    // A jump to itself never exits.
+    if (op == (0x1000 | pc))
+    {
+        report->result = FUZZ_OK;
+        return false;
+    }
+    ExecuteOpcode(chip);
+    switch (chip->trap)
+    {
+    case TRAP_NONE:
+        return true;
+    case TRAP_EXITED:
+        report->result = FUZZ_OK;
+        return false;
+    case TRAP_STACK_OVERFLOW:
+        report->result = FUZZ_STACK_OVERFLOW;
+        return false;
+    case TRAP_STACK_UNDERFLOW:
+        report->result = FUZZ_STACK_UNDERFLOW;
+        return false;
+    default:
+        report->result = FUZZ_TRAPPED;
+        return false;
+    }
+}
+
+static FuzzResult _check(const Chip *chip, opcode op)
+{
+    uint16_t address = chip->address_register;
+    uint8_t x = (op >> 8) & 0xF;
+    uint8_t y = (op >> 4) & 0xF;
+    // A sprite is drawn from consecutive bytes for each selected plane.
+    int sprite_size = ((op & 0xF) ? (op & 0xF) : 32) * __builtin_popcount(chip->planes);
+    if ((op & 0xF000) == 0xD000 && address + sprite_size > MEMORY_SIZE)
+    {
+        return FUZZ_MEMORY_OUT_OF_RANGE;
+    }
+    if ((op & 0xF0FF) == 0xF033 && address + 3 > MEMORY_SIZE)
+    {
+        return FUZZ_MEMORY_OUT_OF_RANGE;
+    }
+    if (((op & 0xF0FF) == 0xF055 || (op & 0xF0FF) == 0xF065) &&
+        address + x + 1 > MEMORY_SIZE)
+    {
+        return FUZZ_MEMORY_OUT_OF_RANGE;
+    }
+    if (((op & 0xF00F) == 0x5002 || (op & 0xF00F) == 0x5003) &&
+        address + abs(x - y) + 1 > MEMORY_SIZE)
+    {
+        return FUZZ_MEMORY_OUT_OF_RANGE;
+    }
+    if ((op & 0xF0FF) == 0xF002 && address + AUDIO_PATTERN_SIZE > MEMORY_SIZE)
+    {
+        return FUZZ_MEMORY_OUT_OF_RANGE;
+    }
+    return FUZZ_OK;
+}
@@ -0,0 +1,74 @@
+#ifndef _FUZZER_H
+#define _FUZZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip.h"
+#include "opcodes.h"
+
+// Runs fuzzer inputs against the core, recording guest edge coverage
+// and checking every opcode for out-of-range accesses before it runs.
+//
+// An input is a ROM, optionally followed by MOVIE_MARKER and a keypad
+// movie of 3-byte events: the number of frames since the previous
+// event, then the 16-bit keypad mask, high byte first. ROM bytes past
+// the end of memory are ignored.
+//
+// Each input starts from a snapshot of a freshly initialized Chip-8,
+// restored in place, so running one costs no allocations.
+
+#define MOVIE_MARKER "KEYS"
+#define MOVIE_MARKER_LENGTH 4
+#define MOVIE_EVENT_SIZE 3
+
+// Size of the coverage map, the same as AFL's default bitmap
+#define COVERAGE_MAP_SIZE 65536
+
+typedef enum
+{
+    FUZZ_OK,                  // ran until halted or exited, or blocked with no input left
+    FUZZ_HANG,                // still running when the cycle budget ran out
+    FUZZ_TRAPPED,             // trapped on an unknown opcode
+    FUZZ_PC_OUT_OF_RANGE,     // fetched an opcode past the end of memory
+    FUZZ_MEMORY_OUT_OF_RANGE, // accessed memory[I + n] past the end of memory
+    FUZZ_STACK_OVERFLOW,      // trapped calling a subroutine with the stack full
+    FUZZ_STACK_UNDERFLOW,     // trapped returning with the stack empty
+    NUM_FUZZ_RESULTS,
+} FuzzResult;
+
+extern const char *const FUZZ_RESULT_NAMES[NUM_FUZZ_RESULTS];
+
+// Results from FUZZ_PC_OUT_OF_RANGE on are bugs in the ROM. The core
+// wraps out-of-range addresses around memory and traps on stack
+// errors, so they are safe, but a ROM that makes them almost
+// certainly misbehaves.
+#define IS_FUZZ_CRASH(result) ((result) >= FUZZ_PC_OUT_OF_RANGE)
+
+typedef struct
+{
+    FuzzResult result;
+    uint16_t pc;     // program counter of the last opcode checked
+    opcode op;       // and the opcode there
+    uint64_t cycles; // opcodes executed
+} FuzzReport;
+
+typedef struct FuzzTarget FuzzTarget;
+
+// Returns a new target that runs each input for at most `cycle_budget`
+// opcodes, `cycles_per_frame` per 60 Hz frame, counting edges into
+// `coverage`, which must hold COVERAGE_MAP_SIZE bytes. Returns NULL
+// on failure.
+FuzzTarget *CreateFuzzTarget(uint8_t *coverage, uint64_t cycle_budget,
+                             uint32_t cycles_per_frame);
+
+// Frees the target, but not its coverage map.
+void FreeFuzzTarget(FuzzTarget *target);
+
+// Resets the target's Chip-8 from its snapshot, loads the input and
+// runs it. Adds the (previous PC, PC) edges it takes to the coverage
+// map, which the caller clears between inputs if it wants to.
+void RunFuzzInput(FuzzTarget *target, const uint8_t *data, size_t size,
+                  FuzzReport *report);
+
+#endif
@@ -0,0 +1,120 @@
+#include "input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE_LENGTH 256
+
+static const SDL_Scancode DEFAULT_KEYMAP[NUM_KEYS] =
+    {
+        SDL_SCANCODE_X, // 0
+        SDL_SCANCODE_1, // 1
+        SDL_SCANCODE_2, // 2
+        SDL_SCANCODE_3, // 3
+        SDL_SCANCODE_Q, // 4
+        SDL_SCANCODE_W, // 5
+        SDL_SCANCODE_E, // 6
+        SDL_SCANCODE_A, // 7
+        SDL_SCANCODE_S, // 8
+        SDL_SCANCODE_D, // 9
+        SDL_SCANCODE_Z, // A
+        SDL_SCANCODE_C, // B
+        SDL_SCANCODE_4, // C
+        SDL_SCANCODE_R, // D
+        SDL_SCANCODE_F, // E
+        SDL_SCANCODE_V  // F
+};
+
+Input *InitializeInput()
+{
+    Input *input = (Input *)(calloc(1, sizeof(Input)));
+    for (int key = 0; key < NUM_KEYS; key++)
+    {
+        input->keymap[DEFAULT_KEYMAP[key]] = key + 1;
+    }
+    SDL_AtomicSet(&input->keypad, 0);
+    input->key_pressed = SDL_CreateSemaphore(0);
+    return input;
+}
+
+bool LoadKeymap(Input *input, const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    uint8_t keymap[SDL_NUM_SCANCODES] = {0};
+    char line[MAX_LINE_LENGTH];
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        unsigned int key;
+        int name_start;
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        valid = sscanf(line, "%x %n", &key, &name_start) == 1 && key < NUM_KEYS;
+        if (valid)
+        {
+            SDL_Scancode scancode = SDL_GetScancodeFromName(line + name_start);
+            valid = scancode != SDL_SCANCODE_UNKNOWN;
+            keymap[scancode] = key + 1;
+        }
+    }
+    fclose(file);
+
+    if (valid)
+    {
+        memcpy(input->keymap, keymap, sizeof(keymap));
+    }
+    return valid;
+}
+
+void HandleKeyEvent(Input *input, const SDL_KeyboardEvent *event)
+{
+    uint8_t mapped = input->keymap[event->keysym.scancode];
+    if (!mapped || event->repeat)
+    {
+        return;
+    }
+    // Only this thread writes the keypad, so a plain read-modify-write is safe.
+    uint16_t keypad = SDL_AtomicGet(&input->keypad);
+    uint16_t bit = 1 << (mapped - 1);
+    if (event->type == SDL_KEYDOWN)
+    {
+        SDL_AtomicSet(&input->keypad, keypad | bit);
+        // One pending wakeup is enough for the single waiter.
+        if (SDL_SemValue(input->key_pressed) == 0)
+        {
+            SDL_SemPost(input->key_pressed);
+        }
+    }
+    else
+    {
+        SDL_AtomicSet(&input->keypad, keypad & ~bit);
+    }
+}
+
+uint16_t GetKeypad(Input *input)
+{
+    return SDL_AtomicGet(&input->keypad);
+}
+
+bool WaitForKeyPress(Input *input, uint32_t timeout_ms)
+{
+    // Drop a wakeup left by a press from before the wait, which would
+    // otherwise end it at once.
+    SDL_SemTryWait(input->key_pressed);
+    return SDL_SemWaitTimeout(input->key_pressed, timeout_ms) == 0;
+}
+
+void CleanUpInput(Input *input)
+{
+    SDL_DestroySemaphore(input->key_pressed);
+    free(input);
+}
@@ -0,0 +1,51 @@
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#include "chip.h"
+
+// Keyboard input for the Chip-8 keypad.
+//
+// The main thread feeds SDL key events in as they arrive and keeps a
+// 16-bit keypad word up to date. The emulation thread reads that word
+// once per frame, and can sleep on a semaphore while a ROM waits in
+// Fx0A instead of spinning.
+
+typedef struct
+{
+    // CHIP-8 key plus one for each mapped scancode, 0 if unmapped
+    uint8_t keymap[SDL_NUM_SCANCODES];
+    SDL_atomic_t keypad;
+    SDL_sem *key_pressed;
+} Input;
+
+// Creates input state with the default keymap:
+//     1 2 3 4        1 2 3 C
+//     Q W E R   ->   4 5 6 D
+//     A S D F        7 8 9 E
+//     Z X C V        A 0 B F
+Input *InitializeInput();
+
+// Replaces the keymap with the one in the given file. Each line is
+// "<hex CHIP-8 key> <SDL scancode name>", e.g. "c 4" or "0 Keypad 0".
+// Returns false, leaving the keymap unchanged, if the file is invalid.
+bool LoadKeymap(Input *input, const char *filename);
+
+// Updates the keypad from a key press or release. Main thread only.
+void HandleKeyEvent(Input *input, const SDL_KeyboardEvent *event);
+
+// Returns the current keypad word. Safe to call from any thread.
+uint16_t GetKeypad(Input *input);
+
+// Blocks until a key is pressed or `timeout_ms` milliseconds pass.
+// Returns true if a key was pressed. Presses from before the call
+// don't count.
+bool WaitForKeyPress(Input *input, uint32_t timeout_ms);
+
+// Frees the input state.
+void CleanUpInput(Input *input);
+
+#endif
@@ -0,0 +1,484 @@
+#include "lockstep.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// GCC/Clang vector extensions; each value holds one byte or word per lane.
+typedef uint8_t LaneBytes __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int8_t LaneFlags __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t LaneWords __attribute__((vector_size(2 * LOCKSTEP_LANES)));
+typedef int16_t LaneWordFlags __attribute__((vector_size(2 * LOCKSTEP_LANES)));
+
+#define LANE_ALIGNMENT 64
+
+// The lane helpers below are static, so the vector calling convention
+// never crosses a translation unit and the ABI warnings do not apply.
+// GCC's note about 32-byte vector parameters ignores the pragma, and
+// is given even for inlined functions, so no function takes a vector
+// by value: helpers take them by pointer, or are macros.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// Returns `a` in lanes where `mask` is set and `b` elsewhere, for byte
+// or word lanes. `mask` is evaluated twice.
+#define SELECT_LANES(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+// Widens a byte mask to a word mask.
+#define WIDEN_MASK(mask) ((LaneWords)__builtin_convertvector((LaneFlags)(mask), LaneWordFlags))
+
+typedef struct
+{
+    LaneBytes registers[NUM_REGISTERS];
+    LaneWords program_counter;
+    LaneWords address_register;
+    LaneBytes delay_timer;
+    LaneBytes sound_timer;
+    LaneBytes active;     // 0xFF for lanes holding an instance that has not trapped
+    uint32_t active_bits; // the same, one bit per lane
+    uint32_t modified;    // lanes that have stored to memory, so their code may differ
+    uint64_t steps;       // steps executed by the group
+    uint8_t quirks;       // QUIRK_PROFILE_QUIRKS of the prototype's profile
+    // Opcodes executed by a lane are cycle_base + steps while it is
+    // active, and cycle_base once it has trapped.
+    uint64_t cycle_base[LOCKSTEP_LANES];
+    Chip *chips[LOCKSTEP_LANES]; // memory, stack, screen, keypad and RNG per lane
+} LockstepGroup;
+
+struct LockstepEngine
+{
+    LockstepGroup *groups;
+    size_t num_groups;
+    size_t num_instances;
+};
+
+// Executes one opcode on every active lane of the group.
+static void _step_group(LockstepGroup *group);
+
+// Executes `op`, followed in memory by `operand`, on the lanes selected
+// by `lanes` as vector operations. Returns false, changing nothing, if
+// `op` has no vector form.
+static bool _execute_vector(LockstepGroup *group, opcode op, opcode operand,
+                            const LaneBytes *lanes);
+
+// Sets VF to 0 in the lanes selected by `mask` if the group's quirks
+// reset it after 8xy1, 8xy2 and 8xy3.
+static inline void _reset_flag(LockstepGroup *group, const LaneBytes *mask);
+
+// Executes the opcode at the lane's program counter through ExecuteOpcode.
+static void _execute_scalar(LockstepGroup *group, int lane, opcode op);
+
+// Copies the lane's array state into its Chip-8.
+static void _store_lane(const LockstepGroup *group, int lane);
+
+// Copies the lane's Chip-8 state into the arrays.
+static void _load_lane(LockstepGroup *group, int lane);
+
+// Returns the opcode at `pc` in the Chip-8's memory.
+static opcode _fetch(const Chip *chip, uint16_t pc);
+
+// Returns bit i set for every lane i whose mask byte is nonzero.
+static uint32_t _lane_bits(const LaneBytes *mask);
+
+// Returns 0xFF in every lane whose bit is set.
+static inline LaneBytes _lanes_from_bits(uint32_t bits);
+
+LockstepEngine *CreateLockstepEngine(const Chip *prototype, size_t num_instances)
+{
+    LockstepEngine *engine = (LockstepEngine *)(calloc(1, sizeof(LockstepEngine)));
+    if (!engine)
+    {
+        return NULL;
+    }
+    engine->num_instances = num_instances;
+    engine->num_groups = (num_instances + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES;
+    size_t size = engine->num_groups * sizeof(LockstepGroup);
+    engine->groups = (LockstepGroup *)(aligned_alloc(LANE_ALIGNMENT, size ? size : LANE_ALIGNMENT));
+    if (!engine->groups)
+    {
+        free(engine);
+        return NULL;
+    }
+    memset(engine->groups, 0, size);
+
+    for (size_t i = 0; i < num_instances; i++)
+    {
+        LockstepGroup *group = &engine->groups[i / LOCKSTEP_LANES];
+        int lane = i % LOCKSTEP_LANES;
+        group->quirks = QUIRK_PROFILE_QUIRKS[prototype->quirk_profile];
+        group->chips[lane] = CloneChip(prototype);
+        group->cycle_base[lane] = prototype->cycle_count;
+        if (prototype->trap == TRAP_NONE)
+        {
+            group->active_bits |= 1u << lane;
+        }
+        _load_lane(group, lane);
+    }
+    for (size_t g = 0; g < engine->num_groups; g++)
+    {
+        engine->groups[g].active = _lanes_from_bits(engine->groups[g].active_bits);
+    }
+    return engine;
+}
+
+void FreeLockstepEngine(LockstepEngine *engine)
+{
+    for (size_t i = 0; i < engine->num_instances; i++)
+    {
+        FreeChip(engine->groups[i / LOCKSTEP_LANES].chips[i % LOCKSTEP_LANES]);
+    }
+    free(engine->groups);
+    free(engine);
+}
+
+size_t GetLockstepInstanceCount(const LockstepEngine *engine)
+{
+    return engine->num_instances;
+}
+
+void SeedLockstepInstance(LockstepEngine *engine, size_t index, uint32_t seed)
+{
+    SeedChip(engine->groups[index / LOCKSTEP_LANES].chips[index % LOCKSTEP_LANES], seed);
+}
+
+void SetLockstepKeypad(LockstepEngine *engine, size_t index, uint16_t keypad)
+{
+    engine->groups[index / LOCKSTEP_LANES].chips[index % LOCKSTEP_LANES]->keypad = keypad;
+}
+
+void RunLockstepCycles(LockstepEngine *engine, uint64_t cycles)
+{
+    for (size_t g = 0; g < engine->num_groups; g++)
+    {
+        LockstepGroup *group = &engine->groups[g];
+        for (uint64_t i = 0; i < cycles && group->active_bits; i++)
+        {
+            _step_group(group);
+        }
+    }
+}
+
+void RunLockstepFrame(LockstepEngine *engine, uint32_t cycles_per_frame)
+{
+    RunLockstepCycles(engine, cycles_per_frame);
+    for (size_t g = 0; g < engine->num_groups; g++)
+    {
+        LockstepGroup *group = &engine->groups[g];
+        LaneBytes one = group->active & 1;
+        group->delay_timer -= one & (LaneBytes)(group->delay_timer != 0);
+        group->sound_timer -= one & (LaneBytes)(group->sound_timer != 0);
+    }
+}
+
+Chip *GetLockstepInstance(LockstepEngine *engine, size_t index)
+{
+    LockstepGroup *group = &engine->groups[index / LOCKSTEP_LANES];
+    int lane = index % LOCKSTEP_LANES;
+    _store_lane(group, lane);
+    return group->chips[lane];
+}
+
+static void _step_group(LockstepGroup *group)
+{
+    uint32_t pending = group->active_bits;
+    while (pending)
+    {
+        // Execute the opcode of the first pending lane for every lane
+        // at the same program counter.
+        int leader = __builtin_ctz(pending);
+        uint16_t pc = group->program_counter[leader];
+        opcode op = _fetch(group->chips[leader], pc);
+        // The word after the opcode: F000's address, and what a skip
+        // decides the length of
+        opcode operand = _fetch(group->chips[leader], pc + 2);
+
+        LaneBytes at_pc = (LaneBytes)__builtin_convertvector(
+            group->program_counter == pc, LaneFlags);
+        uint32_t lanes = _lane_bits(&at_pc) & pending;
+
+        // Lanes that stored to memory may have different code here. If
+        // the leader stored, any lane may differ from it.
+        uint32_t check = lanes & ~(1u << leader);
+        if (!(group->modified & (1u << leader)))
+        {
+            check &= group->modified;
+        }
+        while (check)
+        {
+            int lane = __builtin_ctz(check);
+            if (_fetch(group->chips[lane], pc) != op ||
+                _fetch(group->chips[lane], pc + 2) != operand)
+            {
+                lanes &= ~(1u << lane);
+            }
+            check &= check - 1;
+        }
+
+        // In the common case every lane is at the same opcode.
+        LaneBytes mask = lanes == group->active_bits ? group->active
+                                                     : _lanes_from_bits(lanes);
+        if (!_execute_vector(group, op, operand, &mask))
+        {
+            for (uint32_t rest = lanes; rest; rest &= rest - 1)
+            {
+                _execute_scalar(group, __builtin_ctz(rest), op);
+            }
+        }
+        pending &= ~lanes;
+    }
+    group->steps++;
+}
+
+// Each case mirrors the scalar handler of the same opcode in opcodes.c,
+// including the order of writes when x or y is VF. Quirks are checked
+// at run time; they are the same for every step of a group, so the
+// branches predict perfectly.
+static bool _execute_vector(LockstepGroup *group, opcode op, opcode operand,
+                            const LaneBytes *lanes)
+{
+    LaneBytes mask = *lanes;
+    LaneBytes *v = group->registers;
+    uint8_t x = (op & 0xF00) >> 8;
+    uint8_t y = (op & 0xF0) >> 4;
+    uint8_t kk = op & 0xFF;
+    uint16_t nnn = op & 0xFFF;
+    LaneWords word_mask = WIDEN_MASK(mask);
+    LaneWords next = group->program_counter + 2;
+    // A skip passes over the whole of F000 nnnn.
+    uint16_t skip = operand == 0xF000 ? 4 : 2;
+    LaneBytes flag;
+    LaneBytes result;
+
+    switch (op & 0xF000)
+    {
+    case 0x1000:
+        group->program_counter = SELECT_LANES(word_mask, (LaneWords){0} + nnn,
+                                               group->program_counter);
+        return true;
+    case 0x3000:
+        flag = (LaneBytes)(v[x] == kk);
+        next += WIDEN_MASK(flag) & skip;
+        break;
+    case 0x4000:
+        flag = (LaneBytes)(v[x] != kk);
+        next += WIDEN_MASK(flag) & skip;
+        break;
+    case 0x5000:
+        if ((op & 0xF) == 0x2 || (op & 0xF) == 0x3)
+        {
+            return false;
+        }
+        flag = (LaneBytes)(v[x] == v[y]);
+        next += WIDEN_MASK(flag) & skip;
+        break;
+    case 0x6000:
+        v[x] = SELECT_LANES(mask, (LaneBytes){0} + kk, v[x]);
+        break;
+    case 0x7000:
+        v[x] = SELECT_LANES(mask, v[x] + kk, v[x]);
+        break;
+    case 0x8000:
+        switch (op & 0xF)
+        {
+        case 0x0:
+            v[x] = SELECT_LANES(mask, v[y], v[x]);
+            break;
+        case 0x1:
+            v[x] = SELECT_LANES(mask, v[x] | v[y], v[x]);
+            _reset_flag(group, &mask);
+            break;
+        case 0x2:
+            v[x] = SELECT_LANES(mask, v[x] & v[y], v[x]);
+            _reset_flag(group, &mask);
+            break;
+        case 0x3:
+            v[x] = SELECT_LANES(mask, v[x] ^ v[y], v[x]);
+            _reset_flag(group, &mask);
+            break;
+        case 0x4:
+            result = v[x] + v[y];
+            flag = (LaneBytes)(result < v[x]) & 1;
+            v[x] = SELECT_LANES(mask, result, v[x]);
+            v[0xF] = SELECT_LANES(mask, flag, v[0xF]);
+            break;
+        case 0x5:
+            flag = (LaneBytes)(v[x] >= v[y]) & 1;
+            v[x] = SELECT_LANES(mask, v[x] - v[y], v[x]);
+            v[0xF] = SELECT_LANES(mask, flag, v[0xF]);
+            break;
+        case 0x6:
+            if (group->quirks & QUIRK_SHIFT_USES_VY)
+            {
+                result = v[y];
+                v[x] = SELECT_LANES(mask, result >> 1, v[x]);
+                v[0xF] = SELECT_LANES(mask, result & 1, v[0xF]);
+            }
+            else
+            {
+                result = v[x];
+                v[x] = SELECT_LANES(mask, result >> 1, v[x]);
+                v[0xF] = SELECT_LANES(mask, result & 1, v[0xF]);
+            }
+            break;
+        case 0x7:
+            flag = (LaneBytes)(v[y] >= v[x]) & 1;
+            v[x] = SELECT_LANES(mask, v[y] - v[x], v[x]);
+            v[0xF] = SELECT_LANES(mask, flag, v[0xF]);
+            break;
+        case 0xE:
+            if (group->quirks & QUIRK_SHIFT_USES_VY)
+            {
+                result = v[y];
+                v[x] = SELECT_LANES(mask, result << 1, v[x]);
+                v[0xF] = SELECT_LANES(mask, result >> 7, v[0xF]);
+            }
+            else
+            {
+                result = v[x];
+                v[x] = SELECT_LANES(mask, result << 1, v[x]);
+                v[0xF] = SELECT_LANES(mask, result >> 7, v[0xF]);
+            }
+            break;
+        default:
+            return false;
+        }
+        break;
+    case 0x9000:
+        flag = (LaneBytes)(v[x] != v[y]);
+        next += WIDEN_MASK(flag) & skip;
+        break;
+    case 0xA000:
+        group->address_register = SELECT_LANES(word_mask, (LaneWords){0} + nnn,
+                                                group->address_register);
+        break;
+    case 0xF000:
+        switch (op & 0xFF)
+        {
+        case 0x00:
+            group->address_register = SELECT_LANES(word_mask, (LaneWords){0} + operand,
+                                                    group->address_register);
+            next += 2;
+            break;
+        case 0x07:
+            v[x] = SELECT_LANES(mask, group->delay_timer, v[x]);
+            break;
+        case 0x15:
+            group->delay_timer = SELECT_LANES(mask, v[x], group->delay_timer);
+            break;
+        case 0x18:
+            group->sound_timer = SELECT_LANES(mask, v[x], group->sound_timer);
+            break;
+        case 0x1E:
+            group->address_register = SELECT_LANES(
+                word_mask,
+                group->address_register + __builtin_convertvector(v[x], LaneWords),
+                group->address_register);
+            break;
+        default:
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    group->program_counter = SELECT_LANES(word_mask, next, group->program_counter);
+    return true;
+}
+
+static inline void _reset_flag(LockstepGroup *group, const LaneBytes *mask)
+{
+    if (group->quirks & QUIRK_LOGIC_RESETS_VF)
+    {
+        group->registers[0xF] = SELECT_LANES(*mask, (LaneBytes){0}, group->registers[0xF]);
+    }
+}
+
+static void _execute_scalar(LockstepGroup *group, int lane, opcode op)
+{
+    Chip *chip = group->chips[lane];
+    _store_lane(group, lane);
+    ExecuteOpcode(chip);
+    if (chip->trap != TRAP_NONE)
+    {
+        group->cycle_base[lane] += group->steps;
+        group->active_bits &= ~(1u << lane);
+        group->active[lane] = 0;
+    }
+    if ((op & 0xF0FF) == 0xF033 || (op & 0xF0FF) == 0xF055 || (op & 0xF00F) == 0x5002)
+    {
+        group->modified |= 1u << lane;
+    }
+    _load_lane(group, lane);
+}
+
+static void _store_lane(const LockstepGroup *group, int lane)
+{
+    Chip *chip = group->chips[lane];
+    for (int i = 0; i < NUM_REGISTERS; i++)
+    {
+        chip->registers[i] = group->registers[i][lane];
+    }
+    chip->program_counter = group->program_counter[lane];
+    chip->address_register = group->address_register[lane];
+    chip->delay_timer = group->delay_timer[lane];
+    chip->sound_timer = group->sound_timer[lane];
+    chip->cycle_count = group->cycle_base[lane];
+    if (group->active_bits & (1u << lane))
+    {
+        chip->cycle_count += group->steps;
+    }
+}
+
+static void _load_lane(LockstepGroup *group, int lane)
+{
+    const Chip *chip = group->chips[lane];
+    for (int i = 0; i < NUM_REGISTERS; i++)
+    {
+        group->registers[i][lane] = chip->registers[i];
+    }
+    group->program_counter[lane] = chip->program_counter;
+    group->address_register[lane] = chip->address_register;
+    group->delay_timer[lane] = chip->delay_timer;
+    group->sound_timer[lane] = chip->sound_timer;
+}
+
+static opcode _fetch(const Chip *chip, uint16_t pc)
+{
+    return (chip->memory[MEMORY_ADDRESS(pc)] << 8) | chip->memory[MEMORY_ADDRESS(pc + 1)];
+}
+
+static uint32_t _lane_bits(const LaneBytes *mask)
+{
+#ifdef __SSE2__
+    uint32_t bits = 0;
+    for (int i = 0; i < LOCKSTEP_LANES; i += 16)
+    {
+        __m128i chunk;
+        memcpy(&chunk, (const uint8_t *)mask + i, sizeof(chunk));
+        __m128i nonzero = _mm_cmpeq_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128()),
+                                         _mm_setzero_si128());
+        bits |= (uint32_t)_mm_movemask_epi8(nonzero) << i;
+    }
+    return bits;
+#else
+    uint32_t bits = 0;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        bits |= (uint32_t)((*mask)[lane] != 0) << lane;
+    }
+    return bits;
+#endif
+}
+
+static inline LaneBytes _lanes_from_bits(uint32_t bits)
+{
+    LaneBytes mask;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        mask[lane] = -((bits >> lane) & 1);
+    }
+    return mask;
+}
@@ -0,0 +1,52 @@
+#ifndef _LOCKSTEP_H
+#define _LOCKSTEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip.h"
+#include "opcodes.h"
+
+// Runs many instances of one ROM in lockstep.
+//
+// Registers, program counters, I and the timers of every instance are
+// stored as arrays across groups of LOCKSTEP_LANES instances. Each step,
+// the lanes of a group that sit at the same program counter execute
+// that opcode together as one SIMD operation; opcodes without a vector
+// form (sprites, calls, memory stores, ...) fall back to running each
+// lane through ExecuteOpcode. Instances execute exactly as they would
+// on their own Chip-8.
+
+#define LOCKSTEP_LANES 32
+
+typedef struct LockstepEngine LockstepEngine;
+
+// Creates `num_instances` copies of the given Chip-8, typically one
+// that has just had a ROM loaded. Returns NULL on failure.
+LockstepEngine *CreateLockstepEngine(const Chip *prototype, size_t num_instances);
+
+// Frees the engine and all of its instances.
+void FreeLockstepEngine(LockstepEngine *engine);
+
+// Returns the number of instances the engine runs.
+size_t GetLockstepInstanceCount(const LockstepEngine *engine);
+
+// Seeds the random number generator of the given instance.
+void SeedLockstepInstance(LockstepEngine *engine, size_t index, uint32_t seed);
+
+// Sets the keypad state of the given instance.
+void SetLockstepKeypad(LockstepEngine *engine, size_t index, uint16_t keypad);
+
+// Executes `cycles` opcodes on every instance that has not trapped.
+void RunLockstepCycles(LockstepEngine *engine, uint64_t cycles);
+
+// Executes one 60 Hz frame on every instance that has not trapped:
+// `cycles_per_frame` opcodes followed by a timer tick.
+void RunLockstepFrame(LockstepEngine *engine, uint32_t cycles_per_frame);
+
+// Writes the instance's register state back into its Chip-8 and returns
+// it. The Chip-8 belongs to the engine and is only up to date until the
+// engine runs again.
+Chip *GetLockstepInstance(LockstepEngine *engine, size_t index);
+
+#endif
@@ -1,30 +1,151 @@
 // Sets up emulation cycle for the CHIP-8
 
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <SDL2/SDL.h>
 
+#include "analysis.h"
+#include "audio.h"
 #include "chip.h"
 #include "opcodes.h"
 #include "display.h"
+#include "input.h"
+#include "runstats.h"
+#include "sharedframe.h"
+#include "triplebuffer.h"
 
-#define WIDTH 640
-#define HEIGHT 320
+#define FRAMES_PER_SECOND 60
+
+// How often the overlay's rates are recomputed
+#define OVERLAY_REFRESH_NS 500000000ULL
+
+// Long options; each has the short option it stands for as its value.
+static const struct option LONG_OPTIONS[] =
+    {
+        {"analyze", no_argument, NULL, 'A'},
+        {NULL, 0, NULL, 0},
+};
+
+// State shared between the main (render) thread and the emulation thread.
+typedef struct
+{
+    Chip *chip;               // owned by the emulation thread
+    uint32_t cycles_per_frame;
+    TripleBuffer *frames;     // screens from the emulation thread to the renderer
+    SharedFramebuffer *shared_framebuffer;
+    Audio *audio;
+    Input *input;
+    bool audio_paced;         // pace by the audio device's clock instead of sleeping
+    SDL_atomic_t running;
+    RuntimeStats stats;
+} Emulator;
+
+// Set by SIGUSR1; the main thread then dumps the runtime statistics.
+static volatile sig_atomic_t stats_dump_requested = 0;
 
 // Crashes program and prints error to stderr upon incorrect invocation
 static void Usage();
 
-int main(int argc, char const *argv[])
+// SIGUSR1 handler
+static void RequestStatsDump(int signal_number);
+
+// Takes a snapshot of the emulator's runtime statistics.
+static void SnapshotStats(Emulator *emulator, RuntimeStatsSnapshot *snapshot);
+
+// Runs the Chip-8 at 60 frames per second until emulator->running is
+// cleared, publishing each frame that drew something.
+static int EmulationThread(void *data);
+
+// Runs and publishes one frame. Returns false if the Chip-8 trapped.
+static bool EmulateFrame(Emulator *emulator);
+
+// Runs frames on a 60 Hz deadline, sleeping in between.
+static void PaceWithSleep(Emulator *emulator);
+
+// Runs frames whenever emulated time falls less than a target lead
+// ahead of the samples the audio device has consumed, so the audio
+// device's clock drives emulation and video and audio cannot drift.
+static void PaceWithAudioClock(Emulator *emulator);
+
+int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    const char *shared_name = NULL;
+    const char *keymap_name = NULL;
+    const char *stats_name = NULL;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    bool audio_paced = false;
+    bool analyze = false;
+    QuirkProfile quirk_profile = QUIRKS_DEFAULT;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "s:c:ak:S:q:A", LONG_OPTIONS, NULL)) != -1)
     {
-        Usage(argv[0]);
+        switch (option)
+        {
+        case 'A':
+            analyze = true;
+            break;
+        case 's':
+            shared_name = optarg;
+            break;
+        case 'c':
+            cycles_per_frame = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            audio_paced = true;
+            break;
+        case 'k':
+            keymap_name = optarg;
+            break;
+        case 'S':
+            stats_name = optarg;
+            break;
+        case 'q':
+            quirk_profile = FindQuirkProfile(optarg);
+            if (quirk_profile == NUM_QUIRK_PROFILES)
+            {
+                Usage();
+            }
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (optind != argc - 1 || cycles_per_frame == 0)
+    {
+        Usage();
     }
 
     Chip *chip = InitializeChip();
-    LoadROM(chip, argv[1]);
+    ROMError error = LoadROM(chip, argv[optind]);
+    if (error != ROM_OK)
+    {
+        fprintf(stderr, "Could not load %s: %s.\n", argv[optind], ROM_ERROR_NAMES[error]);
+        return EXIT_FAILURE;
+    }
+    chip->quirk_profile = quirk_profile;
+    if (analyze)
+    {
+        ControlFlowGraph *graph = AnalyzeROM(chip);
+        if (!graph)
+        {
+            fprintf(stderr, "Could not analyze %s.\n", argv[optind]);
+            return EXIT_FAILURE;
+        }
+        WriteControlFlowGraph(graph, chip, stdout);
+        FreeControlFlowGraph(graph);
+        FreeChip(chip);
+        return EXIT_SUCCESS;
+    }
+    SeedChip(chip, (uint32_t)time(NULL));
 
     Display *display = InitializeDisplay();
     if (!display)
@@ -32,28 +153,123 @@ int main(int argc, char const *argv[])
         return EXIT_FAILURE;
     }
 
-    bool running = true;
-    while (running)
+    Emulator emulator;
+    emulator.chip = chip;
+    emulator.cycles_per_frame = cycles_per_frame;
+    emulator.frames = CreateTripleBuffer(HIRES_DISPLAY_HEIGHT_IN_PIXELS * HIRES_DISPLAY_WIDTH_IN_PIXELS);
+    emulator.shared_framebuffer = NULL;
+    emulator.input = InitializeInput();
+    if (keymap_name && !LoadKeymap(emulator.input, keymap_name))
+    {
+        fprintf(stderr, "Could not read keymap %s.\n", keymap_name);
+        return EXIT_FAILURE;
+    }
+    // Runs silently without an audio device
+    emulator.audio = InitializeAudio((uint64_t)cycles_per_frame * FRAMES_PER_SECOND);
+    if (emulator.audio)
+    {
+        chip->sound_hook = AudioSoundHook;
+        chip->sound_pattern_hook = AudioSoundPatternHook;
+        chip->sound_context = emulator.audio;
+    }
+    else if (audio_paced)
     {
-        // Process events given by SDL
-        if (!ProcessEvents(chip))
+        fprintf(stderr, "No audio device; pacing with the system clock instead.\n");
+    }
+    emulator.audio_paced = audio_paced && emulator.audio;
+    SDL_AtomicSet(&emulator.running, 1);
+    InitializeRuntimeStats(&emulator.stats);
+#ifdef SIGUSR1
+    signal(SIGUSR1, RequestStatsDump);
+#endif
+
+    if (shared_name)
+    {
+        emulator.shared_framebuffer = CreateSharedFramebuffer(shared_name, 1);
+        if (!emulator.shared_framebuffer)
         {
-            break;
+            if (errno == EEXIST)
+            {
+                fprintf(stderr, "Shared memory %s already exists. Pick another name, or remove "
+                                "it if no other process is writing to it.\n",
+                        shared_name);
+            }
+            else
+            {
+                fprintf(stderr, "Could not create shared memory %s: %s.\n", shared_name,
+                        strerror(errno));
+            }
+            return EXIT_FAILURE;
         }
-        // Fetch, decode, execute
-        ExecuteOpcode(chip);
-        SDL_Delay(500);
+    }
 
-        // Render to screen
-        if (chip->needs_drawing)
+    SDL_Thread *thread = SDL_CreateThread(EmulationThread, "emulation", &emulator);
+    if (!thread)
+    {
+        fprintf(stderr, "error creating emulation thread: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    // The main thread only handles events and presents the latest frame;
+    // SDL requires both to happen on the thread that created the window.
+    const Uint64 ticks_per_second = SDL_GetPerformanceFrequency();
+    Uint64 last_present = SDL_GetPerformanceCounter();
+    RuntimeStatsSnapshot overlay_since;
+    SnapshotStats(&emulator, &overlay_since);
+    char overlay[RUNTIME_STATS_TEXT_SIZE] = "";
+    while (ProcessEvents(display, emulator.input))
+    {
+        if (stats_dump_requested)
+        {
+            stats_dump_requested = 0;
+            RuntimeStatsSnapshot snapshot;
+            SnapshotStats(&emulator, &snapshot);
+            if (!DumpRuntimeStats(&snapshot, stats_name))
+            {
+                fprintf(stderr, "Could not write statistics to %s.\n", stats_name);
+            }
+        }
+
+        const void *screen;
+        bool fresh = AcquireFrontBuffer(emulator.frames, &screen);
+        if (fresh || display->vsync)
+        {
+            if (display->show_overlay)
+            {
+                RuntimeStatsSnapshot snapshot;
+                SnapshotStats(&emulator, &snapshot);
+                if (snapshot.uptime_ns - overlay_since.uptime_ns >= OVERLAY_REFRESH_NS)
+                {
+                    FormatRuntimeStats(&snapshot, &overlay_since, overlay, sizeof(overlay));
+                    overlay_since = snapshot;
+                }
+            }
+            RenderDisplay(display, screen, display->show_overlay ? overlay : NULL);
+
+            Uint64 now = SDL_GetPerformanceCounter();
+            CountPresentedFrame(&emulator.stats, fresh,
+                                (now - last_present) * 1000000000ULL / ticks_per_second);
+            last_present = now;
+        }
+        if (!display->vsync)
         {
-            _PrintDisplay(chip);
-            RenderDisplay(display, chip);
-            chip->needs_drawing = false;
+            SDL_Delay(1000 / FRAMES_PER_SECOND);
         }
     }
 
     // Clean up resources
+    SDL_AtomicSet(&emulator.running, 0);
+    SDL_WaitThread(thread, NULL);
+    if (emulator.audio)
+    {
+        CleanUpAudio(emulator.audio);
+    }
+    if (emulator.shared_framebuffer)
+    {
+        CloseSharedFramebuffer(emulator.shared_framebuffer);
+    }
+    CleanUpInput(emulator.input);
+    FreeTripleBuffer(emulator.frames);
     CleanUpDisplay(display);
     FreeChip(chip);
 
@@ -62,6 +278,160 @@ int main(int argc, char const *argv[])
 
 void Usage()
 {
-    fprintf(stderr, "Usage: ./ninechippers <filename>\n");
+    fprintf(stderr, "Usage: ./ninechippers [-s shared memory name] "
+                    "[-c cycles per frame] [-a (pace by audio clock)] "
+                    "[-k keymap] [-S statistics file] "
+                    "[-q quirk profile (");
+    for (QuirkProfile profile = 0; profile < NUM_QUIRK_PROFILES; profile++)
+    {
+        fprintf(stderr, "%s%s", profile ? ", " : "", QUIRK_PROFILE_NAMES[profile]);
+    }
+    fprintf(stderr, ")] [-A | --analyze (print the control-flow graph and exit)] <filename>\n");
     exit(EXIT_FAILURE);
 }
+
+static void RequestStatsDump(int signal_number)
+{
+    stats_dump_requested = 1;
+}
+
+static void SnapshotStats(Emulator *emulator, RuntimeStatsSnapshot *snapshot)
+{
+    GetRuntimeStats(&emulator->stats, snapshot);
+    if (emulator->audio)
+    {
+        snapshot->audio_underruns = GetAudioUnderruns(emulator->audio);
+    }
+}
+
+static int EmulationThread(void *data)
+{
+    Emulator *emulator = data;
+    Chip *chip = emulator->chip;
+
+    if (emulator->audio_paced)
+    {
+        PaceWithAudioClock(emulator);
+    }
+    else
+    {
+        PaceWithSleep(emulator);
+    }
+
+    if (emulator->audio && chip->sound_timer > 0)
+    {
+        PushToneEvent(emulator->audio, chip->cycle_count, false);
+    }
+    return 0;
+}
+
+static bool EmulateFrame(Emulator *emulator)
+{
+    Chip *chip = emulator->chip;
+    chip->keypad = GetKeypad(emulator->input);
+    uint64_t cycles_before = chip->cycle_count;
+
+    // Fetch, decode, execute
+    bool trapped = RunFrame(chip, emulator->cycles_per_frame) == STOP_TRAPPED;
+    CountEmulatedFrame(&emulator->stats, chip->cycle_count - cycles_before, !trapped);
+    if (trapped)
+    {
+        if (chip->trap != TRAP_EXITED)
+        {
+            fprintf(stderr, "Error: %s at %03x\n", TRAP_NAMES[chip->trap],
+                    chip->program_counter);
+        }
+        return false;
+    }
+
+    // Hand the frame to the renderer
+    if (chip->needs_drawing)
+    {
+        UnpackScreen(chip, (uint8_t (*)[HIRES_DISPLAY_WIDTH_IN_PIXELS])GetBackBuffer(emulator->frames));
+        PublishBackBuffer(emulator->frames);
+        CountPublishedFrame(&emulator->stats);
+        if (emulator->shared_framebuffer)
+        {
+            PublishFrame(emulator->shared_framebuffer, 0, chip);
+        }
+        chip->needs_drawing = false;
+    }
+    return true;
+}
+
+static void PaceWithSleep(Emulator *emulator)
+{
+    const Uint64 ticks_per_frame = SDL_GetPerformanceFrequency() / FRAMES_PER_SECOND;
+    Uint64 deadline = SDL_GetPerformanceCounter();
+
+    while (SDL_AtomicGet(&emulator->running) && EmulateFrame(emulator))
+    {
+        // Sleep until the next frame is due, without drifting
+        deadline += ticks_per_frame;
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now >= deadline)
+        {
+            CountLateFrame(&emulator->stats);
+            deadline = now;
+            continue;
+        }
+        uint32_t sleep_ms = (deadline - now) * 1000 / SDL_GetPerformanceFrequency();
+        if (emulator->chip->waiting_for_key)
+        {
+            // Blocked in Fx0A: wake as soon as a key goes down.
+            if (WaitForKeyPress(emulator->input, sleep_ms))
+            {
+                deadline = SDL_GetPerformanceCounter();
+            }
+        }
+        else
+        {
+            SDL_Delay(sleep_ms);
+        }
+    }
+}
+
+static void PaceWithAudioClock(Emulator *emulator)
+{
+    Audio *audio = emulator->audio;
+    // Emulated time is kept at most this far ahead of the audio device:
+    // one frame's worth of samples plus one device buffer.
+    const uint64_t target_lead = audio->sample_rate / FRAMES_PER_SECOND +
+                                 AUDIO_BUFFER_SAMPLES;
+    uint64_t frames = 0;
+    uint64_t first_frame = 0;
+    uint64_t played = 0;
+    uint32_t last_played = GetSamplesPlayed(audio);
+
+    while (SDL_AtomicGet(&emulator->running))
+    {
+        uint32_t now_played = GetSamplesPlayed(audio);
+        played += (uint32_t)(now_played - last_played);
+        last_played = now_played;
+
+        uint64_t emulated = (frames - first_frame) * audio->sample_rate / FRAMES_PER_SECOND;
+        if (emulated + audio->sample_rate < played)
+        {
+            // More than a second behind (e.g. the process was suspended):
+            // resume from now instead of fast-forwarding to catch up.
+            first_frame = frames - played * FRAMES_PER_SECOND / audio->sample_rate;
+            continue;
+        }
+        if (emulated < played + target_lead)
+        {
+            if (emulated < played)
+            {
+                CountLateFrame(&emulator->stats);
+            }
+            if (!EmulateFrame(emulator))
+            {
+                return;
+            }
+            frames++;
+        }
+        else
+        {
+            WaitForAudio(audio, 1000 / FRAMES_PER_SECOND);
+        }
+    }
+}
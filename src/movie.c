@@ -0,0 +1,65 @@
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_LINE_LENGTH 256
+
+bool LoadInputMovie(InputMovie *movie, const char *filename)
+{
+    movie->events = NULL;
+    movie->count = 0;
+
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    size_t capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long frame;
+        unsigned int keypad;
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if (sscanf(line, "%lu %x", &frame, &keypad) != 2 ||
+            keypad > 0xFFFF ||
+            (movie->count > 0 && frame <= movie->events[movie->count - 1].frame))
+        {
+            fclose(file);
+            FreeInputMovie(movie);
+            return false;
+        }
+        if (movie->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            movie->events = realloc(movie->events, capacity * sizeof(MovieEvent));
+        }
+        movie->events[movie->count].frame = frame;
+        movie->events[movie->count].keypad = keypad;
+        movie->count++;
+    }
+    fclose(file);
+    return true;
+}
+
+void FreeInputMovie(InputMovie *movie)
+{
+    free(movie->events);
+    movie->events = NULL;
+    movie->count = 0;
+}
+
+void ApplyInputMovie(const InputMovie *movie, size_t *cursor,
+                     uint64_t frame, Chip *chip)
+{
+    while (*cursor < movie->count && movie->events[*cursor].frame <= frame)
+    {
+        chip->keypad = movie->events[*cursor].keypad;
+        (*cursor)++;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _MOVIE_H
+#define _MOVIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip.h"
+
+// A recording of keypad input, one keypad state per change.
+// Movie files are text, one "<frame> <keypad>" pair per line, where
+// <frame> is a decimal 60 Hz frame number and <keypad> a hexadecimal
+// 16-bit key mask held from that frame on. Frames must be increasing.
+// Lines starting with '#' are ignored.
+
+typedef struct
+{
+    uint32_t frame;
+    uint16_t keypad;
+} MovieEvent;
+
+typedef struct
+{
+    MovieEvent *events;
+    size_t count;
+} InputMovie;
+
+// Reads the movie at the given filename. Returns false and leaves
+// `movie` empty if the file cannot be read or is malformed.
+bool LoadInputMovie(InputMovie *movie, const char *filename);
+
+// Frees the events held by the movie.
+void FreeInputMovie(InputMovie *movie);
+
+// Applies the movie's keypad state for `frame` to the Chip-8.
+// `cursor` tracks playback and should start at 0; frames must be
+// applied in increasing order.
+void ApplyInputMovie(const InputMovie *movie, size_t *cursor,
+                     uint64_t frame, Chip *chip);
+
+#endif
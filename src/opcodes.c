@@ -1,16 +1,292 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "opcodes.h"
 #include "chip.h"
+#include "predecode.h"
 
-// TODO: function table
+const char *const BACKEND_NAMES[NUM_BACKENDS] = {"switch", "table", "threaded", "predecoded"};
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// 0nnn - SYS addr, ignored by modern interpreters
+static void _ignore(Chip *chip, opcode op);
+
+// Decode 00??/0nnn, 5xy?, 8xy?, Ex?? and Fx?? through the tables below
+static void _execute_system(Chip *chip, opcode op);
+static void _execute_registers(Chip *chip, opcode op);
+static void _execute_alu(Chip *chip, opcode op);
+static void _execute_key(Chip *chip, opcode op);
+static void _execute_misc(Chip *chip, opcode op);
+
+// Calls the handler, or traps if it is NULL
+static void _execute_handler(Chip *chip, opcode op, OpcodeHandler handler);
+
+// Returns the handler of an opcode whose highest nibble is 0
+static OpcodeHandler _decode_system(opcode op);
+
+// Returns the handler of an opcode whose highest nibble is 5
+static OpcodeHandler _decode_registers(opcode op);
+
+// Handlers indexed by the highest nibble of the opcode
+static const OpcodeHandler OPCODE_TABLE[16] =
+    {
+        _execute_system, JumpToOpcodeAddress, CallOpcodeSubroutine,
+        SkipIfByteEqualToRegister, SkipIfByteNotEqualToRegister,
+        _execute_registers, SetRegisterToByte, AddByteToRegister,
+        _execute_alu, SkipIfUnequalRegisters, SetAddressRegister,
+        JumpToOpcodeRegisterSum, RandomizeRegister, DisplaySprite,
+        _execute_key, _execute_misc,
+};
+
+// 00?? handlers indexed by the lowest byte, apart from 00Cn and 00Dn.
+// Unknown ones are 0nnn, which is ignored.
+static const OpcodeHandler SYSTEM_TABLE[256] =
+    {
+        [0xE0] = ClearDisplay,
+        [0xEE] = ReturnFromSubroutine,
+        [0xFB] = ScrollDisplayRight,
+        [0xFC] = ScrollDisplayLeft,
+        [0xFD] = ExitInterpreter,
+        [0xFE] = DisableHighResolution,
+        [0xFF] = EnableHighResolution,
+};
+
+// 8xy? handlers indexed by the lowest nibble
+static const OpcodeHandler ALU_TABLE[16] =
+    {
+        [0x0] = SetRegisterToRegister,
+        [0x1] = OrRegisters,
+        [0x2] = AndRegisters,
+        [0x3] = XorRegisters,
+        [0x4] = AddRegisters,
+        [0x5] = SubtractRegisters,
+        [0x6] = ShiftRegisterRight,
+        [0x7] = SubtractRegistersReverse,
+        [0xE] = ShiftRegisterLeft,
+};
+
+// Ex?? handlers indexed by the lowest byte
+static const OpcodeHandler KEY_TABLE[256] =
+    {
+        [0x9E] = SkipIfKeyPressed,
+        [0xA1] = SkipIfKeyNotPressed,
+};
+
+// Fx?? handlers indexed by the lowest byte
+static const OpcodeHandler MISC_TABLE[256] =
+    {
+        [0x00] = LoadLongAddress,
+        [0x01] = SelectPlanes,
+        [0x02] = LoadAudioPattern,
+        [0x07] = SetRegisterToDelayTimer,
+        [0x0A] = SetRegisterUponKeyPress,
+        [0x15] = SetDelayTimerToRegister,
+        [0x18] = SetSoundTimerToRegister,
+        [0x1E] = AddToAddressRegister,
+        [0x29] = SetAddressRegisterToSprite,
+        [0x30] = SetAddressRegisterToBigSprite,
+        [0x33] = StoreBCDRepresentation,
+        [0x3A] = SetAudioPitch,
+        [0x55] = StoreRegisters,
+        [0x65] = ReadRegisters,
+        [0x75] = StoreRPLFlags,
+        [0x85] = ReadRPLFlags,
+};
+
+// Every distinct handler, in OPCODE_HANDLERS order, as PLAIN(handler)
+// or, for handlers whose behavior depends on quirks, as
+// QUIRKY(handler, generic, ...) where `generic` takes the quirks as a
+// third argument. Extra arguments are passed on to QUIRKY.
+#define OPCODE_HANDLER_LIST(PLAIN, QUIRKY, ...)                                       \
+    PLAIN(NULL) PLAIN(_ignore) PLAIN(ClearDisplay) PLAIN(ReturnFromSubroutine)          \
+    PLAIN(ScrollDisplayDown) PLAIN(ScrollDisplayUp) PLAIN(ScrollDisplayRight)           \
+    PLAIN(ScrollDisplayLeft)                                                            \
+    PLAIN(ExitInterpreter) PLAIN(DisableHighResolution) PLAIN(EnableHighResolution)     \
+    PLAIN(JumpToOpcodeAddress) PLAIN(CallOpcodeSubroutine)                              \
+    PLAIN(SkipIfByteEqualToRegister) PLAIN(SkipIfByteNotEqualToRegister)                \
+    PLAIN(SkipIfRegistersEqual) PLAIN(SaveRegisterRange) PLAIN(LoadRegisterRange)       \
+    PLAIN(SetRegisterToByte) PLAIN(AddByteToRegister)                                   \
+    PLAIN(SetRegisterToRegister) QUIRKY(OrRegisters, _or, __VA_ARGS__)                  \
+    QUIRKY(AndRegisters, _and, __VA_ARGS__) QUIRKY(XorRegisters, _xor, __VA_ARGS__)     \
+    PLAIN(AddRegisters) PLAIN(SubtractRegisters)                                        \
+    QUIRKY(ShiftRegisterRight, _shift_right, __VA_ARGS__)                               \
+    PLAIN(SubtractRegistersReverse) QUIRKY(ShiftRegisterLeft, _shift_left, __VA_ARGS__) \
+    PLAIN(SkipIfUnequalRegisters) PLAIN(SetAddressRegister)                             \
+    QUIRKY(JumpToOpcodeRegisterSum, _jump_to_sum, __VA_ARGS__) PLAIN(RandomizeRegister) \
+    QUIRKY(DisplaySprite, _draw, __VA_ARGS__) PLAIN(SkipIfKeyPressed)                   \
+    PLAIN(SkipIfKeyNotPressed) PLAIN(LoadLongAddress) PLAIN(SelectPlanes)               \
+    PLAIN(LoadAudioPattern) PLAIN(SetRegisterToDelayTimer)                              \
+    PLAIN(SetRegisterUponKeyPress) PLAIN(SetDelayTimerToRegister)                       \
+    PLAIN(SetSoundTimerToRegister) PLAIN(AddToAddressRegister)                          \
+    PLAIN(SetAddressRegisterToSprite) PLAIN(SetAddressRegisterToBigSprite)              \
+    PLAIN(StoreBCDRepresentation) PLAIN(SetAudioPitch)                                  \
+    QUIRKY(StoreRegisters, _store_registers, __VA_ARGS__)                               \
+    QUIRKY(ReadRegisters, _read_registers, __VA_ARGS__) PLAIN(StoreRPLFlags)            \
+    PLAIN(ReadRPLFlags)
+
+#define HANDLER_ENTRY(handler) handler,
+#define PUBLIC_HANDLER_ENTRY(handler, generic, ...) handler,
+#define COUNT_HANDLER(...) +1
+
+const OpcodeHandler OPCODE_HANDLERS[] = {OPCODE_HANDLER_LIST(HANDLER_ENTRY, PUBLIC_HANDLER_ENTRY, _)};
+
+const size_t NUM_OPCODE_HANDLERS = sizeof(OPCODE_HANDLERS) / sizeof(OPCODE_HANDLERS[0]);
+
+#define HANDLER_INDEX(handler) HANDLER_INDEX_##handler,
+#define QUIRKY_HANDLER_INDEX(handler, generic, ...) HANDLER_INDEX_##handler,
+
+// Indices in OPCODE_HANDLERS, as case labels
+enum
+{
+    OPCODE_HANDLER_LIST(HANDLER_INDEX, QUIRKY_HANDLER_INDEX, _)
+};
+
+// Generic forms of the handlers that depend on quirks, taking them as
+// a bit set of QUIRK_ flags. Each is inlined wherever it is called, so
+// with constant quirks every quirk check folds away.
+static ALWAYS_INLINE void _or(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _and(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _xor(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _shift_right(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _shift_left(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _jump_to_sum(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _draw(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _store_registers(Chip *chip, opcode op, uint8_t quirks);
+static ALWAYS_INLINE void _read_registers(Chip *chip, opcode op, uint8_t quirks);
+
+// Same as ExecuteOpcode, with the given quirks
+static ALWAYS_INLINE void _execute(Chip *chip, uint8_t quirks);
+
+// Same as RunCycles, with the given quirks
+static ALWAYS_INLINE StopReason _run_switch(Chip *chip, uint64_t budget, uint8_t quirks);
+
+// The core of one quirk profile: its handler tables, laid out like the
+// generic ones, and the switch backend, all with its quirks compiled in
+typedef struct
+{
+    OpcodeHandler opcodes[16]; // like OPCODE_TABLE
+    OpcodeHandler alu[16];     // like ALU_TABLE
+    OpcodeHandler misc[256];   // like MISC_TABLE
+    OpcodeHandler handlers[0 OPCODE_HANDLER_LIST(COUNT_HANDLER, COUNT_HANDLER, _)];
+    void (*execute)(Chip *chip);
+    StopReason (*run_switch)(Chip *chip, uint64_t budget);
+} QuirkCore;
+
+#define DEFINE_SPECIALIZED_HANDLER(handler, generic, profile, quirks) \
+    static void generic##_##profile(Chip *chip, opcode op)            \
+    {                                                                 \
+        generic(chip, op, quirks);                                    \
+    }
+#define NO_DEFINITION(handler)
+#define SPECIALIZED_HANDLER_ENTRY(handler, generic, profile, quirks) generic##_##profile,
+
+// Defines CORE_<profile>, the QuirkCore of a profile, and the handlers
+// specialized for it.
+#define DEFINE_QUIRK_CORE(profile, name, quirks)                                        \
+    OPCODE_HANDLER_LIST(NO_DEFINITION, DEFINE_SPECIALIZED_HANDLER, profile, quirks)      \
+    static const QuirkCore CORE_##profile;                                               \
+    static void _execute_alu_##profile(Chip *chip, opcode op)                            \
+    {                                                                                    \
+        _execute_handler(chip, op, CORE_##profile.alu[op & 0xF]);                        \
+    }                                                                                    \
+    static void _execute_misc_##profile(Chip *chip, opcode op)                           \
+    {                                                                                    \
+        _execute_handler(chip, op, CORE_##profile.misc[op & 0xFF]);                      \
+    }                                                                                    \
+    static void _execute_##profile(Chip *chip)                                           \
+    {                                                                                    \
+        _execute(chip, quirks);                                                          \
+    }                                                                                    \
+    static StopReason _run_switch_##profile(Chip *chip, uint64_t budget)                 \
+    {                                                                                    \
+        return _run_switch(chip, budget, quirks);                                        \
+    }                                                                                    \
+    static const QuirkCore CORE_##profile =                                              \
+        {                                                                                \
+            .opcodes =                                                                   \
+                {                                                                        \
+                    _execute_system, JumpToOpcodeAddress, CallOpcodeSubroutine,          \
+                    SkipIfByteEqualToRegister, SkipIfByteNotEqualToRegister,             \
+                    _execute_registers, SetRegisterToByte, AddByteToRegister,            \
+                    _execute_alu_##profile, SkipIfUnequalRegisters, SetAddressRegister,  \
+                    _jump_to_sum_##profile, RandomizeRegister, _draw_##profile,          \
+                    _execute_key, _execute_misc_##profile,                               \
+                },                                                                       \
+            .alu =                                                                       \
+                {                                                                        \
+                    [0x0] = SetRegisterToRegister,                                       \
+                    [0x1] = _or_##profile,                                               \
+                    [0x2] = _and_##profile,                                              \
+                    [0x3] = _xor_##profile,                                              \
+                    [0x4] = AddRegisters,                                                \
+                    [0x5] = SubtractRegisters,                                           \
+                    [0x6] = _shift_right_##profile,                                      \
+                    [0x7] = SubtractRegistersReverse,                                    \
+                    [0xE] = _shift_left_##profile,                                       \
+                },                                                                       \
+            .misc =                                                                      \
+                {                                                                        \
+                    [0x00] = LoadLongAddress,                                            \
+                    [0x01] = SelectPlanes,                                               \
+                    [0x02] = LoadAudioPattern,                                           \
+                    [0x07] = SetRegisterToDelayTimer,                                    \
+                    [0x0A] = SetRegisterUponKeyPress,                                    \
+                    [0x15] = SetDelayTimerToRegister,                                    \
+                    [0x18] = SetSoundTimerToRegister,                                    \
+                    [0x1E] = AddToAddressRegister,                                       \
+                    [0x29] = SetAddressRegisterToSprite,                                 \
+                    [0x30] = SetAddressRegisterToBigSprite,                              \
+                    [0x33] = StoreBCDRepresentation,                                     \
+                    [0x3A] = SetAudioPitch,                                              \
+                    [0x55] = _store_registers_##profile,                                 \
+                    [0x65] = _read_registers_##profile,                                  \
+                    [0x75] = StoreRPLFlags,                                              \
+                    [0x85] = ReadRPLFlags,                                               \
+                },                                                                       \
+            .handlers = {OPCODE_HANDLER_LIST(HANDLER_ENTRY, SPECIALIZED_HANDLER_ENTRY,   \
+                                             profile, quirks)},                          \
+            .execute = _execute_##profile,                                               \
+            .run_switch = _run_switch_##profile,                                         \
+    };
+
+QUIRK_PROFILES(DEFINE_QUIRK_CORE)
+
+#define QUIRK_CORE_POINTER(profile, name, quirks) &CORE_##profile,
+
+static const QuirkCore *const QUIRK_CORES[NUM_QUIRK_PROFILES] = {QUIRK_PROFILES(QUIRK_CORE_POINTER)};
+
+// Runs like RunCycles, dispatching through the core's tables
+static StopReason _run_table(Chip *chip, uint64_t budget, const QuirkCore *core);
+
+// Runs like RunCycles, dispatching with computed gotos into the core's
+// tables
+static StopReason _run_threaded(Chip *chip, uint64_t budget, const QuirkCore *core);
+
+// Runs like RunDecodedCycles, dispatching each cache entry with a
+// computed goto to code for its handler or fused sequence
+static StopReason _run_predecoded(Chip *chip, uint64_t budget, const QuirkCore *core);
+
+// The OPCODE_HANDLERS index of every opcode, built on first use
+static uint8_t OPCODE_INDICES[1 << 16];
+
+// Fills OPCODE_INDICES
+static void _build_opcode_indices();
 
 // Returns opcode pointed at by the chip's program counter
 static opcode _get_opcode(Chip *chip);
 
+// Stops the chip with the given trap
+static void _trap(Chip *chip, Trap trap);
+
 // Returns lowest 12 bits of instruction, usually an address
-static uint8_t _get_nnn(opcode op);
+static uint16_t _get_nnn(opcode op);
 
 // Returns lowest 4 bits of instruction
 static uint8_t _get_nibble(opcode op);
@@ -24,53 +300,119 @@ static uint8_t _get_y(opcode op);
 // Returns lowest 8 bits of instruction
 static uint8_t _get_byte(opcode op);
 
-// Performs reg[lhs] -= reg[rhs], VF = borrow
-static void _subtract(Chip *chip, int lhs_index, int rhs_index);
+// Performs Vx = reg[lhs] - reg[rhs], then VF = NOT borrow
+static void _subtract(Chip *chip, int x, int lhs_index, int rhs_index);
+
+// Returns the mask of the row bits on screen in the current resolution
+static ScreenRow _visible_columns(const Chip *chip);
+
+// Writes a byte of guest memory. All opcode stores go through here, so
+// that stores to decoded code invalidate it.
+static void _store(Chip *chip, uint16_t address, uint8_t value);
+
+// Skips the opcode after the current one. F000 nnnn is twice as long
+// as other opcodes, and is skipped whole.
+static void _skip(Chip *chip);
+
+// Returns the 16-bit word at the address in guest memory
+static uint16_t _read_word(const Chip *chip, uint16_t address);
 
 void ExecuteOpcode(Chip *chip)
 {
-    opcode op = _get_opcode(chip);
-    printf("Opcode: %04x\n", op);
+    QUIRK_CORES[chip->quirk_profile]->execute(chip);
+}
+
+OpcodeHandler DecodeOpcode(opcode op)
+{
     switch (op & 0xF000)
     {
     case 0x0000:
-        switch (op)
+        return _decode_system(op);
+    case 0x5000:
+        return _decode_registers(op);
+    case 0x8000:
+        return ALU_TABLE[op & 0xF];
+    case 0xE000:
+        return KEY_TABLE[op & 0xFF];
+    case 0xF000:
+        return MISC_TABLE[op & 0xFF];
+    default:
+        return OPCODE_TABLE[op >> 12];
+    }
+}
+
+uint8_t DecodeOpcodeIndex(opcode op)
+{
+    // Searching OPCODE_HANDLERS takes a few dozen compares, which the
+    // predecoded backend would pay on every store to its code.
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, _build_opcode_indices);
+    return OPCODE_INDICES[op];
+}
+
+static void _build_opcode_indices()
+{
+    for (uint32_t op = 0; op < sizeof(OPCODE_INDICES); op++)
+    {
+        OpcodeHandler handler = DecodeOpcode((opcode)op);
+        uint8_t index = 0;
+        while (OPCODE_HANDLERS[index] != handler)
         {
-        case 0x00E0:
-            ClearDisplay(chip, op);
-            break;
+            index++;
         }
-        break;
-    case 0x1000:
-        JumpToOpcodeAddress(chip, op);
-        break;
-    case 0x6000:
-        SetRegisterToByte(chip, op);
-        break;
-    case 0x7000:
-        AddByteToRegister(chip, op);
-        break;
-    case 0xA000:
-        SetAddressRegister(chip, op);
-        break;
-    case 0xD000:
-        DisplaySprite(chip, op);
-        break;
+        OPCODE_INDICES[op] = index;
+    }
+}
+
+const OpcodeHandler *GetQuirkHandlers(QuirkProfile profile)
+{
+    return QUIRK_CORES[profile]->handlers;
+}
+
+StopReason RunCycles(Chip *chip, uint64_t budget)
+{
+    return QUIRK_CORES[chip->quirk_profile]->run_switch(chip, budget);
+}
+
+StopReason RunDecodedCycles(Chip *chip, uint64_t budget)
+{
+    return _run_predecoded(chip, budget, QUIRK_CORES[chip->quirk_profile]);
+}
+
+StopReason RunCyclesWithBackend(Chip *chip, uint64_t budget, Backend backend)
+{
+    switch (backend)
+    {
+    case BACKEND_TABLE:
+        return _run_table(chip, budget, QUIRK_CORES[chip->quirk_profile]);
+    case BACKEND_THREADED:
+        return _run_threaded(chip, budget, QUIRK_CORES[chip->quirk_profile]);
+    case BACKEND_PREDECODED:
+        return RunPredecodedCycles(chip, budget);
     default:
-        printf("Error: opcode %04x not implemented\n", op);
-        chip->program_counter -= 2;
+        return RunCycles(chip, budget);
     }
-    chip->program_counter += 2;
+}
+
+StopReason RunFrame(Chip *chip, uint32_t cycles_per_frame)
+{
+    StopReason reason = RunCycles(chip, cycles_per_frame);
+    if (reason != STOP_TRAPPED)
+    {
+        TickTimers(chip);
+    }
+    return reason;
 }
 
 // 00E0 - CLS
+// Clears the selected planes.
 void ClearDisplay(Chip *chip, opcode op)
 {
-    for (int i = 0; i < DISPLAY_HEIGHT_IN_PIXELS; i++)
+    for (int plane = 0; plane < NUM_PLANES; plane++)
     {
-        for (int j = 0; j < DISPLAY_WIDTH_IN_PIXELS; j++)
+        if (chip->planes & (1 << plane))
         {
-            chip->screen[i][j] = 0;
+            memset(chip->screen[plane], 0, sizeof(chip->screen[plane]));
         }
     }
     chip->needs_drawing = true;
@@ -79,13 +421,117 @@ void ClearDisplay(Chip *chip, opcode op)
 // 00EE - RET
 // The interpreter sets the program counter to the address at
 // the top of the stack, then subtracts 1 from the
-// stack pointer.
+// stack pointer. Traps if the stack is empty.
 void ReturnFromSubroutine(Chip *chip, opcode op)
 {
+    if (chip->stack_pointer == 0)
+    {
+        _trap(chip, TRAP_STACK_UNDERFLOW);
+        return;
+    }
     chip->program_counter = chip->stack[chip->stack_pointer];
     chip->stack_pointer--;
 }
 
+// 00Cn - SCD n
+// Scrolls the selected planes down n rows, in the current resolution.
+// Rows are whole words, so this moves them in one go.
+void ScrollDisplayDown(Chip *chip, opcode op)
+{
+    uint8_t rows = _get_nibble(op);
+    int height = GetScreenHeight(chip);
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (chip->planes & (1 << plane))
+        {
+            ScreenRow *screen = chip->screen[plane];
+            memmove(&screen[rows], &screen[0], (height - rows) * sizeof(ScreenRow));
+            memset(&screen[0], 0, rows * sizeof(ScreenRow));
+        }
+    }
+    chip->needs_drawing = true;
+}
+
+// 00Dn - SCU n
+// Scrolls the selected planes up n rows, in the current resolution.
+void ScrollDisplayUp(Chip *chip, opcode op)
+{
+    uint8_t rows = _get_nibble(op);
+    int height = GetScreenHeight(chip);
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (chip->planes & (1 << plane))
+        {
+            ScreenRow *screen = chip->screen[plane];
+            memmove(&screen[0], &screen[rows], (height - rows) * sizeof(ScreenRow));
+            memset(&screen[height - rows], 0, rows * sizeof(ScreenRow));
+        }
+    }
+    chip->needs_drawing = true;
+}
+
+// 00FB - SCR
+// Scrolls the selected planes right 4 pixels, in the current resolution.
+void ScrollDisplayRight(Chip *chip, opcode op)
+{
+    ScreenRow visible = _visible_columns(chip);
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (chip->planes & (1 << plane))
+        {
+            for (int i = 0; i < GetScreenHeight(chip); i++)
+            {
+                chip->screen[plane][i] = (chip->screen[plane][i] >> 4) & visible;
+            }
+        }
+    }
+    chip->needs_drawing = true;
+}
+
+// 00FC - SCL
+// Scrolls the selected planes left 4 pixels, in the current resolution.
+void ScrollDisplayLeft(Chip *chip, opcode op)
+{
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (chip->planes & (1 << plane))
+        {
+            for (int i = 0; i < GetScreenHeight(chip); i++)
+            {
+                chip->screen[plane][i] <<= 4;
+            }
+        }
+    }
+    chip->needs_drawing = true;
+}
+
+// 00FD - EXIT
+// Stops the interpreter, by trapping.
+void ExitInterpreter(Chip *chip, opcode op)
+{
+    _trap(chip, TRAP_EXITED);
+}
+
+// 00FE - LOW
+// Switches to 64x32 pixels. Like current interpreters, and unlike the
+// original SUPER-CHIP, switching resolution clears the display, every
+// plane of it.
+void DisableHighResolution(Chip *chip, opcode op)
+{
+    chip->high_resolution = false;
+    memset(chip->screen, 0, sizeof(chip->screen));
+    chip->needs_drawing = true;
+}
+
+// 00FF - HIGH
+// Switches to 128x64 pixels, clearing the display.
+void EnableHighResolution(Chip *chip, opcode op)
+{
+    chip->high_resolution = true;
+    memset(chip->screen, 0, sizeof(chip->screen));
+    chip->needs_drawing = true;
+}
+
 // 1nnn - JP addr
 // Sets program counter to nnn (addr)
 void JumpToOpcodeAddress(Chip *chip, opcode op)
@@ -98,12 +544,20 @@ void JumpToOpcodeAddress(Chip *chip, opcode op)
 // 2nnn - CALL addr
 // The interpreter increments the stack pointer,
 // then puts the current PC on the top of the stack.
-// The PC is then set to nnn.
+// The PC is then set to nnn. Traps if the stack is full; stack[0]
+// is never used, so it holds STACK_SIZE - 1 return addresses.
 void CallOpcodeSubroutine(Chip *chip, opcode op)
 {
+    if (chip->stack_pointer >= STACK_SIZE - 1)
+    {
+        _trap(chip, TRAP_STACK_OVERFLOW);
+        return;
+    }
     chip->stack_pointer++;
     chip->stack[chip->stack_pointer] = chip->program_counter;
     chip->program_counter = _get_nnn(op);
+    // do not increment PC afterwards
+    chip->program_counter -= 2;
 }
 
 // 3xkk - SE Vx, byte
@@ -114,7 +568,7 @@ void SkipIfByteEqualToRegister(Chip *chip, opcode op)
     uint8_t kk = _get_byte(op);
     if (register_value == kk)
     {
-        chip->program_counter += 2;
+        _skip(chip);
     }
 }
 
@@ -126,19 +580,47 @@ void SkipIfByteNotEqualToRegister(Chip *chip, opcode op)
     uint8_t kk = _get_byte(op);
     if (register_value != kk)
     {
-        chip->program_counter += 2;
+        _skip(chip);
     }
 }
 
 // 5xy0 - SE Vx, Vy
-// If Vx = Vy, increments the program counter by 2.
+// If Vx = Vy, skips the next instruction.
 void SkipIfRegistersEqual(Chip *chip, opcode op)
 {
     uint8_t x_value = chip->registers[_get_x(op)];
     uint8_t y_value = chip->registers[_get_y(op)];
     if (x_value == y_value)
     {
-        chip->program_counter += 2;
+        _skip(chip);
+    }
+}
+
+// 5xy2 - SAVE Vx - Vy
+// Stores registers Vx through Vy, in that order, in memory starting
+// at I. x may be greater than y, storing them backwards. I is
+// unchanged.
+void SaveRegisterRange(Chip *chip, opcode op)
+{
+    uint8_t x = _get_x(op);
+    uint8_t y = _get_y(op);
+    int step = x <= y ? 1 : -1;
+    for (int i = 0; i <= abs(y - x); i++)
+    {
+        _store(chip, chip->address_register + i, chip->registers[x + i * step]);
+    }
+}
+
+// 5xy3 - LOAD Vx - Vy
+// Reads registers Vx through Vy from memory starting at I, like 5xy2.
+void LoadRegisterRange(Chip *chip, opcode op)
+{
+    uint8_t x = _get_x(op);
+    uint8_t y = _get_y(op);
+    int step = x <= y ? 1 : -1;
+    for (int i = 0; i <= abs(y - x); i++)
+    {
+        chip->registers[x + i * step] = chip->memory[MEMORY_ADDRESS(chip->address_register + i)];
     }
 }
 
@@ -174,21 +656,21 @@ void SetRegisterToRegister(Chip *chip, opcode op)
 // Vx |= Vy
 void OrRegisters(Chip *chip, opcode op)
 {
-    chip->registers[_get_x(op)] |= chip->registers[_get_y(op)];
+    _or(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // 8xy2 - AND Vx, Vy
 // Vx &= Vy
 void AndRegisters(Chip *chip, opcode op)
 {
-    chip->registers[_get_x(op)] &= chip->registers[_get_y(op)];
+    _and(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // 8xy3 - XOR Vx, Vy
 // Vx ^= Vy
 void XorRegisters(Chip *chip, opcode op)
 {
-    chip->registers[_get_x(op)] ^= chip->registers[_get_y(op)];
+    _xor(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // 8xy4 - ADD Vx, Vy
@@ -197,50 +679,48 @@ void AddRegisters(Chip *chip, opcode op)
 {
     uint16_t sum = chip->registers[_get_x(op)] +
                    chip->registers[_get_y(op)];
-    chip->registers[_get_x(op)] = sum;         // lossy conversion?
-    chip->registers[0xF] = ((sum >> 4) & 0x1); // this should really be 1.
+    chip->registers[_get_x(op)] = sum;
+    chip->registers[0xF] = ((sum >> 8) & 0x1);
 }
 
 // 8xy5 - SUB Vx, Vy
 // Vx = Vx - Vy, VF = NOT borrow
-// If Vx > Vy, then VF is set to 1, otherwise 0.
-// Then Vy is subtracted from Vx, and the results stored in Vx.
+// Vy is subtracted from Vx and the result stored in Vx. Then, if
+// Vx >= Vy, VF is set to 1, otherwise 0.
 void SubtractRegisters(Chip *chip, opcode op)
 {
-    _subtract(chip, _get_x(op), _get_y(op));
+    _subtract(chip, _get_x(op), _get_x(op), _get_y(op));
 }
 
 // 8xy6 - SHR Vx, Vy
-// VF is set to LSB of Vx, then VF >>= 1 (divide VF by 2)
+// Vx >>= 1, then VF is set to the bit shifted out (so it wins when x is F)
 void ShiftRegisterRight(Chip *chip, opcode op)
 {
-    chip->registers[0xF] = chip->registers[_get_x(op)] & 0x1;
-    chip->registers[_get_x(op)] >>= 0x1;
+    _shift_right(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // 8xy7 - SUBN Vx, Vy
 // Vx = Vy - Vx, set VF = NOT borrow
 void SubtractRegistersReverse(Chip *chip, opcode op)
 {
-    _subtract(chip, _get_y(op), _get_x(op));
+    _subtract(chip, _get_x(op), _get_y(op), _get_x(op));
 }
 
-// 8xy7 - SHL Vx, Vy
+// 8xyE - SHL Vx, Vy
 // Vx = Vx << 1, VF = MSB of Vx
 void ShiftRegisterLeft(Chip *chip, opcode op)
 {
-    chip->registers[0xF] = ((chip->registers[_get_x(op)] & 0x80) >> 7);
-    chip->registers[_get_x(op)] <<= 1;
+    _shift_left(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // 9xy0 - SNE Vx, Vy
 // The values of Vx and Vy are compared, and if they are not equal,
-// the program counter is increased by 2.
+// the next instruction is skipped.
 void SkipIfUnequalRegisters(Chip *chip, opcode op)
 {
     if (chip->registers[_get_x(op)] != chip->registers[_get_y(op)])
     {
-        chip->program_counter += 2;
+        _skip(chip);
     }
 }
 
@@ -255,7 +735,7 @@ void SetAddressRegister(Chip *chip, opcode op)
 // Jump to location nnn + V0
 void JumpToOpcodeRegisterSum(Chip *chip, opcode op)
 {
-    chip->program_counter = _get_nnn(op) + chip->registers[0x0];
+    _jump_to_sum(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // Cxkk - RND Vx, Byte
@@ -263,7 +743,7 @@ void JumpToOpcodeRegisterSum(Chip *chip, opcode op)
 void RandomizeRegister(Chip *chip, opcode op)
 {
     uint8_t kk = _get_byte(op);
-    chip->registers[_get_x(op)] = rand() & kk;
+    chip->registers[_get_x(op)] = NextRandomByte(chip) & kk;
 }
 
 // Dxyn - DRW Vx, Vy, nibble
@@ -275,49 +755,75 @@ void RandomizeRegister(Chip *chip, opcode op)
 // otherwise it is set to 0. If the sprite is positioned so part of it
 // is outside the coordinates of the display, it wraps around to the
 // opposite side of the screen.
+//
+// Dxy0 - DRW Vx, Vy, 0
+// Same, with a 16x16 sprite stored as 16 rows of two bytes.
+//
+// The sprite is drawn on each plane selected by Fn01. With more than
+// one selected, each plane takes the next sprite along from I.
 void DisplaySprite(Chip *chip, opcode op)
 {
-    uint8_t height = _get_nibble(op);
-    uint8_t x_coord = chip->registers[_get_x(op)] % DISPLAY_WIDTH_IN_PIXELS;
-    uint8_t y_coord = chip->registers[_get_y(op)] % DISPLAY_HEIGHT_IN_PIXELS;
-
-    chip->registers[0xF] = 0;
-
-    for (int i = 0; i < height; i++)
-    {
-        uint8_t row = chip->memory[chip->address_register + i];
-        // iterate across row
-        for (int j = 0; j < 8; j++) // TODO: maybe add macro for '8'
-        {
-            uint8_t bit = (row & (0x80 >> j));
-            if (bit)
-            {
-                if (chip->screen[x_coord + j][y_coord + i])
-                {
-                    chip->registers[0xF] = 0x1;
-                }
-            }
-            chip->screen[x_coord + j][y_coord + i] ^= 0x1;
-            chip->needs_drawing = true;
-        }
-    }
+    _draw(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // Ex9E - SKP Vx
 // Skip next instruction if key with value of Vx is pressed.
 void SkipIfKeyPressed(Chip *chip, opcode op)
 {
+    uint8_t key = chip->registers[_get_x(op)] & 0xF;
+    if (chip->keypad & (1 << key))
+    {
+        _skip(chip);
+    }
 }
 
 // ExA1 - SKNP Vx
 // Skip next instruction if key with value of Vx is not pressed.
 void SkipIfKeyNotPressed(Chip *chip, opcode op)
 {
+    uint8_t key = chip->registers[_get_x(op)] & 0xF;
+    if (!(chip->keypad & (1 << key)))
+    {
+        _skip(chip);
+    }
+}
+
+// F000 nnnn - LD I, long addr
+// Set I = nnnn, the 16-bit word after the opcode, and skip it.
+void LoadLongAddress(Chip *chip, opcode op)
+{
+    chip->address_register = _read_word(chip, chip->program_counter + 2);
+    chip->program_counter += 2;
+}
+
+// Fn01 - PLANE n
+// Selects the planes in the bit mask n for drawing, clearing and
+// scrolling.
+void SelectPlanes(Chip *chip, opcode op)
+{
+    chip->planes = _get_x(op) & ALL_PLANES;
+}
+
+// F002 - AUDIO
+// Loads the 16-byte audio pattern from memory starting at I. From then
+// on, the pattern plays instead of the buzzer.
+void LoadAudioPattern(Chip *chip, opcode op)
+{
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++)
+    {
+        chip->audio_pattern[i] = chip->memory[MEMORY_ADDRESS(chip->address_register + i)];
+    }
+    chip->has_audio_pattern = true;
+    if (chip->sound_pattern_hook)
+    {
+        chip->sound_pattern_hook(chip->sound_context, chip->cycle_count, chip->audio_pattern,
+                                 chip->audio_pitch);
+    }
 }
 
 // Fx07 - LD Vx, DT
 // Set Vx = delay timer
-void SetRegietserToDelayTimer(Chip *chip, opcode op)
+void SetRegisterToDelayTimer(Chip *chip, opcode op)
 {
     chip->registers[_get_x(op)] = chip->delay_timer;
 }
@@ -326,6 +832,19 @@ void SetRegietserToDelayTimer(Chip *chip, opcode op)
 // Wait for a key press, then store the value of the key in Vx.
 void SetRegisterUponKeyPress(Chip *chip, opcode op)
 {
+    chip->waiting_for_key = chip->keypad == 0;
+    if (chip->waiting_for_key)
+    {
+        // execute this instruction again once a key is held
+        chip->program_counter -= 2;
+        return;
+    }
+    uint8_t key = 0;
+    while (!(chip->keypad & (1 << key)))
+    {
+        key++;
+    }
+    chip->registers[_get_x(op)] = key;
 }
 
 // Fx15 - LD DT, Vx
@@ -341,7 +860,13 @@ void SetDelayTimerToRegister(Chip *chip, opcode op)
 // ST is set equal to the value of Vx.
 void SetSoundTimerToRegister(Chip *chip, opcode op)
 {
+    bool was_on = chip->sound_timer > 0;
     chip->sound_timer = chip->registers[_get_x(op)];
+    bool is_on = chip->sound_timer > 0;
+    if (was_on != is_on && chip->sound_hook)
+    {
+        chip->sound_hook(chip->sound_context, chip->cycle_count, is_on);
+    }
 }
 
 // Fx1E - ADD I, Vx
@@ -363,6 +888,14 @@ void SetAddressRegisterToSprite(Chip *chip, opcode op)
     chip->address_register = addr;
 }
 
+// Fx30 - LD HF, Vx
+// Set I = location of the 8x10 sprite for digit Vx.
+void SetAddressRegisterToBigSprite(Chip *chip, opcode op)
+{
+    chip->address_register = BIG_FONT_SET_START +
+                             BIG_FONT_SPRITE_SIZE * (chip->registers[_get_x(op)] & 0xF);
+}
+
 // Fx33 - LD B, Vx
 // Store BCD representation of Vx in memory locations I, I+1, and I+2.
 // The interpreter takes the decimal value of Vx,
@@ -371,9 +904,21 @@ void SetAddressRegisterToSprite(Chip *chip, opcode op)
 void StoreBCDRepresentation(Chip *chip, opcode op)
 {
     uint8_t value = chip->registers[_get_x(op)];
-    chip->memory[chip->address_register] = ((value / 100) % 10);
-    chip->memory[chip->address_register + 1] = ((value / 10) % 10);
-    chip->memory[chip->address_register + 2] = (value % 10);
+    _store(chip, chip->address_register, (value / 100) % 10);
+    _store(chip, chip->address_register + 1, (value / 10) % 10);
+    _store(chip, chip->address_register + 2, value % 10);
+}
+
+// Fx3A - PITCH Vx
+// Set the audio pattern's pitch to Vx.
+void SetAudioPitch(Chip *chip, opcode op)
+{
+    chip->audio_pitch = chip->registers[_get_x(op)];
+    if (chip->has_audio_pattern && chip->sound_pattern_hook)
+    {
+        chip->sound_pattern_hook(chip->sound_context, chip->cycle_count, chip->audio_pattern,
+                                 chip->audio_pitch);
+    }
 }
 
 // Fx55 - LD [I], Vx
@@ -382,11 +927,7 @@ void StoreBCDRepresentation(Chip *chip, opcode op)
 // memory, starting at the address in I.
 void StoreRegisters(Chip *chip, opcode op)
 {
-    uint8_t last_index = _get_x(op);
-    for (int i = 0; i <= last_index; i++)
-    {
-        chip->memory[chip->address_register + i] = chip->registers[i];
-    }
+    _store_registers(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
 }
 
 // Fx65 - LD Vx, [I]
@@ -395,52 +936,778 @@ void StoreRegisters(Chip *chip, opcode op)
 // into registers V0 through Vx.
 void ReadRegisters(Chip *chip, opcode op)
 {
-    uint8_t last_index = _get_x(op);
-    for (int i = 0; i <= last_index; i++)
-    {
-        chip->registers[i] = chip->memory[chip->address_register + i];
-    }
+    _read_registers(chip, op, QUIRK_PROFILE_QUIRKS[chip->quirk_profile]);
+}
+
+// Fx75 - LD R, Vx
+// Store registers V0 through Vx in the RPL flags. There is one flag
+// per register, as in XO-CHIP; SUPER-CHIP only had 8.
+void StoreRPLFlags(Chip *chip, opcode op)
+{
+    memcpy(chip->rpl_flags, chip->registers, _get_x(op) + 1);
+}
+
+// Fx85 - LD Vx, R
+// Read registers V0 through Vx from the RPL flags.
+void ReadRPLFlags(Chip *chip, opcode op)
+{
+    memcpy(chip->registers, chip->rpl_flags, _get_x(op) + 1);
 }
 
 // HELPER FUNCTION MAYHEM:
 
-static opcode _get_opcode(Chip *chip)
+static void _ignore(Chip *chip, opcode op)
 {
-    opcode op = ((chip->memory[chip->program_counter] << 8) |
-                 chip->memory[chip->program_counter + 1]);
-    return op;
 }
 
-static uint8_t _get_nnn(opcode op)
+static void _execute_system(Chip *chip, opcode op)
 {
-    return (op & 0xFFF);
+    _decode_system(op)(chip, op);
 }
 
-static uint8_t _get_nibble(opcode op)
+static void _execute_registers(Chip *chip, opcode op)
 {
-    return (op & 0xF);
+    _decode_registers(op)(chip, op);
 }
 
-static uint8_t _get_x(opcode op)
+static void _execute_alu(Chip *chip, opcode op)
 {
-    return ((op & 0xF00) >> 8);
+    _execute_handler(chip, op, ALU_TABLE[op & 0xF]);
 }
 
-static uint8_t _get_y(opcode op)
+static void _execute_key(Chip *chip, opcode op)
 {
-    return ((op & 0xF0) >> 4);
+    _execute_handler(chip, op, KEY_TABLE[op & 0xFF]);
 }
 
-static uint8_t _get_byte(opcode op)
+static void _execute_misc(Chip *chip, opcode op)
 {
-    return (op & 0xFF);
+    _execute_handler(chip, op, MISC_TABLE[op & 0xFF]);
 }
 
-// Performs reg[lhs] -= reg[rhs], VF = borrow
-static void _subtract(Chip *chip, int lhs_index, int rhs_index)
+static OpcodeHandler _decode_system(opcode op)
 {
-    uint8_t lh_value = chip->registers[lhs_index];
-    uint8_t rh_value = chip->registers[rhs_index];
-    chip->registers[0xF] = lh_value > rh_value; // TODO: uh oh
-    chip->registers[lhs_index] -= chip->registers[rhs_index];
+    if ((op & 0xFFF0) == 0x00C0)
+    {
+        return ScrollDisplayDown;
+    }
+    if ((op & 0xFFF0) == 0x00D0)
+    {
+        return ScrollDisplayUp;
+    }
+    OpcodeHandler handler = (op & 0xFF00) ? NULL : SYSTEM_TABLE[op & 0xFF];
+    return handler ? handler : _ignore;
+}
+
+static OpcodeHandler _decode_registers(opcode op)
+{
+    // 5xy? other than 5xy2 and 5xy3 runs as 5xy0, as it always has.
+    switch (op & 0xF)
+    {
+    case 0x2:
+        return SaveRegisterRange;
+    case 0x3:
+        return LoadRegisterRange;
+    default:
+        return SkipIfRegistersEqual;
+    }
+}
+
+static void _execute_handler(Chip *chip, opcode op, OpcodeHandler handler)
+{
+    if (handler)
+    {
+        handler(chip, op);
+    }
+    else
+    {
+        _trap(chip, TRAP_UNKNOWN_OPCODE);
+    }
+}
+
+static ALWAYS_INLINE void _or(Chip *chip, opcode op, uint8_t quirks)
+{
+    chip->registers[_get_x(op)] |= chip->registers[_get_y(op)];
+    if (quirks & QUIRK_LOGIC_RESETS_VF)
+    {
+        chip->registers[0xF] = 0;
+    }
+}
+
+static ALWAYS_INLINE void _and(Chip *chip, opcode op, uint8_t quirks)
+{
+    chip->registers[_get_x(op)] &= chip->registers[_get_y(op)];
+    if (quirks & QUIRK_LOGIC_RESETS_VF)
+    {
+        chip->registers[0xF] = 0;
+    }
+}
+
+static ALWAYS_INLINE void _xor(Chip *chip, opcode op, uint8_t quirks)
+{
+    chip->registers[_get_x(op)] ^= chip->registers[_get_y(op)];
+    if (quirks & QUIRK_LOGIC_RESETS_VF)
+    {
+        chip->registers[0xF] = 0;
+    }
+}
+
+static ALWAYS_INLINE void _shift_right(Chip *chip, opcode op, uint8_t quirks)
+{
+    if (quirks & QUIRK_SHIFT_USES_VY)
+    {
+        uint8_t source = chip->registers[_get_y(op)];
+        chip->registers[_get_x(op)] = source >> 1;
+        chip->registers[0xF] = source & 0x1;
+    }
+    else
+    {
+        uint8_t flag = chip->registers[_get_x(op)] & 0x1;
+        chip->registers[_get_x(op)] >>= 0x1;
+        chip->registers[0xF] = flag;
+    }
+}
+
+static ALWAYS_INLINE void _shift_left(Chip *chip, opcode op, uint8_t quirks)
+{
+    if (quirks & QUIRK_SHIFT_USES_VY)
+    {
+        uint8_t source = chip->registers[_get_y(op)];
+        chip->registers[_get_x(op)] = source << 1;
+        chip->registers[0xF] = (source & 0x80) >> 7;
+    }
+    else
+    {
+        uint8_t flag = (chip->registers[_get_x(op)] & 0x80) >> 7;
+        chip->registers[_get_x(op)] <<= 1;
+        chip->registers[0xF] = flag;
+    }
+}
+
+static ALWAYS_INLINE void _jump_to_sum(Chip *chip, opcode op, uint8_t quirks)
+{
+    uint8_t offset = chip->registers[(quirks & QUIRK_JUMP_USES_VX) ? _get_x(op) : 0x0];
+    chip->program_counter = _get_nnn(op) + offset;
+    // do not increment PC afterwards
+    chip->program_counter -= 2;
+}
+
+static ALWAYS_INLINE void _draw(Chip *chip, opcode op, uint8_t quirks)
+{
+    // Dxy0 draws 16 rows of two bytes each
+    uint8_t height = _get_nibble(op) ? _get_nibble(op) : 16;
+    uint8_t width = _get_nibble(op) ? 8 : 16;
+    int screen_width = GetScreenWidth(chip);
+    int screen_height = GetScreenHeight(chip);
+    uint8_t x_coord = chip->registers[_get_x(op)] % screen_width;
+    uint8_t y_coord = chip->registers[_get_y(op)] % screen_height;
+    ScreenRow visible = _visible_columns(chip);
+    uint16_t address = chip->address_register;
+
+    chip->registers[0xF] = 0;
+    chip->needs_drawing = true;
+
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (!(chip->planes & (1 << plane)))
+        {
+            continue;
+        }
+        ScreenRow *screen = chip->screen[plane];
+        for (int i = 0; i < height; i++)
+        {
+            int y = y_coord + i;
+            if (y >= screen_height)
+            {
+                if (quirks & QUIRK_SPRITES_CLIP)
+                {
+                    break;
+                }
+                y -= screen_height;
+            }
+            uint16_t row_address = address + i * width / 8;
+            uint16_t row = chip->memory[MEMORY_ADDRESS(row_address)];
+            if (width == 16)
+            {
+                row = (row << 8) | chip->memory[MEMORY_ADDRESS(row_address + 1)];
+            }
+
+            // Line the sprite's row up with the screen's, wrapping what
+            // falls off the right edge around to the left.
+            ScreenRow sprite = (ScreenRow)row << (SCREEN_ROW_BITS - width);
+            ScreenRow pixels = sprite >> x_coord;
+            if (!(quirks & QUIRK_SPRITES_CLIP) && x_coord + width > screen_width)
+            {
+                pixels |= sprite << (screen_width - x_coord);
+            }
+            pixels &= visible;
+
+            if (screen[y] & pixels)
+            {
+                chip->registers[0xF] = 0x1;
+            }
+            screen[y] ^= pixels;
+        }
+        address += height * width / 8;
+    }
+}
+
+static ALWAYS_INLINE void _store_registers(Chip *chip, opcode op, uint8_t quirks)
+{
+    uint8_t last_index = _get_x(op);
+    for (int i = 0; i <= last_index; i++)
+    {
+        _store(chip, chip->address_register + i, chip->registers[i]);
+    }
+    if (quirks & QUIRK_LOAD_STORE_ADVANCES_I)
+    {
+        chip->address_register += last_index + 1;
+    }
+}
+
+static ALWAYS_INLINE void _read_registers(Chip *chip, opcode op, uint8_t quirks)
+{
+    uint8_t last_index = _get_x(op);
+    for (int i = 0; i <= last_index; i++)
+    {
+        chip->registers[i] = chip->memory[MEMORY_ADDRESS(chip->address_register + i)];
+    }
+    if (quirks & QUIRK_LOAD_STORE_ADVANCES_I)
+    {
+        chip->address_register += last_index + 1;
+    }
+}
+
+static ALWAYS_INLINE void _execute(Chip *chip, uint8_t quirks)
+{
+    opcode op = _get_opcode(chip);
+#ifdef NINECHIP_TRACE
+    printf("Opcode: %04x\n", op);
+#endif
+    switch (op & 0xF000)
+    {
+    case 0x0000:
+        switch (op)
+        {
+        case 0x00E0:
+            ClearDisplay(chip, op);
+            break;
+        case 0x00EE:
+            ReturnFromSubroutine(chip, op);
+            if (chip->trap != TRAP_NONE)
+            {
+                return;
+            }
+            break;
+        case 0x00FB:
+            ScrollDisplayRight(chip, op);
+            break;
+        case 0x00FC:
+            ScrollDisplayLeft(chip, op);
+            break;
+        case 0x00FD:
+            ExitInterpreter(chip, op);
+            return;
+        case 0x00FE:
+            DisableHighResolution(chip, op);
+            break;
+        case 0x00FF:
+            EnableHighResolution(chip, op);
+            break;
+        default:
+            if ((op & 0xFFF0) == 0x00C0)
+            {
+                ScrollDisplayDown(chip, op);
+            }
+            else if ((op & 0xFFF0) == 0x00D0)
+            {
+                ScrollDisplayUp(chip, op);
+            }
+            // 0nnn (SYS addr) is ignored by modern interpreters.
+            break;
+        }
+        break;
+    case 0x1000:
+        JumpToOpcodeAddress(chip, op);
+        break;
+    case 0x2000:
+        CallOpcodeSubroutine(chip, op);
+        if (chip->trap != TRAP_NONE)
+        {
+            return;
+        }
+        break;
+    case 0x3000:
+        SkipIfByteEqualToRegister(chip, op);
+        break;
+    case 0x4000:
+        SkipIfByteNotEqualToRegister(chip, op);
+        break;
+    case 0x5000:
+        switch (op & 0xF)
+        {
+        case 0x2:
+            SaveRegisterRange(chip, op);
+            break;
+        case 0x3:
+            LoadRegisterRange(chip, op);
+            break;
+        default:
+            SkipIfRegistersEqual(chip, op);
+            break;
+        }
+        break;
+    case 0x6000:
+        SetRegisterToByte(chip, op);
+        break;
+    case 0x7000:
+        AddByteToRegister(chip, op);
+        break;
+    case 0x8000:
+        switch (op & 0xF)
+        {
+        case 0x0:
+            SetRegisterToRegister(chip, op);
+            break;
+        case 0x1:
+            _or(chip, op, quirks);
+            break;
+        case 0x2:
+            _and(chip, op, quirks);
+            break;
+        case 0x3:
+            _xor(chip, op, quirks);
+            break;
+        case 0x4:
+            AddRegisters(chip, op);
+            break;
+        case 0x5:
+            SubtractRegisters(chip, op);
+            break;
+        case 0x6:
+            _shift_right(chip, op, quirks);
+            break;
+        case 0x7:
+            SubtractRegistersReverse(chip, op);
+            break;
+        case 0xE:
+            _shift_left(chip, op, quirks);
+            break;
+        default:
+            _trap(chip, TRAP_UNKNOWN_OPCODE);
+            return;
+        }
+        break;
+    case 0x9000:
+        SkipIfUnequalRegisters(chip, op);
+        break;
+    case 0xA000:
+        SetAddressRegister(chip, op);
+        break;
+    case 0xB000:
+        _jump_to_sum(chip, op, quirks);
+        break;
+    case 0xC000:
+        RandomizeRegister(chip, op);
+        break;
+    case 0xD000:
+        _draw(chip, op, quirks);
+        break;
+    case 0xE000:
+        switch (op & 0xFF)
+        {
+        case 0x9E:
+            SkipIfKeyPressed(chip, op);
+            break;
+        case 0xA1:
+            SkipIfKeyNotPressed(chip, op);
+            break;
+        default:
+            _trap(chip, TRAP_UNKNOWN_OPCODE);
+            return;
+        }
+        break;
+    case 0xF000:
+        switch (op & 0xFF)
+        {
+        case 0x00:
+            LoadLongAddress(chip, op);
+            break;
+        case 0x01:
+            SelectPlanes(chip, op);
+            break;
+        case 0x02:
+            LoadAudioPattern(chip, op);
+            break;
+        case 0x07:
+            SetRegisterToDelayTimer(chip, op);
+            break;
+        case 0x0A:
+            SetRegisterUponKeyPress(chip, op);
+            break;
+        case 0x15:
+            SetDelayTimerToRegister(chip, op);
+            break;
+        case 0x18:
+            SetSoundTimerToRegister(chip, op);
+            break;
+        case 0x1E:
+            AddToAddressRegister(chip, op);
+            break;
+        case 0x29:
+            SetAddressRegisterToSprite(chip, op);
+            break;
+        case 0x30:
+            SetAddressRegisterToBigSprite(chip, op);
+            break;
+        case 0x33:
+            StoreBCDRepresentation(chip, op);
+            break;
+        case 0x3A:
+            SetAudioPitch(chip, op);
+            break;
+        case 0x55:
+            _store_registers(chip, op, quirks);
+            break;
+        case 0x65:
+            _read_registers(chip, op, quirks);
+            break;
+        case 0x75:
+            StoreRPLFlags(chip, op);
+            break;
+        case 0x85:
+            ReadRPLFlags(chip, op);
+            break;
+        default:
+            _trap(chip, TRAP_UNKNOWN_OPCODE);
+            return;
+        }
+        break;
+    }
+    chip->program_counter += 2;
+    chip->cycle_count++;
+}
+
+static ALWAYS_INLINE StopReason _run_switch(Chip *chip, uint64_t budget, uint8_t quirks)
+{
+    for (uint64_t i = 0; i < budget; i++)
+    {
+        _execute(chip, quirks);
+        if (chip->trap != TRAP_NONE)
+        {
+            return STOP_TRAPPED;
+        }
+        if (chip->waiting_for_key)
+        {
+            return STOP_WAITING_FOR_KEY;
+        }
+    }
+    return STOP_BUDGET_EXHAUSTED;
+}
+
+
+static StopReason _run_table(Chip *chip, uint64_t budget, const QuirkCore *core)
+{
+    for (uint64_t i = 0; i < budget; i++)
+    {
+        opcode op = _get_opcode(chip);
+        core->opcodes[op >> 12](chip, op);
+        if (chip->trap != TRAP_NONE)
+        {
+            return STOP_TRAPPED;
+        }
+        chip->program_counter += 2;
+        chip->cycle_count++;
+        if (chip->waiting_for_key)
+        {
+            return STOP_WAITING_FOR_KEY;
+        }
+    }
+    return STOP_BUDGET_EXHAUSTED;
+}
+
+#if defined(__GNUC__)
+static StopReason _run_threaded(Chip *chip, uint64_t budget, const QuirkCore *core)
+{
+    // Only 00EE, 00FD, 2nnn, 8xy?, Ex?? and Fx?? can trap, and only Fx0A can
+    // wait, so every other opcode jumps straight to the next one.
+    static void *const LABELS[16] =
+        {
+            &&stack, &&plain, &&stack, &&plain, &&plain, &&plain, &&plain, &&plain,
+            &&alu, &&plain, &&plain, &&plain, &&plain, &&plain, &&key, &&misc,
+        };
+    opcode op;
+    OpcodeHandler handler;
+    uint64_t remaining = budget;
+
+#define DISPATCH()                    \
+    if (remaining-- == 0)             \
+    {                                 \
+        return STOP_BUDGET_EXHAUSTED; \
+    }                                 \
+    op = _get_opcode(chip);           \
+    goto *LABELS[op >> 12]
+
+#define ADVANCE()               \
+    chip->program_counter += 2; \
+    chip->cycle_count++
+
+    DISPATCH();
+stack:
+    core->opcodes[op >> 12](chip, op);
+    if (chip->trap != TRAP_NONE)
+    {
+        return STOP_TRAPPED;
+    }
+    ADVANCE();
+    DISPATCH();
+plain:
+    core->opcodes[op >> 12](chip, op);
+    ADVANCE();
+    DISPATCH();
+alu:
+    handler = core->alu[op & 0xF];
+    goto checked;
+key:
+    handler = KEY_TABLE[op & 0xFF];
+    goto checked;
+misc:
+    handler = core->misc[op & 0xFF];
+checked:
+    if (!handler)
+    {
+        _trap(chip, TRAP_UNKNOWN_OPCODE);
+        return STOP_TRAPPED;
+    }
+    handler(chip, op);
+    ADVANCE();
+    if (chip->waiting_for_key)
+    {
+        return STOP_WAITING_FOR_KEY;
+    }
+    DISPATCH();
+
+#undef ADVANCE
+#undef DISPATCH
+}
+#else
+static StopReason _run_threaded(Chip *chip, uint64_t budget, const QuirkCore *core)
+{
+    return _run_table(chip, budget, core);
+}
+#endif
+
+#if defined(__GNUC__)
+static StopReason _run_predecoded(Chip *chip, uint64_t budget, const QuirkCore *core)
+{
+    // Each handler and fused sequence ends in its own dispatch, so the
+    // branch predictor sees which entry tends to follow which.
+#define PREDECODED_LABEL(handler) [SINGLE_DISPATCH(HANDLER_INDEX_##handler)] = &&single_##handler,
+#define QUIRKY_PREDECODED_LABEL(handler, generic, ...) PREDECODED_LABEL(handler)
+    static void *const LABELS[] =
+        {
+            [DECODED_NONE] = &&decode,
+            [DECODED_SET_I_AND_DRAW] = &&set_i_and_draw,
+            [DECODED_SET_TWO_REGISTERS] = &&set_two_registers,
+            [DECODED_COUNTING_LOOP] = &&counting_loop,
+            [DECODED_ADD_I_AND_READ] = &&add_i_and_read,
+            OPCODE_HANDLER_LIST(PREDECODED_LABEL, QUIRKY_PREDECODED_LABEL, _)
+        };
+    DecodedInstruction *const *pages = chip->predecode->pages;
+    // Code mostly runs within a page, so the page is only looked up again
+    // when the program counter leaves it or decoding allocates it.
+    uint16_t page_number = MEMORY_ADDRESS(chip->program_counter) >> CODE_PAGE_SHIFT;
+    const DecodedInstruction *page = pages[page_number];
+    const DecodedInstruction *entry;
+    uint16_t address;
+    uint64_t remaining = budget;
+
+#define DISPATCH()                                              \
+    if (remaining == 0)                                         \
+    {                                                           \
+        return STOP_BUDGET_EXHAUSTED;                           \
+    }                                                           \
+    address = MEMORY_ADDRESS(chip->program_counter);            \
+    if (address >> CODE_PAGE_SHIFT != page_number)              \
+    {                                                           \
+        page_number = address >> CODE_PAGE_SHIFT;               \
+        page = pages[page_number];                              \
+    }                                                           \
+    entry = &page[address & (CODE_PAGE_ENTRIES - 1)];           \
+    goto *LABELS[entry->dispatch]
+
+#define FINISH_SINGLE()               \
+    if (chip->trap != TRAP_NONE)      \
+    {                                 \
+        return STOP_TRAPPED;          \
+    }                                 \
+    chip->program_counter += 2;       \
+    chip->cycle_count++;              \
+    remaining--;                      \
+    if (chip->waiting_for_key)        \
+    {                                 \
+        return STOP_WAITING_FOR_KEY;  \
+    }                                 \
+    DISPATCH()
+
+#define PREDECODED_SINGLE(handler)                      \
+    single_##handler:                                   \
+    _execute_handler(chip, entry->ops[0], handler);     \
+    FINISH_SINGLE();
+#define QUIRKY_PREDECODED_SINGLE(handler, generic, ...)               \
+    single_##handler:                                                 \
+    core->handlers[HANDLER_INDEX_##handler](chip, entry->ops[0]);     \
+    FINISH_SINGLE();
+
+    DISPATCH();
+decode:
+    if (!DecodeInstruction(chip, address))
+    {
+        return core->run_switch(chip, remaining);
+    }
+    page = pages[page_number];
+    DISPATCH();
+
+// Fused opcodes run inline when the budget fits them all, and otherwise
+// run their first opcode alone.
+set_i_and_draw:
+    if (remaining < 2)
+    {
+        SetAddressRegister(chip, entry->ops[0]);
+        FINISH_SINGLE();
+    }
+    chip->address_register = entry->ops[0] & 0xFFF;
+    core->handlers[HANDLER_INDEX_DisplaySprite](chip, entry->ops[1]);
+    chip->program_counter += 4;
+    chip->cycle_count += 2;
+    remaining -= 2;
+    DISPATCH();
+set_two_registers:
+    if (remaining < 2)
+    {
+        SetRegisterToByte(chip, entry->ops[0]);
+        FINISH_SINGLE();
+    }
+    chip->registers[_get_x(entry->ops[0])] = _get_byte(entry->ops[0]);
+    chip->registers[_get_x(entry->ops[1])] = _get_byte(entry->ops[1]);
+    chip->program_counter += 4;
+    chip->cycle_count += 2;
+    remaining -= 2;
+    DISPATCH();
+counting_loop:
+    if (remaining < 3)
+    {
+        AddByteToRegister(chip, entry->ops[0]);
+        FINISH_SINGLE();
+    }
+    chip->registers[_get_x(entry->ops[0])] += _get_byte(entry->ops[0]);
+    if (chip->registers[_get_x(entry->ops[1])] == _get_byte(entry->ops[1]))
+    {
+        // The skip passes over the jump, which does not execute.
+        chip->program_counter += 6;
+        chip->cycle_count += 2;
+        remaining -= 2;
+        DISPATCH();
+    }
+    chip->program_counter = _get_nnn(entry->ops[2]);
+    chip->cycle_count += 3;
+    remaining -= 3;
+    DISPATCH();
+add_i_and_read:
+    if (remaining < 2)
+    {
+        AddToAddressRegister(chip, entry->ops[0]);
+        FINISH_SINGLE();
+    }
+    AddToAddressRegister(chip, entry->ops[0]);
+    core->handlers[HANDLER_INDEX_ReadRegisters](chip, entry->ops[1]);
+    chip->program_counter += 4;
+    chip->cycle_count += 2;
+    remaining -= 2;
+    DISPATCH();
+
+    OPCODE_HANDLER_LIST(PREDECODED_SINGLE, QUIRKY_PREDECODED_SINGLE, _)
+
+#undef QUIRKY_PREDECODED_SINGLE
+#undef PREDECODED_SINGLE
+#undef FINISH_SINGLE
+#undef DISPATCH
+#undef QUIRKY_PREDECODED_LABEL
+#undef PREDECODED_LABEL
+}
+#else
+static StopReason _run_predecoded(Chip *chip, uint64_t budget, const QuirkCore *core)
+{
+    return core->run_switch(chip, budget);
+}
+#endif
+
+static opcode _get_opcode(Chip *chip)
+{
+    return _read_word(chip, chip->program_counter);
+}
+
+static void _trap(Chip *chip, Trap trap)
+{
+    chip->trap = trap;
+}
+
+static uint16_t _get_nnn(opcode op)
+{
+    return (op & 0xFFF);
+}
+
+static uint8_t _get_nibble(opcode op)
+{
+    return (op & 0xF);
+}
+
+static uint8_t _get_x(opcode op)
+{
+    return ((op & 0xF00) >> 8);
+}
+
+static uint8_t _get_y(opcode op)
+{
+    return ((op & 0xF0) >> 4);
+}
+
+static uint8_t _get_byte(opcode op)
+{
+    return (op & 0xFF);
+}
+
+// Performs Vx = reg[lhs] - reg[rhs], then VF = NOT borrow
+static void _subtract(Chip *chip, int x, int lhs_index, int rhs_index)
+{
+    uint8_t lh_value = chip->registers[lhs_index];
+    uint8_t rh_value = chip->registers[rhs_index];
+    chip->registers[x] = lh_value - rh_value;
+    chip->registers[0xF] = lh_value >= rh_value;
+}
+
+static ScreenRow _visible_columns(const Chip *chip)
+{
+    return ~(ScreenRow)0 << (SCREEN_ROW_BITS - GetScreenWidth(chip));
+}
+
+static void _store(Chip *chip, uint16_t address, uint8_t value)
+{
+    address = MEMORY_ADDRESS(address);
+    chip->memory[address] = value;
+    uint16_t page = address >> CODE_PAGE_SHIFT;
+    if (chip->code_pages[page / 64] & (1ULL << (page % 64)))
+    {
+        InvalidateCode(chip, address, 1);
+    }
+}
+
+static void _skip(Chip *chip)
+{
+    chip->program_counter += _read_word(chip, chip->program_counter + 2) == 0xF000 ? 4 : 2;
+}
+
+static uint16_t _read_word(const Chip *chip, uint16_t address)
+{
+    return (chip->memory[MEMORY_ADDRESS(address)] << 8) | chip->memory[MEMORY_ADDRESS(address + 1)];
 }
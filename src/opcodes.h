@@ -1,14 +1,75 @@
 #ifndef _OPCODES_H
 #define _OPCODES_H
 
+#include <stddef.h>
+
 #include "chip.h"
 #include "opcodes.h"
 
+// Number of opcodes executed per 60 Hz frame, i.e. 600 opcodes per second.
+#define DEFAULT_CYCLES_PER_FRAME 10
+
+// Why a call to RunCycles or RunFrame returned.
+typedef enum
+{
+    STOP_BUDGET_EXHAUSTED,
+    STOP_TRAPPED,         // see chip->trap for the cause
+    STOP_WAITING_FOR_KEY, // blocked in Fx0A; run again once a key is held
+} StopReason;
+
+// Ways of dispatching opcodes to their handlers. All of them execute
+// ROMs identically; they differ only in speed.
+typedef enum
+{
+    BACKEND_SWITCH,     // nested switch statements
+    BACKEND_TABLE,      // tables of handler pointers
+    BACKEND_THREADED,   // computed gotos on GCC and Clang, else the table
+    BACKEND_PREDECODED, // cached decodes and fused opcode sequences
+    NUM_BACKENDS,
+} Backend;
+
+// Names of the backends, e.g. for command line options.
+extern const char *const BACKEND_NAMES[NUM_BACKENDS];
+
+typedef uint16_t opcode;
+
+// Executes one decoded opcode. Does not advance the program counter.
+typedef void (*OpcodeHandler)(Chip *chip, opcode op);
+
 // Executes the opcode pointed at by the Chip-8's program counter.
-// Updates the Chip-8's state as a result.
+// Updates the Chip-8's state as a result, following its quirk profile.
+// If the opcode cannot be executed, sets chip->trap and leaves the
+// program counter in place.
 void ExecuteOpcode(Chip *chip);
 
-typedef uint16_t opcode;
+// Returns the handler for the given opcode, or NULL if the opcode
+// is unknown.
+OpcodeHandler DecodeOpcode(opcode op);
+
+// Every distinct opcode handler, at an index that is stable within a
+// build. Index 0 is NULL, standing for unknown opcodes.
+extern const OpcodeHandler OPCODE_HANDLERS[];
+extern const size_t NUM_OPCODE_HANDLERS;
+
+// Returns the index in OPCODE_HANDLERS of the opcode's handler.
+uint8_t DecodeOpcodeIndex(opcode op);
+
+// Returns the handlers of the core specialized for the quirk profile,
+// laid out like OPCODE_HANDLERS. The handlers in OPCODE_HANDLERS look
+// up the Chip-8's quirk profile on every call; these have its quirks
+// compiled in.
+const OpcodeHandler *GetQuirkHandlers(QuirkProfile profile);
+
+// Executes up to `budget` opcodes, stopping early if the Chip-8 traps
+// or starts waiting for a key press.
+StopReason RunCycles(Chip *chip, uint64_t budget);
+
+// Same as RunCycles, dispatching opcodes with the given backend.
+StopReason RunCyclesWithBackend(Chip *chip, uint64_t budget, Backend backend);
+
+// Executes one 60 Hz frame: up to `cycles_per_frame` opcodes followed
+// by a timer tick. Timers are not ticked if the Chip-8 traps.
+StopReason RunFrame(Chip *chip, uint32_t cycles_per_frame);
 
 /******************************** OPCODES ***********************/
 // Clear the display.
@@ -17,6 +78,27 @@ void ClearDisplay(Chip *chip, opcode op);
 // Return from a subroutine.
 void ReturnFromSubroutine(Chip *chip, opcode op);
 
+// Scroll the display down n rows.
+void ScrollDisplayDown(Chip *chip, opcode op);
+
+// Scroll the display up n rows.
+void ScrollDisplayUp(Chip *chip, opcode op);
+
+// Scroll the display right 4 pixels.
+void ScrollDisplayRight(Chip *chip, opcode op);
+
+// Scroll the display left 4 pixels.
+void ScrollDisplayLeft(Chip *chip, opcode op);
+
+// Exit the interpreter.
+void ExitInterpreter(Chip *chip, opcode op);
+
+// Switch to low resolution, clearing the display.
+void DisableHighResolution(Chip *chip, opcode op);
+
+// Switch to high resolution, clearing the display.
+void EnableHighResolution(Chip *chip, opcode op);
+
 // Jump to the address embedded within the opcode.
 void JumpToOpcodeAddress(Chip *chip, opcode op);
 
@@ -32,6 +114,12 @@ void SkipIfByteNotEqualToRegister(Chip *chip, opcode op);
 // Skip next instruction if Vx = Vy.
 void SkipIfRegistersEqual(Chip *chip, opcode op);
 
+// Store registers Vx through Vy in memory starting at I
+void SaveRegisterRange(Chip *chip, opcode op);
+
+// Read into registers Vx through Vy from memory starting at I
+void LoadRegisterRange(Chip *chip, opcode op);
+
 // Set Vx = kk.
 void SetRegisterToByte(Chip *chip, opcode op);
 
@@ -77,7 +165,8 @@ void JumpToOpcodeRegisterSum(Chip *chip, opcode op);
 // Vx = random byte & kk
 void RandomizeRegister(Chip *chip, opcode op);
 
-// Display n-byte sprite pointed at by Chip's address register
+// Display n-byte sprite pointed at by Chip's address register, or a
+// 16x16 sprite if n is 0, on each selected plane
 void DisplaySprite(Chip *chip, opcode op);
 
 // Skip next instruction if key with value of Vx is pressed.
@@ -86,6 +175,15 @@ void SkipIfKeyPressed(Chip *chip, opcode op);
 // Skip next instruction if key with value of Vx is not pressed.
 void SkipIfKeyNotPressed(Chip *chip, opcode op);
 
+// I = the 16-bit address following the opcode, which is skipped.
+void LoadLongAddress(Chip *chip, opcode op);
+
+// Select the planes that drawing, clearing and scrolling act on
+void SelectPlanes(Chip *chip, opcode op);
+
+// Load the 16-byte audio pattern from memory starting at I
+void LoadAudioPattern(Chip *chip, opcode op);
+
 // Set Vx = delay timer value.
 void SetRegisterToDelayTimer(Chip *chip, opcode op);
 
@@ -104,14 +202,26 @@ void AddToAddressRegister(Chip *chip, opcode op);
 // I = location of sprite for digit Vx
 void SetAddressRegisterToSprite(Chip *chip, opcode op);
 
+// I = location of big sprite for digit Vx
+void SetAddressRegisterToBigSprite(Chip *chip, opcode op);
+
 // store bcd representation of Vx in memory locations at
 // I, I + 1, and I + 2.
 void StoreBCDRepresentation(Chip *chip, opcode op);
 
+// Set the audio pattern's pitch to Vx
+void SetAudioPitch(Chip *chip, opcode op);
+
 // Store registers V0 through Vx in memory starting at I
 void StoreRegisters(Chip *chip, opcode op);
 
 // Read into registers V0 through Vx in memory starting at I
 void ReadRegisters(Chip *chip, opcode op);
 
+// Store registers V0 through Vx in the RPL flags
+void StoreRPLFlags(Chip *chip, opcode op);
+
+// Read into registers V0 through Vx from the RPL flags
+void ReadRPLFlags(Chip *chip, opcode op);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "perfcounters.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char *const PERF_COUNTER_NAMES[NUM_PERF_COUNTERS] =
+    {"cycles", "instructions", "branches", "branch_misses", "l1d_misses"};
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct PerfCounters
+{
+    int fds[NUM_PERF_COUNTERS]; // -1 if the counter did not open
+};
+
+// Opens one counter for the calling thread on any CPU, disabled.
+// Returns -1 on failure.
+static int _open_counter(uint32_t type, uint64_t config);
+
+PerfCounters *OpenPerfCounters()
+{
+    PerfCounters *counters = (PerfCounters *)(malloc(sizeof(PerfCounters)));
+    if (!counters)
+    {
+        return NULL;
+    }
+    counters->fds[PERF_CYCLES] = _open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fds[PERF_INSTRUCTIONS] = _open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fds[PERF_BRANCHES] = _open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+    counters->fds[PERF_BRANCH_MISSES] = _open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters->fds[PERF_L1D_MISSES] = _open_counter(PERF_TYPE_HW_CACHE,
+                                                   PERF_COUNT_HW_CACHE_L1D |
+                                                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (counters->fds[i] >= 0)
+        {
+            return counters;
+        }
+    }
+    free(counters);
+    return NULL;
+}
+
+void ClosePerfCounters(PerfCounters *counters)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (counters->fds[i] >= 0)
+        {
+            close(counters->fds[i]);
+        }
+    }
+    free(counters);
+}
+
+void StartPerfCounters(PerfCounters *counters)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (counters->fds[i] >= 0)
+        {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void StopPerfCounters(PerfCounters *counters, PerfSample *sample)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (counters->fds[i] >= 0)
+        {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        // value, time enabled, time running
+        uint64_t data[3];
+        sample->valid[i] = counters->fds[i] >= 0 &&
+                           read(counters->fds[i], data, sizeof(data)) == sizeof(data);
+        sample->values[i] = 0;
+        if (sample->valid[i] && data[2] > 0)
+        {
+            sample->values[i] = data[2] < data[1]
+                                    ? (uint64_t)((double)data[0] * data[1] / data[2])
+                                    : data[0];
+        }
+    }
+}
+
+static int _open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#else
+
+PerfCounters *OpenPerfCounters()
+{
+    return NULL;
+}
+
+void ClosePerfCounters(PerfCounters *counters)
+{
+}
+
+void StartPerfCounters(PerfCounters *counters)
+{
+}
+
+void StopPerfCounters(PerfCounters *counters, PerfSample *sample)
+{
+    memset(sample, 0, sizeof(PerfSample));
+}
+
+#endif
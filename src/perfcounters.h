@@ -0,0 +1,47 @@
+#ifndef _PERFCOUNTERS_H
+#define _PERFCOUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hardware performance counters for the calling thread, read through
+// perf_event_open on Linux. Elsewhere, or where the kernel refuses
+// (see /proc/sys/kernel/perf_event_paranoid), no counters open.
+// Only user-space events are counted.
+
+typedef enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCHES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    NUM_PERF_COUNTERS,
+} PerfCounter;
+
+// Names of the counters, e.g. for JSON output.
+extern const char *const PERF_COUNTER_NAMES[NUM_PERF_COUNTERS];
+
+typedef struct PerfCounters PerfCounters;
+
+// Counts accumulated between StartPerfCounters and StopPerfCounters.
+// Counts are scaled up if the kernel had to multiplex the counters.
+typedef struct
+{
+    uint64_t values[NUM_PERF_COUNTERS];
+    bool valid[NUM_PERF_COUNTERS]; // false if the counter did not open
+} PerfSample;
+
+// Opens every counter the host supports. Returns NULL if none open.
+PerfCounters *OpenPerfCounters();
+
+// Closes the counters.
+void ClosePerfCounters(PerfCounters *counters);
+
+// Resets and starts all counters.
+void StartPerfCounters(PerfCounters *counters);
+
+// Stops all counters and reads them into `sample`.
+void StopPerfCounters(PerfCounters *counters, PerfSample *sample);
+
+#endif
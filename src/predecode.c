@@ -0,0 +1,356 @@
+#include "predecode.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_PATH_LENGTH 4096
+
+// Returns the opcode at the given address
+static opcode _fetch(const Chip *chip, uint16_t address);
+
+// Returns the entry for the given address, or NULL if its page has no
+// entries
+static DecodedInstruction *_find_entry(const PredecodeCache *cache, uint16_t address);
+
+// Returns the entry for the given address, allocating its page if
+// needed. Returns NULL if the page cannot be allocated.
+static DecodedInstruction *_get_entry(PredecodeCache *cache, uint16_t address);
+
+// Decodes the opcodes at the given address into the entry, and marks
+// the pages they were read from as holding code
+static void _decode(Chip *chip, DecodedInstruction *entry, uint16_t address);
+
+// Sets the entry's kind and dispatch index from its opcodes
+static void _classify(DecodedInstruction *entry);
+
+// Marks the pages the entry at the given address was read from as
+// holding code
+static void _mark_code(Chip *chip, const DecodedInstruction *entry, uint16_t address);
+
+// Returns true if the saved entry for the given address is what
+// decoding the Chip-8's memory there could produce
+static bool _is_current(const Chip *chip, const DecodedInstruction *entry, uint16_t address);
+
+// Writes the path of the saved cache for the ROM into `path`
+static void _cache_path(char *path, const char *directory, uint64_t rom_hash);
+
+// Opcodes per entry of each kind
+static const uint8_t KIND_LENGTHS[NUM_DECODED_KINDS] = {0, 1, 2, 2, 3, 2};
+
+// The page every page without entries points to. Its entries are all
+// DECODED_NONE, and it is never written.
+static const DecodedInstruction EMPTY_PAGE[CODE_PAGE_ENTRIES];
+
+PredecodeCache *CreatePredecodeCache()
+{
+    PredecodeCache *cache = (PredecodeCache *)(malloc(sizeof(PredecodeCache)));
+    for (int page = 0; cache && page < NUM_CODE_PAGES; page++)
+    {
+        cache->pages[page] = (DecodedInstruction *)(EMPTY_PAGE);
+    }
+    return cache;
+}
+
+void FreePredecodeCache(PredecodeCache *cache)
+{
+    for (int page = 0; page < NUM_CODE_PAGES; page++)
+    {
+        if (cache->pages[page] != EMPTY_PAGE)
+        {
+            free(cache->pages[page]);
+        }
+    }
+    free(cache);
+}
+
+StopReason RunPredecodedCycles(Chip *chip, uint64_t budget)
+{
+    if (!chip->predecode && !(chip->predecode = CreatePredecodeCache()))
+    {
+        return RunCycles(chip, budget);
+    }
+    return RunDecodedCycles(chip, budget);
+}
+
+DecodedInstruction *DecodeInstruction(Chip *chip, uint16_t address)
+{
+    DecodedInstruction *entry = _get_entry(chip->predecode, address);
+    if (entry && entry->kind == DECODED_NONE)
+    {
+        _decode(chip, entry, address);
+    }
+    return entry;
+}
+
+static opcode _fetch(const Chip *chip, uint16_t address)
+{
+    return (chip->memory[MEMORY_ADDRESS(address)] << 8) |
+           chip->memory[MEMORY_ADDRESS(address + 1)];
+}
+
+void InvalidateCode(Chip *chip, uint16_t address, uint16_t length)
+{
+    if (!chip->predecode || length == 0)
+    {
+        return;
+    }
+    // An entry reads 2 * KIND_LENGTHS bytes from its address on,
+    // wrapping around the end of memory, so entries up to
+    // 2 * MAX_FUSED_OPCODES - 1 bytes before the write may have read it.
+    // Each page is looked up once, as these all but always share one.
+    int page_number = -1;
+    DecodedInstruction *page = NULL;
+    for (int offset = -(2 * MAX_FUSED_OPCODES - 1); offset < length; offset++)
+    {
+        uint16_t entry_address = MEMORY_ADDRESS(address + offset);
+        if (entry_address >> CODE_PAGE_SHIFT != page_number)
+        {
+            page_number = entry_address >> CODE_PAGE_SHIFT;
+            page = chip->predecode->pages[page_number];
+        }
+        DecodedInstruction *entry = &page[entry_address & (CODE_PAGE_ENTRIES - 1)];
+        if (page != EMPTY_PAGE && (offset >= 0 || -offset < 2 * KIND_LENGTHS[entry->kind]))
+        {
+            entry->kind = DECODED_NONE;
+            entry->dispatch = DECODED_NONE;
+        }
+    }
+}
+
+uint64_t GetPredecodeBuildID()
+{
+    // Entries store handler indices, so the ID covers the index of every
+    // opcode along with the layout constants. Loading reclassifies each
+    // entry, which catches changes to the fusion rules. Threads racing
+    // here all compute the same ID.
+    static atomic_uint_least64_t build_id;
+    uint64_t id = atomic_load(&build_id);
+    if (id)
+    {
+        return id;
+    }
+    uint8_t indices[1 << 16];
+    for (uint32_t op = 0; op < sizeof(indices); op++)
+    {
+        indices[op] = DecodeOpcodeIndex((opcode)op);
+    }
+    uint64_t layout[] = {sizeof(DecodedInstruction), NUM_DECODED_KINDS, MAX_FUSED_OPCODES,
+                         NUM_OPCODE_HANDLERS, CODE_PAGE_ENTRIES, sizeof(SavedCodePage)};
+    id = HashROM(indices, sizeof(indices)) ^ HashROM((const uint8_t *)layout, sizeof(layout)) ^
+         HashROM(KIND_LENGTHS, sizeof(KIND_LENGTHS));
+    atomic_store(&build_id, id);
+    return id;
+}
+
+size_t CountDecodedEntries(const PredecodeCache *cache)
+{
+    size_t count = 0;
+    for (int page = 0; page < NUM_CODE_PAGES; page++)
+    {
+        for (int i = 0; i < CODE_PAGE_ENTRIES; i++)
+        {
+            count += cache->pages[page][i].kind != DECODED_NONE;
+        }
+    }
+    return count;
+}
+
+size_t LoadPredecodeCache(Chip *chip, const char *directory, uint64_t rom_hash)
+{
+    if (!chip->predecode && !(chip->predecode = CreatePredecodeCache()))
+    {
+        return 0;
+    }
+    char path[MAX_PATH_LENGTH];
+    _cache_path(path, directory, rom_hash);
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        return 0;
+    }
+    struct stat info;
+    void *mapping = fstat(file, &info) == 0 && (size_t)info.st_size >= sizeof(PredecodeFileHeader)
+                        ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0)
+                        : MAP_FAILED;
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    const PredecodeFileHeader *header = (const PredecodeFileHeader *)(mapping);
+    const SavedCodePage *saved = (const SavedCodePage *)(header + 1);
+    size_t loaded = 0;
+    if (memcmp(header->magic, PREDECODE_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->entry_size == sizeof(DecodedInstruction) &&
+        header->build_id == GetPredecodeBuildID() && header->rom_hash == rom_hash &&
+        sizeof(PredecodeFileHeader) + (uint64_t)header->num_pages * sizeof(SavedCodePage) ==
+            (uint64_t)info.st_size)
+    {
+        for (uint32_t p = 0; p < header->num_pages; p++)
+        {
+            for (int i = 0; saved[p].page < NUM_CODE_PAGES && i < CODE_PAGE_ENTRIES; i++)
+            {
+                uint16_t address = (saved[p].page << CODE_PAGE_SHIFT) | i;
+                DecodedInstruction *entry = _find_entry(chip->predecode, address);
+                if ((!entry || entry->kind == DECODED_NONE) &&
+                    _is_current(chip, &saved[p].entries[i], address) &&
+                    (entry = _get_entry(chip->predecode, address)))
+                {
+                    *entry = saved[p].entries[i];
+                    _mark_code(chip, entry, address);
+                    loaded++;
+                }
+            }
+        }
+    }
+    munmap(mapping, info.st_size);
+    return loaded;
+}
+
+bool SavePredecodeCache(const Chip *chip, const char *directory, uint64_t rom_hash)
+{
+    if (!chip->predecode)
+    {
+        return false;
+    }
+    // Written under a unique name, then renamed over the cache, so
+    // concurrent savers and loaders never see a partial file.
+    char path[MAX_PATH_LENGTH];
+    char temporary_path[MAX_PATH_LENGTH + sizeof(".XXXXXX")];
+    _cache_path(path, directory, rom_hash);
+    snprintf(temporary_path, sizeof(temporary_path), "%s.XXXXXX", path);
+    int file = mkstemp(temporary_path);
+    if (file < 0)
+    {
+        return false;
+    }
+
+    PredecodeFileHeader header = {{0}, sizeof(DecodedInstruction), GetPredecodeBuildID(), rom_hash,
+                                  0, 0};
+    memcpy(header.magic, PREDECODE_FILE_MAGIC, sizeof(header.magic));
+    for (int page = 0; page < NUM_CODE_PAGES; page++)
+    {
+        header.num_pages += chip->predecode->pages[page] != EMPTY_PAGE;
+    }
+    bool written = write(file, &header, sizeof(header)) == sizeof(header);
+    for (int page = 0; written && page < NUM_CODE_PAGES; page++)
+    {
+        if (chip->predecode->pages[page] != EMPTY_PAGE)
+        {
+            SavedCodePage saved = {page, 0, {{{0}}}};
+            memcpy(saved.entries, chip->predecode->pages[page], sizeof(saved.entries));
+            written = write(file, &saved, sizeof(saved)) == sizeof(saved);
+        }
+    }
+    written &= close(file) == 0;
+    if (!written || rename(temporary_path, path) != 0)
+    {
+        unlink(temporary_path);
+        return false;
+    }
+    return true;
+}
+
+static DecodedInstruction *_find_entry(const PredecodeCache *cache, uint16_t address)
+{
+    address = MEMORY_ADDRESS(address);
+    DecodedInstruction *page = cache->pages[address >> CODE_PAGE_SHIFT];
+    return page != EMPTY_PAGE ? &page[address & (CODE_PAGE_ENTRIES - 1)] : NULL;
+}
+
+static DecodedInstruction *_get_entry(PredecodeCache *cache, uint16_t address)
+{
+    address = MEMORY_ADDRESS(address);
+    DecodedInstruction **page = &cache->pages[address >> CODE_PAGE_SHIFT];
+    if (*page == EMPTY_PAGE)
+    {
+        DecodedInstruction *entries =
+            (DecodedInstruction *)(calloc(CODE_PAGE_ENTRIES, sizeof(DecodedInstruction)));
+        if (!entries)
+        {
+            return NULL;
+        }
+        *page = entries;
+    }
+    return &(*page)[address & (CODE_PAGE_ENTRIES - 1)];
+}
+
+static void _decode(Chip *chip, DecodedInstruction *entry, uint16_t address)
+{
+    for (int i = 0; i < MAX_FUSED_OPCODES; i++)
+    {
+        entry->ops[i] = _fetch(chip, address + 2 * i);
+    }
+    _classify(entry);
+    _mark_code(chip, entry, address);
+}
+
+static void _classify(DecodedInstruction *entry)
+{
+    entry->kind = DECODED_SINGLE;
+
+    opcode first = entry->ops[0] & 0xF000;
+    opcode second = entry->ops[1] & 0xF000;
+    if (first == 0xA000 && second == 0xD000)
+    {
+        entry->kind = DECODED_SET_I_AND_DRAW;
+    }
+    else if (first == 0x6000 && second == 0x6000)
+    {
+        entry->kind = DECODED_SET_TWO_REGISTERS;
+    }
+    else if (first == 0x7000 && second == 0x3000 &&
+             (entry->ops[2] & 0xF000) == 0x1000)
+    {
+        entry->kind = DECODED_COUNTING_LOOP;
+    }
+    else if ((entry->ops[0] & 0xF0FF) == 0xF01E &&
+             (entry->ops[1] & 0xF0FF) == 0xF065)
+    {
+        entry->kind = DECODED_ADD_I_AND_READ;
+    }
+    entry->dispatch = entry->kind == DECODED_SINGLE ? SINGLE_DISPATCH(DecodeOpcodeIndex(entry->ops[0]))
+                                                    : entry->kind;
+}
+
+static void _mark_code(Chip *chip, const DecodedInstruction *entry, uint16_t address)
+{
+    uint16_t first = MEMORY_ADDRESS(address) >> CODE_PAGE_SHIFT;
+    uint16_t last = MEMORY_ADDRESS(address + 2 * KIND_LENGTHS[entry->kind] - 1) >> CODE_PAGE_SHIFT;
+    chip->code_pages[first / 64] |= 1ULL << (first % 64);
+    chip->code_pages[last / 64] |= 1ULL << (last % 64);
+}
+
+static bool _is_current(const Chip *chip, const DecodedInstruction *entry, uint16_t address)
+{
+    if (entry->kind == DECODED_NONE || entry->kind >= NUM_DECODED_KINDS)
+    {
+        return false;
+    }
+    // The opcodes the entry runs must still be in memory. Those past
+    // them only chose its kind, which a write there does not change
+    // either, as InvalidateCode leaves the entry in place.
+    for (int i = 0; i < KIND_LENGTHS[entry->kind]; i++)
+    {
+        if (entry->ops[i] != _fetch(chip, address + 2 * i))
+        {
+            return false;
+        }
+    }
+    DecodedInstruction decoded = *entry;
+    _classify(&decoded);
+    return decoded.kind == entry->kind && decoded.dispatch == entry->dispatch;
+}
+
+static void _cache_path(char *path, const char *directory, uint64_t rom_hash)
+{
+    snprintf(path, MAX_PATH_LENGTH, "%s/%016llx-%016llx.n8pd", directory,
+             (unsigned long long)rom_hash, (unsigned long long)GetPredecodeBuildID());
+}
@@ -0,0 +1,148 @@
+#ifndef _PREDECODE_H
+#define _PREDECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip.h"
+#include "opcodes.h"
+
+// The predecoded backend. The opcode at each address is decoded once
+// into a cache entry holding its handler's index in OPCODE_HANDLERS,
+// and common opcode sequences are fused into superinstructions that
+// run as a single dispatch:
+//
+//     Annn Dxyn       set I, then draw
+//     6xkk 6ykk       set two registers
+//     7xkk 3ykk 1nnn  counting loop: add, then loop until equal
+//     Fx1E Fy65       advance I, then load registers
+//
+// None of the fused opcodes can trap, wait or write memory, so a fused
+// sequence has exactly the architectural effect of its opcodes run one
+// by one. Entries run through RunDecodedCycles, where each entry is a
+// single computed goto on its `dispatch` index to code for its handler
+// or fused sequence; an entry that has not been decoded dispatches to
+// the decoder.
+//
+// Entries are allocated a code page (see CODE_PAGE_SHIFT) at a time,
+// the first time an opcode in the page is decoded, so a Chip-8 only
+// pays for the pages it runs code from. Pages without entries share a
+// page of undecoded entries, so running never checks for a page.
+//
+// Decoding sets the bits of chip->code_pages for the pages an entry
+// was read from. Every store to guest memory goes through a write
+// barrier that, on a page with code, calls InvalidateCode to drop
+// exactly the entries that read the written bytes, so self-modifying
+// code runs correctly without checking entries before use.
+
+// Number of opcodes in the longest fused sequence
+#define MAX_FUSED_OPCODES 3
+
+// Entries per code page
+#define CODE_PAGE_ENTRIES (1 << CODE_PAGE_SHIFT)
+
+// Kinds of cache entries. Values are stable within a build.
+typedef enum
+{
+    DECODED_NONE,              // not decoded yet
+    DECODED_SINGLE,            // one opcode, run by its handler
+    DECODED_SET_I_AND_DRAW,    // Annn Dxyn
+    DECODED_SET_TWO_REGISTERS, // 6xkk 6ykk
+    DECODED_COUNTING_LOOP,     // 7xkk 3ykk 1nnn
+    DECODED_ADD_I_AND_READ,    // Fx1E Fy65
+    NUM_DECODED_KINDS,
+} DecodedKind;
+
+// The dispatch index of a single opcode with the given OPCODE_HANDLERS
+// index. Every other kind of entry dispatches on its kind.
+#define SINGLE_DISPATCH(handler_index) (NUM_DECODED_KINDS + (handler_index))
+
+typedef struct
+{
+    opcode ops[MAX_FUSED_OPCODES]; // the opcodes, as read from memory
+    uint8_t kind;                  // a DecodedKind
+    uint8_t dispatch;              // the kind, or SINGLE_DISPATCH of the handler
+} DecodedInstruction;
+
+struct PredecodeCache
+{
+    // The entries of each code page, indexed by address within it. Pages
+    // where nothing has been decoded share a read-only page of
+    // DECODED_NONE entries.
+    DecodedInstruction *pages[NUM_CODE_PAGES];
+};
+
+// Allocates an empty cache. Returns NULL on failure.
+PredecodeCache *CreatePredecodeCache();
+
+// Frees the cache.
+void FreePredecodeCache(PredecodeCache *cache);
+
+// Same as RunCycles, using the Chip-8's predecode cache, which is
+// created on first use. Runs through RunCycles if it cannot be.
+StopReason RunPredecodedCycles(Chip *chip, uint64_t budget);
+
+// Same as RunPredecodedCycles once the cache exists. Defined in
+// opcodes.c with the other backends.
+StopReason RunDecodedCycles(Chip *chip, uint64_t budget);
+
+// Returns the cache entry for the opcode at the given address, decoding
+// it first if it has not been. Returns NULL if its page cannot be
+// allocated.
+DecodedInstruction *DecodeInstruction(Chip *chip, uint16_t address);
+
+// Drops the cache entries that were decoded from any of the `length`
+// bytes starting at `address`. Must be called after writing to guest
+// memory other than through the opcode handlers.
+void InvalidateCode(Chip *chip, uint16_t address, uint16_t length);
+
+// A cache can be saved to disk and loaded by a later process, so that
+// short runs start warm. Saved caches live in a directory, one file per
+// ROM and build, named "<rom hash>-<build ID>.n8pd" with the ROM's
+// HashROM and GetPredecodeBuildID in hex. The file is a
+// PredecodeFileHeader followed by a SavedCodePage for each page with
+// entries, in host byte order.
+//
+// Loading maps the file and keeps only the entries that decode the
+// same way from the Chip-8's current memory, so a stale or damaged
+// file costs decoding time, never correctness.
+
+#define PREDECODE_FILE_MAGIC "N8PD"
+
+typedef struct
+{
+    char magic[4];
+    uint32_t entry_size; // sizeof(DecodedInstruction)
+    uint64_t build_id;
+    uint64_t rom_hash;
+    uint32_t num_pages;
+    uint32_t reserved;
+} PredecodeFileHeader;
+
+typedef struct
+{
+    uint32_t page; // below NUM_CODE_PAGES
+    uint32_t reserved;
+    DecodedInstruction entries[CODE_PAGE_ENTRIES];
+} SavedCodePage;
+
+// Returns an ID for the cache layout and the decoder's handler
+// numbering, hashed from the layout constants and the handler index of
+// every opcode. Saved caches with another ID are ignored.
+uint64_t GetPredecodeBuildID();
+
+// Returns the number of decoded entries in the cache.
+size_t CountDecodedEntries(const PredecodeCache *cache);
+
+// Loads the saved cache for the ROM with the given hash from the
+// directory into the Chip-8's cache, creating it if needed. Call after
+// loading the ROM. Returns the number of entries loaded, 0 if there is
+// no usable saved cache.
+size_t LoadPredecodeCache(Chip *chip, const char *directory, uint64_t rom_hash);
+
+// Saves the Chip-8's cache for the ROM with the given hash to the
+// directory, atomically replacing any saved before. Returns false if
+// there is no cache or it cannot be written.
+bool SavePredecodeCache(const Chip *chip, const char *directory, uint64_t rom_hash);
+
+#endif
@@ -0,0 +1,370 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_STACK_CAPACITY 64
+#define NUM_OPCODES 0x10000
+
+typedef struct
+{
+    opcode mask;
+    opcode value;
+    const char *name;
+} OpcodeClass;
+
+// Opcode classes in the order they are matched; 5xy? and 9xy? match
+// any low nibble, like ExecuteOpcode.
+static const OpcodeClass OPCODE_CLASSES[] =
+    {
+        {0xFFFF, 0x00E0, "00E0 CLS"},
+        {0xFFFF, 0x00EE, "00EE RET"},
+        {0xFFF0, 0x00C0, "00Cn SCD"},
+        {0xFFFF, 0x00FB, "00FB SCR"},
+        {0xFFFF, 0x00FC, "00FC SCL"},
+        {0xFFFF, 0x00FD, "00FD EXIT"},
+        {0xFFFF, 0x00FE, "00FE LOW"},
+        {0xFFFF, 0x00FF, "00FF HIGH"},
+        {0xFFF0, 0x00D0, "00Dn SCU"},
+        {0xF000, 0x0000, "0nnn SYS"},
+        {0xF000, 0x1000, "1nnn JP"},
+        {0xF000, 0x2000, "2nnn CALL"},
+        {0xF000, 0x3000, "3xkk SE"},
+        {0xF000, 0x4000, "4xkk SNE"},
+        {0xF00F, 0x5002, "5xy2 SAVE"},
+        {0xF00F, 0x5003, "5xy3 LOAD"},
+        {0xF000, 0x5000, "5xy0 SE"},
+        {0xF000, 0x6000, "6xkk LD"},
+        {0xF000, 0x7000, "7xkk ADD"},
+        {0xF00F, 0x8000, "8xy0 LD"},
+        {0xF00F, 0x8001, "8xy1 OR"},
+        {0xF00F, 0x8002, "8xy2 AND"},
+        {0xF00F, 0x8003, "8xy3 XOR"},
+        {0xF00F, 0x8004, "8xy4 ADD"},
+        {0xF00F, 0x8005, "8xy5 SUB"},
+        {0xF00F, 0x8006, "8xy6 SHR"},
+        {0xF00F, 0x8007, "8xy7 SUBN"},
+        {0xF00F, 0x800E, "8xyE SHL"},
+        {0xF000, 0x9000, "9xy0 SNE"},
+        {0xF000, 0xA000, "Annn LD I"},
+        {0xF000, 0xB000, "Bnnn JP V0"},
+        {0xF000, 0xC000, "Cxkk RND"},
+        {0xF00F, 0xD000, "Dxy0 DRW"},
+        {0xF000, 0xD000, "Dxyn DRW"},
+        {0xF0FF, 0xE09E, "Ex9E SKP"},
+        {0xF0FF, 0xE0A1, "ExA1 SKNP"},
+        {0xF0FF, 0xF000, "F000 LD I"},
+        {0xF0FF, 0xF001, "Fn01 PLANE"},
+        {0xF0FF, 0xF002, "F002 AUDIO"},
+        {0xF0FF, 0xF007, "Fx07 LD DT"},
+        {0xF0FF, 0xF00A, "Fx0A LD K"},
+        {0xF0FF, 0xF015, "Fx15 LD DT"},
+        {0xF0FF, 0xF018, "Fx18 LD ST"},
+        {0xF0FF, 0xF01E, "Fx1E ADD I"},
+        {0xF0FF, 0xF029, "Fx29 LD F"},
+        {0xF0FF, 0xF030, "Fx30 LD HF"},
+        {0xF0FF, 0xF033, "Fx33 LD B"},
+        {0xF0FF, 0xF03A, "Fx3A PITCH"},
+        {0xF0FF, 0xF055, "Fx55 LD [I]"},
+        {0xF0FF, 0xF065, "Fx65 LD [I]"},
+        {0xF0FF, 0xF075, "Fx75 LD R"},
+        {0xF0FF, 0xF085, "Fx85 LD R"},
+        {0x0000, 0x0000, "unknown"},
+};
+
+#define NUM_OPCODE_CLASSES (sizeof(OPCODE_CLASSES) / sizeof(OPCODE_CLASSES[0]))
+#define CALL_CLASS 11
+
+// A call stack and the number of opcodes executed while it was current.
+// Used as an open-addressing hash table entry; depth is 0 when unused.
+typedef struct
+{
+    uint16_t frames[STACK_SIZE];
+    uint8_t depth;
+    uint64_t count;
+} StackEntry;
+
+typedef struct
+{
+    uint16_t pc;
+    uint64_t count;
+} HotPC;
+
+struct Profile
+{
+    uint8_t class_of[NUM_OPCODES];
+    uint64_t class_counts[NUM_OPCODE_CLASSES];
+    uint64_t pc_counts[MEMORY_SIZE];
+    opcode last_opcode[MEMORY_SIZE];
+    uint64_t instructions;
+
+    // Subroutine entry addresses by stack depth; frames[0] is the
+    // address profiling started at.
+    uint16_t frames[STACK_SIZE];
+    bool started;
+    uint8_t depth;         // stack depth of the current entry
+    size_t current;        // index of the current entry in `stacks`
+    bool current_is_valid; // false after a call or return
+
+    StackEntry *stacks;
+    size_t stack_capacity; // power of two
+    size_t num_stacks;
+};
+
+// Returns the index of the entry for frames[0..depth], adding it if needed
+static size_t _find_stack(Profile *profile, uint8_t depth);
+
+// Doubles the capacity of the stack table
+static bool _grow_stacks(Profile *profile);
+
+// Returns the hash of the given frames
+static uint64_t _hash_frames(const uint16_t *frames, uint8_t depth);
+
+// Counts and executes the opcode at the program counter
+static void _step(Profile *profile, Chip *chip);
+
+// qsort comparator ordering HotPCs by descending count
+static int _compare_hot_pcs(const void *lhs, const void *rhs);
+
+Profile *CreateProfile()
+{
+    Profile *profile = (Profile *)(calloc(1, sizeof(Profile)));
+    if (!profile)
+    {
+        return NULL;
+    }
+    profile->stacks = (StackEntry *)(calloc(INITIAL_STACK_CAPACITY, sizeof(StackEntry)));
+    if (!profile->stacks)
+    {
+        free(profile);
+        return NULL;
+    }
+    profile->stack_capacity = INITIAL_STACK_CAPACITY;
+
+    for (size_t op = 0; op < NUM_OPCODES; op++)
+    {
+        size_t class = 0;
+        while ((op & OPCODE_CLASSES[class].mask) != OPCODE_CLASSES[class].value)
+        {
+            class++;
+        }
+        profile->class_of[op] = class;
+    }
+    return profile;
+}
+
+void FreeProfile(Profile *profile)
+{
+    free(profile->stacks);
+    free(profile);
+}
+
+StopReason RunProfiledCycles(Profile *profile, Chip *chip, uint64_t budget)
+{
+    for (uint64_t i = 0; i < budget; i++)
+    {
+        _step(profile, chip);
+        if (chip->trap != TRAP_NONE)
+        {
+            return STOP_TRAPPED;
+        }
+        if (chip->waiting_for_key)
+        {
+            return STOP_WAITING_FOR_KEY;
+        }
+    }
+    return STOP_BUDGET_EXHAUSTED;
+}
+
+StopReason RunProfiledFrame(Profile *profile, Chip *chip, uint32_t cycles_per_frame)
+{
+    StopReason reason = RunProfiledCycles(profile, chip, cycles_per_frame);
+    if (reason != STOP_TRAPPED)
+    {
+        TickTimers(chip);
+    }
+    return reason;
+}
+
+uint64_t GetProfiledInstructionCount(const Profile *profile)
+{
+    return profile->instructions;
+}
+
+void WriteFoldedStacks(const Profile *profile, FILE *file)
+{
+    for (size_t i = 0; i < profile->stack_capacity; i++)
+    {
+        const StackEntry *entry = &profile->stacks[i];
+        if (entry->depth == 0 || entry->count == 0)
+        {
+            continue;
+        }
+        for (int d = 0; d < entry->depth; d++)
+        {
+            fprintf(file, "%s0x%03X", d ? ";" : "", entry->frames[d]);
+        }
+        fprintf(file, " %llu\n", (unsigned long long)entry->count);
+    }
+}
+
+void WriteHotPCs(const Profile *profile, FILE *file, size_t max_rows)
+{
+    double total = profile->instructions ? profile->instructions : 1;
+
+    fprintf(file, "%-12s %12s %8s\n", "class", "count", "percent");
+    for (size_t c = 0; c < NUM_OPCODE_CLASSES; c++)
+    {
+        if (profile->class_counts[c])
+        {
+            fprintf(file, "%-12s %12llu %7.2f%%\n", OPCODE_CLASSES[c].name,
+                    (unsigned long long)profile->class_counts[c],
+                    100.0 * profile->class_counts[c] / total);
+        }
+    }
+
+    HotPC *pcs = (HotPC *)(malloc(MEMORY_SIZE * sizeof(HotPC)));
+    if (!pcs)
+    {
+        return;
+    }
+    for (int pc = 0; pc < MEMORY_SIZE; pc++)
+    {
+        pcs[pc].pc = pc;
+        pcs[pc].count = profile->pc_counts[pc];
+    }
+    qsort(pcs, MEMORY_SIZE, sizeof(HotPC), _compare_hot_pcs);
+
+    fprintf(file, "\n%-6s %-6s %-12s %12s %8s\n", "pc", "opcode", "class", "count", "percent");
+    for (size_t i = 0; i < max_rows && i < MEMORY_SIZE && pcs[i].count; i++)
+    {
+        uint16_t pc = pcs[i].pc;
+        opcode op = profile->last_opcode[pc];
+        fprintf(file, "0x%03X  %04X   %-12s %12llu %7.2f%%\n", pc, op,
+                OPCODE_CLASSES[profile->class_of[op]].name,
+                (unsigned long long)profile->pc_counts[pc],
+                100.0 * profile->pc_counts[pc] / total);
+    }
+    free(pcs);
+}
+
+static void _step(Profile *profile, Chip *chip)
+{
+    uint16_t pc = MEMORY_ADDRESS(chip->program_counter);
+    uint8_t depth = chip->stack_pointer < STACK_SIZE ? chip->stack_pointer : STACK_SIZE - 1;
+    if (!profile->started)
+    {
+        // Frames entered before profiling began are named by their
+        // return addresses.
+        profile->frames[0] = pc;
+        memcpy(&profile->frames[1], &chip->stack[1], (STACK_SIZE - 1) * sizeof(uint16_t));
+        profile->started = true;
+    }
+    if (!profile->current_is_valid || depth != profile->depth)
+    {
+        profile->current = _find_stack(profile, depth);
+        profile->depth = depth;
+        profile->current_is_valid = true;
+    }
+
+    opcode op = (chip->memory[pc] << 8) | chip->memory[MEMORY_ADDRESS(pc + 1)];
+    ExecuteOpcode(chip);
+    if (chip->trap != TRAP_NONE)
+    {
+        return;
+    }
+
+    uint8_t class = profile->class_of[op];
+    profile->class_counts[class]++;
+    profile->pc_counts[pc]++;
+    profile->last_opcode[pc] = op;
+    profile->stacks[profile->current].count++;
+    profile->instructions++;
+
+    if (class == CALL_CLASS && chip->stack_pointer < STACK_SIZE)
+    {
+        profile->frames[chip->stack_pointer] = op & 0xFFF;
+        profile->current_is_valid = false;
+    }
+}
+
+static size_t _find_stack(Profile *profile, uint8_t depth)
+{
+    // Entries store depth + 1 frames so that 0 marks an unused entry.
+    uint8_t length = depth + 1;
+    if (2 * (profile->num_stacks + 1) > profile->stack_capacity && !_grow_stacks(profile))
+    {
+        // Out of memory: lump everything into the current entry.
+        return profile->current;
+    }
+
+    size_t mask = profile->stack_capacity - 1;
+    size_t index = _hash_frames(profile->frames, length) & mask;
+    for (;;)
+    {
+        StackEntry *entry = &profile->stacks[index];
+        if (entry->depth == 0)
+        {
+            memcpy(entry->frames, profile->frames, length * sizeof(uint16_t));
+            entry->depth = length;
+            profile->num_stacks++;
+            return index;
+        }
+        if (entry->depth == length &&
+            memcmp(entry->frames, profile->frames, length * sizeof(uint16_t)) == 0)
+        {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static bool _grow_stacks(Profile *profile)
+{
+    size_t capacity = profile->stack_capacity * 2;
+    StackEntry *stacks = (StackEntry *)(calloc(capacity, sizeof(StackEntry)));
+    if (!stacks)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < profile->stack_capacity; i++)
+    {
+        const StackEntry *entry = &profile->stacks[i];
+        if (entry->depth == 0)
+        {
+            continue;
+        }
+        size_t index = _hash_frames(entry->frames, entry->depth) & (capacity - 1);
+        while (stacks[index].depth != 0)
+        {
+            index = (index + 1) & (capacity - 1);
+        }
+        stacks[index] = *entry;
+    }
+    free(profile->stacks);
+    profile->stacks = stacks;
+    profile->stack_capacity = capacity;
+    profile->current_is_valid = false;
+    return true;
+}
+
+static uint64_t _hash_frames(const uint16_t *frames, uint8_t depth)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < depth; i++)
+    {
+        hash = (hash ^ frames[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int _compare_hot_pcs(const void *lhs, const void *rhs)
+{
+    const HotPC *a = lhs;
+    const HotPC *b = rhs;
+    if (a->count != b->count)
+    {
+        return (a->count < b->count) - (a->count > b->count);
+    }
+    return a->pc - b->pc;
+}
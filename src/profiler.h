@@ -0,0 +1,46 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip.h"
+#include "opcodes.h"
+
+// Counts opcode executions per opcode class, per program counter and
+// per guest call stack. Profiled runs step the Chip-8 one opcode at a
+// time through ExecuteOpcode, so profiling costs nothing when it is
+// not used.
+//
+// Call stacks are named by the subroutine entry addresses on the
+// Chip-8's stack, outermost first, starting with the address execution
+// was at when profiling began.
+
+typedef struct Profile Profile;
+
+// Returns a new, empty profile, or NULL on failure.
+Profile *CreateProfile();
+
+// Frees the profile.
+void FreeProfile(Profile *profile);
+
+// Same as RunCycles, counting every opcode executed into the profile.
+StopReason RunProfiledCycles(Profile *profile, Chip *chip, uint64_t budget);
+
+// Same as RunFrame, counting every opcode executed into the profile.
+StopReason RunProfiledFrame(Profile *profile, Chip *chip, uint32_t cycles_per_frame);
+
+// Returns the number of opcodes counted so far.
+uint64_t GetProfiledInstructionCount(const Profile *profile);
+
+// Writes one "<frame>;<frame>;... <count>" line per call stack, the
+// folded format read by flamegraph.pl and speedscope.
+void WriteFoldedStacks(const Profile *profile, FILE *file);
+
+// Writes the execution count of every opcode class, then the
+// `max_rows` most executed program counters with the opcode last seen
+// there, as text tables.
+void WriteHotPCs(const Profile *profile, FILE *file, size_t max_rows);
+
+#endif
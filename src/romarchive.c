@@ -0,0 +1,293 @@
+#include "romarchive.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip.h"
+
+struct ROMArchive
+{
+    const uint8_t *mapping;
+    size_t mapping_size;
+    const ArchiveHeader *header;
+    const ArchiveEntry *entries;
+    const uint32_t *by_name;
+    const char *names;
+};
+
+// A ROM being packed, with its position in the written entries
+typedef struct
+{
+    const PackedROM *rom;
+    uint64_t hash;
+    uint32_t entry;
+} PackSlot;
+
+// Points the archive at the sections of its mapping. Returns false if
+// the mapping is not an archive or any offset in it is out of bounds.
+static bool _locate_sections(ROMArchive *archive);
+
+// Fills in `rom` from the entry at `index`.
+static void _get_rom(const ROMArchive *archive, uint32_t index, ArchivedROM *rom);
+
+// qsort comparators ordering PackSlots by hash then name, and by name.
+static int _compare_hashes(const void *lhs, const void *rhs);
+static int _compare_names(const void *lhs, const void *rhs);
+
+ROMArchive *OpenROMArchive(const char *filename)
+{
+    int file = open(filename, O_RDONLY);
+    if (file < 0)
+    {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode) ||
+        (size_t)info.st_size < sizeof(ArchiveHeader))
+    {
+        close(file);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    ROMArchive *archive = (ROMArchive *)(malloc(sizeof(ROMArchive)));
+    if (!archive)
+    {
+        munmap(mapping, info.st_size);
+        return NULL;
+    }
+    archive->mapping = (const uint8_t *)(mapping);
+    archive->mapping_size = info.st_size;
+    archive->header = (const ArchiveHeader *)(mapping);
+    if (!_locate_sections(archive))
+    {
+        CloseROMArchive(archive);
+        return NULL;
+    }
+    return archive;
+}
+
+void CloseROMArchive(ROMArchive *archive)
+{
+    munmap((void *)archive->mapping, archive->mapping_size);
+    free(archive);
+}
+
+size_t GetArchivedROMCount(const ROMArchive *archive)
+{
+    return archive->header->count;
+}
+
+bool GetArchivedROM(const ROMArchive *archive, size_t index, ArchivedROM *rom)
+{
+    if (index >= archive->header->count)
+    {
+        return false;
+    }
+    _get_rom(archive, index, rom);
+    return true;
+}
+
+bool FindArchivedROMByHash(const ROMArchive *archive, uint64_t hash, ArchivedROM *rom)
+{
+    uint32_t low = 0;
+    uint32_t high = archive->header->count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (archive->entries[middle].hash < hash)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low == archive->header->count || archive->entries[low].hash != hash)
+    {
+        return false;
+    }
+    _get_rom(archive, low, rom);
+    return true;
+}
+
+bool FindArchivedROMByName(const ROMArchive *archive, const char *name, ArchivedROM *rom)
+{
+    uint32_t low = 0;
+    uint32_t high = archive->header->count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        uint32_t entry = archive->by_name[middle];
+        int order = strcmp(archive->names + archive->entries[entry].name_offset, name);
+        if (order == 0)
+        {
+            _get_rom(archive, entry, rom);
+            return true;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+bool WriteROMArchive(const char *filename, const PackedROM *roms, size_t count)
+{
+    PackSlot *slots = (PackSlot *)(malloc((count ? count : 1) * sizeof(PackSlot)));
+    if (!slots)
+    {
+        return false;
+    }
+    uint64_t names_size = 0;
+    uint64_t data_size = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        slots[i].rom = &roms[i];
+        slots[i].hash = HashROM(roms[i].data, roms[i].size);
+        names_size += strlen(roms[i].name) + 1;
+        data_size += roms[i].size;
+    }
+    uint64_t data_start = sizeof(ArchiveHeader) + count * (sizeof(ArchiveEntry) + sizeof(uint32_t)) +
+                          names_size;
+    if (data_start + data_size > UINT32_MAX)
+    {
+        free(slots);
+        return false;
+    }
+
+    // Entries go in hash order, and the name index points at them.
+    qsort(slots, count, sizeof(PackSlot), _compare_hashes);
+    for (size_t i = 0; i < count; i++)
+    {
+        slots[i].entry = i;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        free(slots);
+        return false;
+    }
+    ArchiveHeader header = {{0}, ROM_ARCHIVE_VERSION, count, names_size};
+    memcpy(header.magic, ROM_ARCHIVE_MAGIC, sizeof(header.magic));
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    uint32_t name_offset = 0;
+    uint32_t data_offset = data_start;
+    for (size_t i = 0; i < count; i++)
+    {
+        ArchiveEntry entry = {slots[i].hash, data_offset, slots[i].rom->size, name_offset, 0};
+        written &= fwrite(&entry, sizeof(entry), 1, file) == 1;
+        name_offset += strlen(slots[i].rom->name) + 1;
+        data_offset += slots[i].rom->size;
+    }
+
+    qsort(slots, count, sizeof(PackSlot), _compare_names);
+    bool distinct = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        distinct &= i == 0 || strcmp(slots[i - 1].rom->name, slots[i].rom->name) != 0;
+        written &= fwrite(&slots[i].entry, sizeof(uint32_t), 1, file) == 1;
+    }
+    qsort(slots, count, sizeof(PackSlot), _compare_hashes);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *name = slots[i].rom->name;
+        written &= fwrite(name, strlen(name) + 1, 1, file) == 1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        written &= fwrite(slots[i].rom->data, 1, slots[i].rom->size, file) == slots[i].rom->size;
+    }
+    written &= fclose(file) == 0;
+    free(slots);
+    if (!distinct)
+    {
+        remove(filename);
+    }
+    return written && distinct;
+}
+
+static bool _locate_sections(ROMArchive *archive)
+{
+    const ArchiveHeader *header = archive->header;
+    if (memcmp(header->magic, ROM_ARCHIVE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != ROM_ARCHIVE_VERSION)
+    {
+        return false;
+    }
+    uint64_t entries_start = sizeof(ArchiveHeader);
+    uint64_t by_name_start = entries_start + (uint64_t)header->count * sizeof(ArchiveEntry);
+    uint64_t names_start = by_name_start + (uint64_t)header->count * sizeof(uint32_t);
+    if (names_start + header->names_size > archive->mapping_size)
+    {
+        return false;
+    }
+    archive->entries = (const ArchiveEntry *)(archive->mapping + entries_start);
+    archive->by_name = (const uint32_t *)(archive->mapping + by_name_start);
+    archive->names = (const char *)(archive->mapping + names_start);
+
+    // The last name is terminated, so every name offset in bounds is.
+    if (header->count > 0 &&
+        (header->names_size == 0 || archive->names[header->names_size - 1] != '\0'))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->count; i++)
+    {
+        const ArchiveEntry *entry = &archive->entries[i];
+        if (entry->name_offset >= header->names_size ||
+            (uint64_t)entry->data_offset + entry->size > archive->mapping_size ||
+            archive->by_name[i] >= header->count ||
+            (i > 0 && archive->entries[i - 1].hash > entry->hash))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _get_rom(const ROMArchive *archive, uint32_t index, ArchivedROM *rom)
+{
+    const ArchiveEntry *entry = &archive->entries[index];
+    rom->name = archive->names + entry->name_offset;
+    rom->data = archive->mapping + entry->data_offset;
+    rom->size = entry->size;
+    rom->hash = entry->hash;
+}
+
+static int _compare_hashes(const void *lhs, const void *rhs)
+{
+    const PackSlot *left = lhs;
+    const PackSlot *right = rhs;
+    if (left->hash != right->hash)
+    {
+        return left->hash < right->hash ? -1 : 1;
+    }
+    return strcmp(left->rom->name, right->rom->name);
+}
+
+static int _compare_names(const void *lhs, const void *rhs)
+{
+    const PackSlot *left = lhs;
+    const PackSlot *right = rhs;
+    return strcmp(left->rom->name, right->rom->name);
+}
@@ -0,0 +1,85 @@
+#ifndef _ROMARCHIVE_H
+#define _ROMARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A single file holding many ROMs, indexed by content hash (HashROM)
+// and by name. Opening an archive maps it into memory; lookups are
+// binary searches over the mapped index and return pointers into the
+// mapping, so nothing is copied until a ROM is loaded into a Chip-8.
+//
+// The file is little-endian:
+//
+//     ArchiveHeader
+//     ArchiveEntry[count]  sorted by hash, then by name
+//     uint32_t[count]      entry indices sorted by name
+//     char[names_size]     NUL-terminated names
+//     ROM data
+
+#define ROM_ARCHIVE_MAGIC "N8AR"
+#define ROM_ARCHIVE_VERSION 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t names_size;
+} ArchiveHeader;
+
+typedef struct
+{
+    uint64_t hash;
+    uint32_t data_offset; // from the start of the file
+    uint32_t size;
+    uint32_t name_offset; // into the names
+    uint32_t reserved;
+} ArchiveEntry;
+
+typedef struct ROMArchive ROMArchive;
+
+// A ROM in an archive. Valid until the archive is closed.
+typedef struct
+{
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+    uint64_t hash;
+} ArchivedROM;
+
+// A ROM to pack with WriteROMArchive.
+typedef struct
+{
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+} PackedROM;
+
+// Maps the archive with the given filename. Returns NULL if it cannot
+// be read or is not a valid archive.
+ROMArchive *OpenROMArchive(const char *filename);
+
+// Unmaps the archive.
+void CloseROMArchive(ROMArchive *archive);
+
+// Returns the number of ROMs in the archive.
+size_t GetArchivedROMCount(const ROMArchive *archive);
+
+// Fills in the ROM at `index`, in hash order. Returns false if there
+// is none.
+bool GetArchivedROM(const ROMArchive *archive, size_t index, ArchivedROM *rom);
+
+// Fills in a ROM with the given content hash. Returns false if there
+// is none.
+bool FindArchivedROMByHash(const ROMArchive *archive, uint64_t hash, ArchivedROM *rom);
+
+// Fills in the ROM with the given name. Returns false if there is none.
+bool FindArchivedROMByName(const ROMArchive *archive, const char *name, ArchivedROM *rom);
+
+// Writes the ROMs, whose names must be distinct, as an archive to the
+// given filename. Returns false if it cannot be written.
+bool WriteROMArchive(const char *filename, const PackedROM *roms, size_t count);
+
+#endif
@@ -0,0 +1,188 @@
+#include "runstats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+const uint32_t FRAME_TIME_LIMITS_MS[NUM_FRAME_TIME_BUCKETS - 1] = {8, 12, 17, 20, 25, 34, 50};
+
+// Returns a monotonic timestamp in nanoseconds.
+static uint64_t _now_ns();
+
+// Adds to a counter only written by the calling thread.
+static void _increment(atomic_uint_least64_t *counter, uint64_t amount);
+
+// Appends formatted text at buffer + *used, never past `size` bytes.
+static void _append(char *buffer, size_t size, size_t *used, const char *format, ...);
+
+void InitializeRuntimeStats(RuntimeStats *stats)
+{
+    stats->start_ns = _now_ns();
+    atomic_init(&stats->instructions, 0);
+    atomic_init(&stats->frames_emulated, 0);
+    atomic_init(&stats->timer_ticks, 0);
+    atomic_init(&stats->frames_published, 0);
+    atomic_init(&stats->late_frames, 0);
+    atomic_init(&stats->frames_presented, 0);
+    atomic_init(&stats->fresh_frames_presented, 0);
+    for (int i = 0; i < NUM_FRAME_TIME_BUCKETS; i++)
+    {
+        atomic_init(&stats->frame_times[i], 0);
+    }
+}
+
+void CountEmulatedFrame(RuntimeStats *stats, uint64_t instructions, bool ticked)
+{
+    _increment(&stats->instructions, instructions);
+    _increment(&stats->frames_emulated, 1);
+    if (ticked)
+    {
+        _increment(&stats->timer_ticks, 1);
+    }
+}
+
+void CountPublishedFrame(RuntimeStats *stats)
+{
+    _increment(&stats->frames_published, 1);
+}
+
+void CountLateFrame(RuntimeStats *stats)
+{
+    _increment(&stats->late_frames, 1);
+}
+
+void CountPresentedFrame(RuntimeStats *stats, bool fresh, uint64_t frame_time_ns)
+{
+    _increment(&stats->frames_presented, 1);
+    if (fresh)
+    {
+        _increment(&stats->fresh_frames_presented, 1);
+    }
+    int bucket = 0;
+    while (bucket < NUM_FRAME_TIME_BUCKETS - 1 &&
+           frame_time_ns >= FRAME_TIME_LIMITS_MS[bucket] * 1000000ULL)
+    {
+        bucket++;
+    }
+    _increment(&stats->frame_times[bucket], 1);
+}
+
+void GetRuntimeStats(RuntimeStats *stats, RuntimeStatsSnapshot *snapshot)
+{
+    snapshot->uptime_ns = _now_ns() - stats->start_ns;
+    snapshot->instructions = atomic_load_explicit(&stats->instructions, memory_order_relaxed);
+    snapshot->frames_emulated = atomic_load_explicit(&stats->frames_emulated, memory_order_relaxed);
+    snapshot->timer_ticks = atomic_load_explicit(&stats->timer_ticks, memory_order_relaxed);
+    snapshot->frames_published = atomic_load_explicit(&stats->frames_published, memory_order_relaxed);
+    snapshot->late_frames = atomic_load_explicit(&stats->late_frames, memory_order_relaxed);
+    snapshot->frames_presented = atomic_load_explicit(&stats->frames_presented, memory_order_relaxed);
+    snapshot->fresh_frames_presented =
+        atomic_load_explicit(&stats->fresh_frames_presented, memory_order_relaxed);
+    for (int i = 0; i < NUM_FRAME_TIME_BUCKETS; i++)
+    {
+        snapshot->frame_times[i] = atomic_load_explicit(&stats->frame_times[i], memory_order_relaxed);
+    }
+    // The counters are read one at a time, so a screen published
+    // between the two loads may look presented but not published.
+    snapshot->frames_dropped = snapshot->frames_published > snapshot->fresh_frames_presented
+                                   ? snapshot->frames_published - snapshot->fresh_frames_presented
+                                   : 0;
+    snapshot->audio_underruns = 0;
+}
+
+void FormatRuntimeStats(const RuntimeStatsSnapshot *snapshot,
+                        const RuntimeStatsSnapshot *previous,
+                        char *buffer, size_t size)
+{
+    static const RuntimeStatsSnapshot START = {0};
+    if (!previous)
+    {
+        previous = &START;
+    }
+    double seconds = (snapshot->uptime_ns - previous->uptime_ns) / 1e9;
+    seconds = seconds > 0 ? seconds : 1;
+    size_t used = 0;
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    _append(buffer, size, &used, "ips %.0f\n",
+            (snapshot->instructions - previous->instructions) / seconds);
+    _append(buffer, size, &used, "fps emulated %.1f presented %.1f timers %.1f\n",
+            (snapshot->frames_emulated - previous->frames_emulated) / seconds,
+            (snapshot->frames_presented - previous->frames_presented) / seconds,
+            (snapshot->timer_ticks - previous->timer_ticks) / seconds);
+    _append(buffer, size, &used, "frames emulated %llu published %llu presented %llu\n",
+            (unsigned long long)snapshot->frames_emulated,
+            (unsigned long long)snapshot->frames_published,
+            (unsigned long long)snapshot->frames_presented);
+    _append(buffer, size, &used, "dropped %llu late %llu audio underruns %llu\n",
+            (unsigned long long)snapshot->frames_dropped,
+            (unsigned long long)snapshot->late_frames,
+            (unsigned long long)snapshot->audio_underruns);
+    _append(buffer, size, &used, "frame ms");
+    for (int i = 0; i < NUM_FRAME_TIME_BUCKETS; i++)
+    {
+        if (i < NUM_FRAME_TIME_BUCKETS - 1)
+        {
+            _append(buffer, size, &used, " <%u:%llu", FRAME_TIME_LIMITS_MS[i],
+                    (unsigned long long)snapshot->frame_times[i]);
+        }
+        else
+        {
+            _append(buffer, size, &used, " >%u:%llu", FRAME_TIME_LIMITS_MS[i - 1],
+                    (unsigned long long)snapshot->frame_times[i]);
+        }
+    }
+    _append(buffer, size, &used, "\nuptime %.1f s\n", snapshot->uptime_ns / 1e9);
+}
+
+bool DumpRuntimeStats(const RuntimeStatsSnapshot *snapshot, const char *filename)
+{
+    char text[RUNTIME_STATS_TEXT_SIZE];
+    FormatRuntimeStats(snapshot, NULL, text, sizeof(text));
+
+    FILE *file = filename ? fopen(filename, "w") : stderr;
+    if (!file)
+    {
+        return false;
+    }
+    bool written = fputs(text, file) >= 0;
+    if (filename)
+    {
+        written &= fclose(file) == 0;
+    }
+    return written;
+}
+
+static uint64_t _now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void _increment(atomic_uint_least64_t *counter, uint64_t amount)
+{
+    // Single writer, so a load and a store suffice and no locked
+    // instruction is needed.
+    uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, value + amount, memory_order_relaxed);
+}
+
+static void _append(char *buffer, size_t size, size_t *used, const char *format, ...)
+{
+    if (*used >= size)
+    {
+        return;
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    int written = vsnprintf(buffer + *used, size - *used, format, arguments);
+    va_end(arguments);
+    if (written > 0)
+    {
+        *used += written;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef _RUNSTATS_H
+#define _RUNSTATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Always-on counters for a running emulator. Each counter has a single
+// writer thread and uses relaxed atomics, so counting costs about as
+// much as a plain increment and any thread can take a snapshot.
+
+// Host frame times are counted in buckets whose upper limits are
+// FRAME_TIME_LIMITS_MS; the last bucket holds everything slower.
+#define NUM_FRAME_TIME_BUCKETS 8
+extern const uint32_t FRAME_TIME_LIMITS_MS[NUM_FRAME_TIME_BUCKETS - 1];
+
+typedef struct
+{
+    uint64_t start_ns;
+
+    // Written by the emulation thread.
+    atomic_uint_least64_t instructions;
+    atomic_uint_least64_t frames_emulated;
+    atomic_uint_least64_t timer_ticks;
+    atomic_uint_least64_t frames_published; // screens handed to the renderer
+    atomic_uint_least64_t late_frames;      // frames emulated behind schedule
+
+    // Written by the render thread.
+    atomic_uint_least64_t frames_presented;
+    atomic_uint_least64_t fresh_frames_presented; // presented a new screen
+    atomic_uint_least64_t frame_times[NUM_FRAME_TIME_BUCKETS];
+} RuntimeStats;
+
+// A copy of the counters at one moment.
+typedef struct
+{
+    uint64_t uptime_ns;
+    uint64_t instructions;
+    uint64_t frames_emulated;
+    uint64_t timer_ticks;
+    uint64_t frames_published;
+    uint64_t late_frames;
+    uint64_t frames_presented;
+    uint64_t fresh_frames_presented;
+    uint64_t frames_dropped; // published but replaced before being presented
+    uint64_t frame_times[NUM_FRAME_TIME_BUCKETS];
+    uint64_t audio_underruns; // filled in by the caller, if it has audio
+} RuntimeStatsSnapshot;
+
+// Zeroes the counters and starts the uptime clock.
+void InitializeRuntimeStats(RuntimeStats *stats);
+
+// Counts one emulated frame of `instructions` opcodes, and a timer tick
+// if the timers were ticked.
+void CountEmulatedFrame(RuntimeStats *stats, uint64_t instructions, bool ticked);
+
+// Counts a screen handed to the renderer.
+void CountPublishedFrame(RuntimeStats *stats);
+
+// Counts a frame emulated later than it was due.
+void CountLateFrame(RuntimeStats *stats);
+
+// Counts a presented host frame that took `frame_time_ns` since the
+// previous one. `fresh` is true if it showed a newly published screen.
+void CountPresentedFrame(RuntimeStats *stats, bool fresh, uint64_t frame_time_ns);
+
+// Copies the counters into `snapshot`.
+void GetRuntimeStats(RuntimeStats *stats, RuntimeStatsSnapshot *snapshot);
+
+// Large enough for FormatRuntimeStats' output.
+#define RUNTIME_STATS_TEXT_SIZE 1024
+
+// Writes the snapshot as lines of text into `buffer`, truncating to
+// `size` bytes. Rates are averaged since `previous`, or since start if
+// `previous` is NULL.
+void FormatRuntimeStats(const RuntimeStatsSnapshot *snapshot,
+                        const RuntimeStatsSnapshot *previous,
+                        char *buffer, size_t size);
+
+// Writes the formatted snapshot to the given file, or to stderr if
+// `filename` is NULL. Returns false if the file cannot be written.
+bool DumpRuntimeStats(const RuntimeStatsSnapshot *snapshot, const char *filename);
+
+#endif
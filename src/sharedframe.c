@@ -0,0 +1,268 @@
+#include "sharedframe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+
+// A reader spins this many times while a frame is being written, then
+// yields the CPU between checks, and gives up after MAX_READ_WAITS
+// checks in all. Publishing a frame takes about a microsecond, so only
+// a writer that stopped mid-frame keeps a reader waiting that long.
+#define READ_SPINS 64
+#define MAX_READ_WAITS 10000
+
+// ReadSharedFrame's retries while frames keep changing under it
+#define MAX_READ_ATTEMPTS 1000
+#define WORDS_PER_ROW (SCREEN_ROW_BITS / 64)
+
+typedef struct
+{
+    atomic_uint_fast64_t sequence;
+    uint64_t high_resolution;
+    uint64_t rows[NUM_PLANES][HIRES_DISPLAY_HEIGHT_IN_PIXELS][WORDS_PER_ROW];
+} SharedFrameSlot;
+
+// Slots are padded to whole cache lines so writers of neighbouring
+// slots do not contend.
+#define SLOT_SIZE ((sizeof(SharedFrameSlot) + CACHE_LINE_SIZE - 1) / \
+                   CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+#define HEADER_SIZE CACHE_LINE_SIZE
+
+struct SharedFramebuffer
+{
+    uint8_t *base;
+    size_t size;
+    char *name; // set only for the creator, which unlinks the segment
+};
+
+// Returns the given slot of the segment.
+static SharedFrameSlot *_slot(const SharedFramebuffer *framebuffer, uint32_t slot);
+
+// Returns the size of a segment with the given number of slots.
+static size_t _segment_size(uint32_t num_slots);
+
+// Tells the CPU that the thread is spinning.
+static inline void _pause();
+
+SharedFramebuffer *CreateSharedFramebuffer(const char *name, uint32_t num_slots)
+{
+    // O_EXCL keeps a second writer from replacing a live segment.
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    size_t size = _segment_size(num_slots);
+    if (ftruncate(fd, size) != 0)
+    {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        int error = errno;
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+
+    SharedFramebuffer *framebuffer = (SharedFramebuffer *)(malloc(sizeof(SharedFramebuffer)));
+    framebuffer->base = base;
+    framebuffer->size = size;
+    framebuffer->name = strdup(name);
+
+    // ftruncate zero-fills, so every slot starts at sequence 0.
+    SharedFrameHeader header = {SHARED_FRAME_MAGIC, 0,
+                                HIRES_DISPLAY_WIDTH_IN_PIXELS, HIRES_DISPLAY_HEIGHT_IN_PIXELS,
+                                num_slots, SLOT_SIZE};
+    memcpy(base, &header, sizeof(header));
+    // Readers check the version last, so publish it after the rest.
+    atomic_thread_fence(memory_order_release);
+    ((SharedFrameHeader *)base)->version = SHARED_FRAME_VERSION;
+    return framebuffer;
+}
+
+SharedFramebuffer *OpenSharedFramebuffer(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < HEADER_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const SharedFrameHeader *header = base;
+    if (header->magic != SHARED_FRAME_MAGIC ||
+        header->version != SHARED_FRAME_VERSION ||
+        header->width != HIRES_DISPLAY_WIDTH_IN_PIXELS ||
+        header->height != HIRES_DISPLAY_HEIGHT_IN_PIXELS ||
+        header->slot_size != SLOT_SIZE ||
+        _segment_size(header->num_slots) > (size_t)info.st_size)
+    {
+        munmap(base, info.st_size);
+        return NULL;
+    }
+
+    SharedFramebuffer *framebuffer = (SharedFramebuffer *)(malloc(sizeof(SharedFramebuffer)));
+    framebuffer->base = base;
+    framebuffer->size = info.st_size;
+    framebuffer->name = NULL;
+    return framebuffer;
+}
+
+void CloseSharedFramebuffer(SharedFramebuffer *framebuffer)
+{
+    munmap(framebuffer->base, framebuffer->size);
+    if (framebuffer->name)
+    {
+        shm_unlink(framebuffer->name);
+        free(framebuffer->name);
+    }
+    free(framebuffer);
+}
+
+uint32_t GetSharedFrameSlotCount(const SharedFramebuffer *framebuffer)
+{
+    return ((const SharedFrameHeader *)framebuffer->base)->num_slots;
+}
+
+void PublishFrame(SharedFramebuffer *framebuffer, uint32_t slot, const Chip *chip)
+{
+    SharedFrameSlot *target = _slot(framebuffer, slot);
+    uint64_t sequence = atomic_load_explicit(&target->sequence, memory_order_relaxed);
+    atomic_store_explicit(&target->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    target->high_resolution = chip->high_resolution;
+    int height = GetScreenHeight(chip);
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        for (int i = 0; i < height; i++)
+        {
+            target->rows[plane][i][0] = chip->screen[plane][i] >> 64;
+            target->rows[plane][i][1] = chip->screen[plane][i];
+        }
+    }
+    atomic_store_explicit(&target->sequence, sequence + 2, memory_order_release);
+}
+
+bool BeginFrameRead(const SharedFramebuffer *framebuffer, uint32_t slot, uint64_t *sequence)
+{
+    SharedFrameSlot *source = _slot(framebuffer, slot);
+    for (int wait = 0; wait < MAX_READ_WAITS; wait++)
+    {
+        *sequence = atomic_load_explicit(&source->sequence, memory_order_acquire);
+        if (!(*sequence & 1))
+        {
+            return true;
+        }
+        // A frame is being written.
+        if (wait < READ_SPINS)
+        {
+            _pause();
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    return false;
+}
+
+bool EndFrameRead(const SharedFramebuffer *framebuffer, uint32_t slot, uint64_t sequence)
+{
+    SharedFrameSlot *source = _slot(framebuffer, slot);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&source->sequence, memory_order_relaxed) == sequence;
+}
+
+bool IsSharedFrameHighResolution(const SharedFramebuffer *framebuffer, uint32_t slot)
+{
+    return _slot(framebuffer, slot)->high_resolution;
+}
+
+const uint64_t *GetSharedFrameRows(const SharedFramebuffer *framebuffer, uint32_t slot)
+{
+    return &_slot(framebuffer, slot)->rows[0][0][0];
+}
+
+bool ReadSharedFrame(const SharedFramebuffer *framebuffer, uint32_t slot,
+                     uint8_t *pixels, uint64_t *frame)
+{
+    // Copy the rows out first, so the seqlock is held only for a copy
+    // and the unpacking below works on a consistent frame.
+    uint64_t rows[NUM_PLANES][HIRES_DISPLAY_HEIGHT_IN_PIXELS][WORDS_PER_ROW];
+    bool high_resolution;
+    uint64_t sequence;
+    int attempt = 0;
+    do
+    {
+        if (attempt++ == MAX_READ_ATTEMPTS || !BeginFrameRead(framebuffer, slot, &sequence))
+        {
+            return false;
+        }
+        high_resolution = IsSharedFrameHighResolution(framebuffer, slot);
+        memcpy(rows, GetSharedFrameRows(framebuffer, slot), sizeof(rows));
+    } while (!EndFrameRead(framebuffer, slot, sequence));
+
+    // A low-resolution pixel covers 2x2 pixels of the frame.
+    int scale = high_resolution ? 1 : 2;
+    for (int i = 0; i < HIRES_DISPLAY_HEIGHT_IN_PIXELS; i++)
+    {
+        for (int j = 0; j < HIRES_DISPLAY_WIDTH_IN_PIXELS; j++)
+        {
+            int x = j / scale;
+            uint8_t color = 0;
+            for (int plane = 0; plane < NUM_PLANES; plane++)
+            {
+                uint64_t word = rows[plane][i / scale][x / 64];
+                color |= ((word >> (63 - x % 64)) & 1) << plane;
+            }
+            *pixels++ = color;
+        }
+    }
+    *frame = sequence / 2;
+    return true;
+}
+
+static SharedFrameSlot *_slot(const SharedFramebuffer *framebuffer, uint32_t slot)
+{
+    return (SharedFrameSlot *)(framebuffer->base + HEADER_SIZE + (size_t)slot * SLOT_SIZE);
+}
+
+static size_t _segment_size(uint32_t num_slots)
+{
+    return HEADER_SIZE + (size_t)num_slots * SLOT_SIZE;
+}
+
+static inline void _pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
@@ -0,0 +1,81 @@
+#ifndef _SHAREDFRAME_H
+#define _SHAREDFRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip.h"
+
+// Publishes Chip-8 framebuffers through POSIX shared memory so other
+// processes can read frames without sockets or copies.
+//
+// The segment holds a header followed by `num_slots` slots, one per
+// Chip-8 (a single frontend uses one slot, a batch one per job). Each
+// slot is a seqlock: the writer makes the slot's sequence odd, writes
+// the pixels, then makes it even again. Readers sample the sequence
+// before and after reading, and retry if it was odd or changed.
+// A slot's sequence divided by two is the number of frames published.
+//
+// A slot holds the screen as the Chip-8 keeps it, so publishing is a
+// copy of its rows: a uint64_t that is nonzero at high resolution,
+// then for each plane `height` rows of two uint64_t, the leftmost
+// pixel in the most significant bit of the first. At low resolution
+// only the first 32 rows' first words are the frame; the rest of the
+// slot is left as it was.
+
+#define SHARED_FRAME_MAGIC 0x4246394e // "N9FB"
+#define SHARED_FRAME_VERSION 4
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width; // in pixels, at high resolution
+    uint32_t height;
+    uint32_t num_slots;
+    uint32_t slot_size; // bytes from one slot to the next
+} SharedFrameHeader;
+
+typedef struct SharedFramebuffer SharedFramebuffer;
+
+// Creates the shared memory segment `name`, e.g. "/ninechipper", with
+// room for `num_slots` framebuffers. Returns NULL and sets errno on
+// failure; errno is EEXIST if the segment already exists, which is
+// never replaced.
+SharedFramebuffer *CreateSharedFramebuffer(const char *name, uint32_t num_slots);
+
+// Maps an existing segment read-only. Returns NULL on failure or if
+// the segment was not made by a compatible writer.
+SharedFramebuffer *OpenSharedFramebuffer(const char *name);
+
+// Unmaps the segment, and removes it if this process created it.
+void CloseSharedFramebuffer(SharedFramebuffer *framebuffer);
+
+// Returns the number of slots in the segment.
+uint32_t GetSharedFrameSlotCount(const SharedFramebuffer *framebuffer);
+
+// Copies the Chip-8's screen into the slot as the next frame.
+// Only one thread may publish to a given slot.
+void PublishFrame(SharedFramebuffer *framebuffer, uint32_t slot, const Chip *chip);
+
+// Zero-copy reads: BeginFrameRead waits until the slot is not being
+// written and sets `sequence` to its sequence; the slot's resolution
+// and the rows at GetSharedFrameRows may then be read in place.
+// EndFrameRead returns true if they were not overwritten in the
+// meantime, otherwise the read must be retried. BeginFrameRead waits
+// only a few milliseconds, and returns false if the slot is still
+// being written, as it is forever if the writer died mid-frame.
+bool BeginFrameRead(const SharedFramebuffer *framebuffer, uint32_t slot, uint64_t *sequence);
+bool EndFrameRead(const SharedFramebuffer *framebuffer, uint32_t slot, uint64_t sequence);
+bool IsSharedFrameHighResolution(const SharedFramebuffer *framebuffer, uint32_t slot);
+const uint64_t *GetSharedFrameRows(const SharedFramebuffer *framebuffer, uint32_t slot);
+
+// Copies a consistent frame out of the slot into `pixels`, which must
+// hold width * height bytes, as UnpackScreen would: one byte per pixel
+// holding its color, with low-resolution pixels doubled. Sets `frame`
+// to the frame's number. Returns false, leaving `pixels` unchanged, if
+// no consistent frame could be read before giving up.
+bool ReadSharedFrame(const SharedFramebuffer *framebuffer, uint32_t slot,
+                     uint8_t *pixels, uint64_t *frame);
+
+#endif
@@ -0,0 +1,303 @@
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define INITIAL_DEQUE_CAPACITY 64
+
+typedef struct
+{
+    TaskFunction function;
+    void *argument;
+} Task;
+
+// A worker's deque, stored as a ring buffer. The owner pushes and
+// pops at the back; thieves take from the front.
+typedef struct
+{
+    pthread_mutex_t lock;
+    Task *tasks;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    pthread_t thread;
+    struct ThreadPool *pool;
+    int index;
+} Worker;
+
+struct ThreadPool
+{
+    Worker *workers;
+    int num_workers;   // workers with a running thread
+    int num_allocated; // workers with an initialized deque
+    int next_worker;
+    atomic_size_t queued;  // tasks sitting in some deque
+    atomic_size_t pending; // tasks submitted but not yet finished
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    bool stopping;
+};
+
+// Main loop of every worker thread.
+static void *_worker_main(void *argument);
+
+// Runs a task and marks it finished, waking WaitForTasks after the last.
+static void _run_task(ThreadPool *pool, Task task);
+
+// Appends a task to the back of the worker's deque. Returns false if
+// the deque was full and could not grow.
+static bool _push_back(Worker *worker, Task task);
+
+// Takes the task at the back of the worker's deque.
+// Returns false if the deque is empty.
+static bool _pop_back(Worker *worker, Task *task);
+
+// Takes the task at the front of the worker's deque.
+// Returns false if the deque is empty.
+static bool _steal_front(Worker *worker, Task *task);
+
+// Tries to take a task from any other worker's deque.
+static bool _steal(ThreadPool *pool, int thief, Task *task);
+
+int GetNumCores()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+ThreadPool *CreateThreadPool(int num_threads)
+{
+    if (num_threads <= 0)
+    {
+        num_threads = GetNumCores();
+    }
+
+    ThreadPool *pool = (ThreadPool *)(calloc(1, sizeof(ThreadPool)));
+    if (!pool)
+    {
+        return NULL;
+    }
+    pool->workers = (Worker *)(calloc(num_threads, sizeof(Worker)));
+    if (!pool->workers)
+    {
+        free(pool);
+        return NULL;
+    }
+    pool->num_workers = num_threads;
+    pool->num_allocated = num_threads;
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        Worker *worker = &pool->workers[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->tasks = (Task *)(malloc(INITIAL_DEQUE_CAPACITY * sizeof(Task)));
+        if (!worker->tasks)
+        {
+            pool->num_workers = 0;
+            pool->num_allocated = i + 1;
+            DestroyThreadPool(pool);
+            return NULL;
+        }
+        worker->capacity = INITIAL_DEQUE_CAPACITY;
+        worker->pool = pool;
+        worker->index = i;
+    }
+    for (int i = 0; i < num_threads; i++)
+    {
+        Worker *worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, _worker_main, worker) != 0)
+        {
+            // Run with the workers that did start.
+            pool->num_workers = i;
+            break;
+        }
+    }
+    if (pool->num_workers == 0)
+    {
+        DestroyThreadPool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void SubmitTask(ThreadPool *pool, TaskFunction function, void *argument)
+{
+    Task task = {function, argument};
+    atomic_fetch_add(&pool->pending, 1);
+
+    // Count the task before it is pushed, so a worker that takes it
+    // never brings `queued` below zero, and under the pool lock, so a
+    // worker about to sleep cannot miss the wakeup.
+    pthread_mutex_lock(&pool->lock);
+    Worker *worker = &pool->workers[pool->next_worker];
+    pool->next_worker = (pool->next_worker + 1) % pool->num_workers;
+    atomic_fetch_add(&pool->queued, 1);
+    bool pushed = _push_back(worker, task);
+    if (pushed)
+    {
+        pthread_cond_signal(&pool->work_available);
+    }
+    else
+    {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    // Without room to queue it, the task runs on the submitting thread.
+    if (!pushed)
+    {
+        _run_task(pool, task);
+    }
+}
+
+void WaitForTasks(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) > 0)
+    {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void DestroyThreadPool(ThreadPool *pool)
+{
+    WaitForTasks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_workers; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->num_allocated; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].tasks);
+    }
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+static void *_worker_main(void *argument)
+{
+    Worker *self = argument;
+    ThreadPool *pool = self->pool;
+
+    for (;;)
+    {
+        Task task;
+        if (_pop_back(self, &task) || _steal(pool, self->index, &task))
+        {
+            atomic_fetch_sub(&pool->queued, 1);
+            _run_task(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+        bool done = pool->stopping && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (done)
+        {
+            return NULL;
+        }
+    }
+}
+
+static void _run_task(ThreadPool *pool, Task task)
+{
+    task.function(task.argument);
+    if (atomic_fetch_sub(&pool->pending, 1) == 1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->all_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static bool _push_back(Worker *worker, Task task)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == worker->capacity)
+    {
+        // Grow and unwrap the ring so head is at index 0 again.
+        size_t capacity = worker->capacity * 2;
+        Task *tasks = (Task *)(malloc(capacity * sizeof(Task)));
+        if (!tasks)
+        {
+            pthread_mutex_unlock(&worker->lock);
+            return false;
+        }
+        for (size_t i = 0; i < worker->count; i++)
+        {
+            tasks[i] = worker->tasks[(worker->head + i) % worker->capacity];
+        }
+        free(worker->tasks);
+        worker->tasks = tasks;
+        worker->capacity = capacity;
+        worker->head = 0;
+    }
+    worker->tasks[(worker->head + worker->count) % worker->capacity] = task;
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+    return true;
+}
+
+static bool _pop_back(Worker *worker, Task *task)
+{
+    pthread_mutex_lock(&worker->lock);
+    bool found = worker->count > 0;
+    if (found)
+    {
+        worker->count--;
+        *task = worker->tasks[(worker->head + worker->count) % worker->capacity];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static bool _steal_front(Worker *worker, Task *task)
+{
+    pthread_mutex_lock(&worker->lock);
+    bool found = worker->count > 0;
+    if (found)
+    {
+        *task = worker->tasks[worker->head];
+        worker->head = (worker->head + 1) % worker->capacity;
+        worker->count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static bool _steal(ThreadPool *pool, int thief, Task *task)
+{
+    for (int i = 1; i < pool->num_workers; i++)
+    {
+        Worker *victim = &pool->workers[(thief + i) % pool->num_workers];
+        if (_steal_front(victim, task))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,32 @@
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+// A fixed-size pool of worker threads with work stealing.
+// Every worker owns a deque of tasks. A worker pops its own tasks
+// from the back, and when its deque runs dry it steals from the
+// front of another worker's deque, so long tasks submitted to one
+// worker do not leave the others idle.
+
+typedef void (*TaskFunction)(void *argument);
+
+typedef struct ThreadPool ThreadPool;
+
+// Returns the number of online processors, or 1 if unknown.
+int GetNumCores();
+
+// Creates a pool of `num_threads` workers. If `num_threads` is not
+// positive, uses one worker per core. Returns NULL on failure.
+ThreadPool *CreateThreadPool(int num_threads);
+
+// Queues `function(argument)` to be run by some worker.
+// Tasks are spread round-robin across the workers' deques. If a deque
+// cannot grow to hold the task, it runs on the calling thread instead.
+void SubmitTask(ThreadPool *pool, TaskFunction function, void *argument);
+
+// Blocks until every submitted task has finished running.
+void WaitForTasks(ThreadPool *pool);
+
+// Waits for outstanding tasks, then stops and frees the pool.
+void DestroyThreadPool(ThreadPool *pool);
+
+#endif
@@ -0,0 +1,306 @@
+// Runs a list of headless jobs across all cores and prints one JSON
+// object per job to stdout.
+//
+// Each non-empty line of the job file is
+//     <rom> <seed> <movie|-> <cycle budget> [quirk profile]
+// where the quirk profile is one of QUIRK_PROFILE_NAMES (default, vip,
+// schip or xochip), and is default if omitted. Lines starting with '#'
+// are ignored. With -a, each <rom> is instead the name or 16-digit hex
+// content hash of a ROM in a ninechip-pack archive, and is run
+// straight from the mapped archive. With -p, jobs
+// run on the predecoded backend and share their predecode caches
+// through a directory, so later runs of a ROM start warm.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "../batch.h"
+#include "../romarchive.h"
+
+#define MAX_LINE_LENGTH 4096
+
+// Crashes program and prints error to stderr upon incorrect invocation
+static void Usage();
+
+// Reads the job file, returning an array of jobs and setting `num_jobs`.
+// Crashes on malformed input.
+static BatchJob *ReadJobs(const char *filename, size_t *num_jobs);
+
+// Prints `string` escaped for use inside a JSON string.
+static void PrintEscaped(const char *string);
+
+// Prints the result of a job as a single line of JSON.
+static void PrintResult(size_t index, const BatchJob *job,
+                        const BatchResult *result, bool frame_hashes);
+
+// Points every job at its ROM in the archive, looking it up by hash if
+// its ROM is 16 hex digits and by name otherwise. Crashes if any ROM is
+// not in the archive.
+static void FindJobROMs(const ROMArchive *archive, BatchJob *jobs, size_t num_jobs);
+
+int main(int argc, char *argv[])
+{
+    int num_threads = 0;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    bool frame_hashes = true;
+    const char *shared_name = NULL;
+    const char *archive_path = NULL;
+    const char *predecode_directory = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "j:c:ns:a:p:")) != -1)
+    {
+        switch (option)
+        {
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'c':
+            cycles_per_frame = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            frame_hashes = false;
+            break;
+        case 's':
+            shared_name = optarg;
+            break;
+        case 'a':
+            archive_path = optarg;
+            break;
+        case 'p':
+            predecode_directory = optarg;
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (optind != argc - 1 || cycles_per_frame == 0)
+    {
+        Usage();
+    }
+
+    size_t num_jobs;
+    BatchJob *jobs = ReadJobs(argv[optind], &num_jobs);
+    BatchResult *results = (BatchResult *)(calloc(num_jobs, sizeof(BatchResult)));
+
+    ROMArchive *archive = NULL;
+    if (archive_path)
+    {
+        archive = OpenROMArchive(archive_path);
+        if (!archive)
+        {
+            fprintf(stderr, "Could not open archive %s.\n", archive_path);
+            exit(EXIT_FAILURE);
+        }
+        FindJobROMs(archive, jobs, num_jobs);
+    }
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        jobs[i].predecode_directory = predecode_directory;
+        jobs[i].frame_hashes = frame_hashes;
+    }
+
+    SharedFramebuffer *shared_framebuffer = NULL;
+    if (shared_name)
+    {
+        shared_framebuffer = CreateSharedFramebuffer(shared_name, num_jobs);
+        if (!shared_framebuffer)
+        {
+            if (errno == EEXIST)
+            {
+                fprintf(stderr, "Shared memory %s already exists. Pick another name, or remove "
+                                "it if no other process is writing to it.\n",
+                        shared_name);
+            }
+            else
+            {
+                fprintf(stderr, "Could not create shared memory %s: %s.\n", shared_name,
+                        strerror(errno));
+            }
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < num_jobs; i++)
+        {
+            jobs[i].shared_framebuffer = shared_framebuffer;
+            jobs[i].shared_slot = i;
+        }
+    }
+
+    RunBatch(jobs, results, num_jobs, num_threads, cycles_per_frame);
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        PrintResult(i, &jobs[i], &results[i], frame_hashes);
+    }
+
+    if (shared_framebuffer)
+    {
+        CloseSharedFramebuffer(shared_framebuffer);
+    }
+    if (archive)
+    {
+        CloseROMArchive(archive);
+    }
+    FreeBatchResults(results, num_jobs);
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        free((char *)jobs[i].rom_path);
+        free((char *)jobs[i].movie_path);
+    }
+    free(results);
+    free(jobs);
+    return EXIT_SUCCESS;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: ./ninechip-batch [-j threads] [-c cycles per frame] "
+                    "[-n (omit frame hashes)] [-s shared memory name] [-a rom archive] "
+                    "[-p predecode cache directory] <job file>\n");
+    exit(EXIT_FAILURE);
+}
+
+static BatchJob *ReadJobs(const char *filename, size_t *num_jobs)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    BatchJob *jobs = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        char rom[MAX_LINE_LENGTH];
+        char movie[MAX_LINE_LENGTH];
+        char quirks[MAX_LINE_LENGTH] = "default";
+        unsigned long seed;
+        unsigned long long budget;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+        {
+            continue;
+        }
+        int fields = sscanf(line, "%s %lu %s %llu %s", rom, &seed, movie, &budget, quirks);
+        QuirkProfile quirk_profile = FindQuirkProfile(quirks);
+        if (fields < 4 || quirk_profile == NUM_QUIRK_PROFILES)
+        {
+            fprintf(stderr, "%s:%d: expected <rom> <seed> <movie|-> <cycles> [quirk profile]\n",
+                    filename, line_number);
+            exit(EXIT_FAILURE);
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = realloc(jobs, capacity * sizeof(BatchJob));
+        }
+        jobs[count].rom_path = strdup(rom);
+        jobs[count].rom_data = NULL;
+        jobs[count].rom_size = 0;
+        jobs[count].seed = seed;
+        jobs[count].movie_path = strcmp(movie, "-") ? strdup(movie) : NULL;
+        jobs[count].cycle_budget = budget;
+        jobs[count].quirk_profile = quirk_profile;
+        jobs[count].shared_framebuffer = NULL;
+        jobs[count].shared_slot = 0;
+        count++;
+    }
+    fclose(file);
+    *num_jobs = count;
+    return jobs;
+}
+
+static void PrintEscaped(const char *string)
+{
+    for (const char *c = string; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            printf("\\%c", *c);
+        }
+        else if ((unsigned char)*c < ' ')
+        {
+            printf("\\u%04x", *c);
+        }
+        else
+        {
+            putchar(*c);
+        }
+    }
+}
+
+static void PrintResult(size_t index, const BatchJob *job,
+                        const BatchResult *result, bool frame_hashes)
+{
+    static const char *STOP_NAMES[] = {"budget", "trap", "waiting"};
+
+    printf("{\"job\":%zu,\"rom\":\"", index);
+    PrintEscaped(job->rom_path);
+    printf("\",\"seed\":%" PRIu32, job->seed);
+    if (!result->loaded)
+    {
+        if (result->rom_error != ROM_OK)
+        {
+            printf(",\"error\":\"%s\"}\n", ROM_ERROR_NAMES[result->rom_error]);
+        }
+        else if (result->out_of_memory)
+        {
+            printf(",\"error\":\"out of memory for frame hashes\"}\n");
+        }
+        else
+        {
+            printf(",\"error\":\"could not read movie ");
+            PrintEscaped(job->movie_path);
+            printf("\"}\n");
+        }
+        return;
+    }
+    printf(",\"stop\":\"%s\",\"trap\":\"%s\",\"cycles\":%" PRIu64
+           ",\"frames\":%" PRIu64 ",\"elapsed_ns\":%" PRIu64
+           ",\"final_hash\":\"%016" PRIx64 "\"",
+           STOP_NAMES[result->stop_reason], TRAP_NAMES[result->trap], result->cycles,
+           result->num_frames, result->elapsed_ns, result->final_hash);
+    if (frame_hashes)
+    {
+        printf(",\"frame_hashes\":[");
+        for (uint64_t i = 0; i < result->num_frames; i++)
+        {
+            printf("%s\"%016" PRIx64 "\"", i ? "," : "", result->frame_hashes[i]);
+        }
+        printf("]");
+    }
+    printf("}\n");
+}
+
+static void FindJobROMs(const ROMArchive *archive, BatchJob *jobs, size_t num_jobs)
+{
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        const char *key = jobs[i].rom_path;
+        ArchivedROM rom;
+        bool found;
+        if (strlen(key) == 16 && strspn(key, "0123456789abcdefABCDEF") == 16)
+        {
+            found = FindArchivedROMByHash(archive, strtoull(key, NULL, 16), &rom);
+        }
+        else
+        {
+            found = FindArchivedROMByName(archive, key, &rom);
+        }
+        if (!found)
+        {
+            fprintf(stderr, "%s is not in the archive.\n", key);
+            exit(EXIT_FAILURE);
+        }
+        jobs[i].rom_data = rom.data;
+        jobs[i].rom_size = rom.size;
+    }
+}
@@ -0,0 +1,589 @@
+// Benchmarks the core on the bundled synthetic ROMs, plus every ROM in
+// an optional directory, headless and without any frame pacing, once
+// per dispatch backend, under the quirk profile given with -q and
+// optionally with hardware performance counters (-p). With -m, instead
+// benchmarks every opcode handler in isolation on randomized operands
+// and state.
+// Prints the results as JSON to stdout.
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../benchroms.h"
+#include "../chip.h"
+#include "../opcodes.h"
+#include "../perfcounters.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_CYCLE_COUNTER 1
+#else
+#define HAS_CYCLE_COUNTER 0
+#endif
+
+#define DEFAULT_INSTRUCTIONS 10000000ULL
+#define DEFAULT_REPETITIONS 9
+#define MAX_PATH_LENGTH 4096
+
+// Number of randomized operations per handler microbenchmark run
+#define MICRO_SAMPLES 4096
+
+// Every heap allocation in the process is counted by interposing on
+// glibc's allocator. Elsewhere allocations are reported as null.
+#ifdef __GLIBC__
+#define COUNTS_ALLOCATIONS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static atomic_size_t allocations;
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+#else
+#define COUNTS_ALLOCATIONS 0
+static atomic_size_t allocations;
+#endif
+
+typedef struct
+{
+    uint64_t instructions; // per run
+    uint64_t frames;       // per run
+    bool trapped;
+    size_t allocations;    // during all timed runs
+    double *elapsed_ns;    // one per repetition
+    PerfSample perf;       // summed over all timed runs
+} Measurement;
+
+typedef struct
+{
+    uint64_t instructions;
+    uint32_t cycles_per_frame;
+    int repetitions;
+    Backend backend;
+    PerfCounters *counters; // NULL unless -p was given and counters opened
+} BenchOptions;
+
+// An opcode handler and the opcodes it executes: `base` with any of
+// the bits in `operands` set.
+typedef struct
+{
+    const char *name;
+    const char *pattern;
+    OpcodeHandler handler;
+    opcode base;
+    opcode operands;
+} MicroBenchmark;
+
+static const MicroBenchmark MICRO_BENCHMARKS[] =
+    {
+        {"ClearDisplay", "00E0", ClearDisplay, 0x00E0, 0x0000},
+        {"ReturnFromSubroutine", "00EE", ReturnFromSubroutine, 0x00EE, 0x0000},
+        {"ScrollDisplayDown", "00Cn", ScrollDisplayDown, 0x00C0, 0x000F},
+        {"ScrollDisplayUp", "00Dn", ScrollDisplayUp, 0x00D0, 0x000F},
+        {"ScrollDisplayRight", "00FB", ScrollDisplayRight, 0x00FB, 0x0000},
+        {"ScrollDisplayLeft", "00FC", ScrollDisplayLeft, 0x00FC, 0x0000},
+        {"DisableHighResolution", "00FE", DisableHighResolution, 0x00FE, 0x0000},
+        {"EnableHighResolution", "00FF", EnableHighResolution, 0x00FF, 0x0000},
+        {"JumpToOpcodeAddress", "1nnn", JumpToOpcodeAddress, 0x1000, 0x0FFF},
+        {"CallOpcodeSubroutine", "2nnn", CallOpcodeSubroutine, 0x2000, 0x0FFF},
+        {"SkipIfByteEqualToRegister", "3xkk", SkipIfByteEqualToRegister, 0x3000, 0x0FFF},
+        {"SkipIfByteNotEqualToRegister", "4xkk", SkipIfByteNotEqualToRegister, 0x4000, 0x0FFF},
+        {"SaveRegisterRange", "5xy2", SaveRegisterRange, 0x5002, 0x0FF0},
+        {"LoadRegisterRange", "5xy3", LoadRegisterRange, 0x5003, 0x0FF0},
+        {"SkipIfRegistersEqual", "5xy0", SkipIfRegistersEqual, 0x5000, 0x0FF0},
+        {"SetRegisterToByte", "6xkk", SetRegisterToByte, 0x6000, 0x0FFF},
+        {"AddByteToRegister", "7xkk", AddByteToRegister, 0x7000, 0x0FFF},
+        {"SetRegisterToRegister", "8xy0", SetRegisterToRegister, 0x8000, 0x0FF0},
+        {"OrRegisters", "8xy1", OrRegisters, 0x8001, 0x0FF0},
+        {"AndRegisters", "8xy2", AndRegisters, 0x8002, 0x0FF0},
+        {"XorRegisters", "8xy3", XorRegisters, 0x8003, 0x0FF0},
+        {"AddRegisters", "8xy4", AddRegisters, 0x8004, 0x0FF0},
+        {"SubtractRegisters", "8xy5", SubtractRegisters, 0x8005, 0x0FF0},
+        {"ShiftRegisterRight", "8xy6", ShiftRegisterRight, 0x8006, 0x0FF0},
+        {"SubtractRegistersReverse", "8xy7", SubtractRegistersReverse, 0x8007, 0x0FF0},
+        {"ShiftRegisterLeft", "8xyE", ShiftRegisterLeft, 0x800E, 0x0FF0},
+        {"SkipIfUnequalRegisters", "9xy0", SkipIfUnequalRegisters, 0x9000, 0x0FF0},
+        {"SetAddressRegister", "Annn", SetAddressRegister, 0xA000, 0x0FFF},
+        {"JumpToOpcodeRegisterSum", "Bnnn", JumpToOpcodeRegisterSum, 0xB000, 0x0FFF},
+        {"RandomizeRegister", "Cxkk", RandomizeRegister, 0xC000, 0x0FFF},
+        {"DisplaySprite", "Dxyn", DisplaySprite, 0xD000, 0x0FFF},
+        {"SkipIfKeyPressed", "Ex9E", SkipIfKeyPressed, 0xE09E, 0x0F00},
+        {"SkipIfKeyNotPressed", "ExA1", SkipIfKeyNotPressed, 0xE0A1, 0x0F00},
+        {"LoadLongAddress", "F000", LoadLongAddress, 0xF000, 0x0000},
+        {"SelectPlanes", "Fn01", SelectPlanes, 0xF001, 0x0F00},
+        {"LoadAudioPattern", "F002", LoadAudioPattern, 0xF002, 0x0000},
+        {"SetRegisterToDelayTimer", "Fx07", SetRegisterToDelayTimer, 0xF007, 0x0F00},
+        {"SetRegisterUponKeyPress", "Fx0A", SetRegisterUponKeyPress, 0xF00A, 0x0F00},
+        {"SetDelayTimerToRegister", "Fx15", SetDelayTimerToRegister, 0xF015, 0x0F00},
+        {"SetSoundTimerToRegister", "Fx18", SetSoundTimerToRegister, 0xF018, 0x0F00},
+        {"AddToAddressRegister", "Fx1E", AddToAddressRegister, 0xF01E, 0x0F00},
+        {"SetAddressRegisterToSprite", "Fx29", SetAddressRegisterToSprite, 0xF029, 0x0F00},
+        {"SetAddressRegisterToBigSprite", "Fx30", SetAddressRegisterToBigSprite, 0xF030, 0x0F00},
+        {"StoreBCDRepresentation", "Fx33", StoreBCDRepresentation, 0xF033, 0x0F00},
+        {"SetAudioPitch", "Fx3A", SetAudioPitch, 0xF03A, 0x0F00},
+        {"StoreRegisters", "Fx55", StoreRegisters, 0xF055, 0x0F00},
+        {"ReadRegisters", "Fx65", ReadRegisters, 0xF065, 0x0F00},
+        {"StoreRPLFlags", "Fx75", StoreRPLFlags, 0xF075, 0x0F00},
+        {"ReadRPLFlags", "Fx85", ReadRPLFlags, 0xF085, 0x0F00},
+};
+
+#define NUM_MICRO_BENCHMARKS (sizeof(MICRO_BENCHMARKS) / sizeof(MICRO_BENCHMARKS[0]))
+
+// Crashes program and prints error to stderr upon incorrect invocation
+static void Usage();
+
+// Runs `chip` for options->instructions opcodes, `repetitions` times,
+// each time from a fresh copy of the given Chip-8.
+static void Measure(const Chip *prototype, const BenchOptions *options,
+                    Measurement *measurement);
+
+// Measures the prototype once per backend and prints the results.
+static void MeasureBackends(const char *name, const Chip *prototype,
+                            BenchOptions *options, Measurement *measurement,
+                            bool *first);
+
+// Prints one ROM's results as a JSON object.
+static void PrintMeasurement(const char *name, Backend backend,
+                             const Measurement *measurement, int repetitions,
+                             bool first);
+
+// Times every handler in MICRO_BENCHMARKS and prints the results.
+static void RunMicroBenchmarks(int repetitions);
+
+// Returns the next value of a xorshift32 generator.
+static uint32_t NextRandom(uint32_t *state);
+
+// qsort comparator for doubles.
+static int CompareDoubles(const void *lhs, const void *rhs);
+
+// Prints the performance counter totals per guest instruction, and
+// the branch miss rate, as a JSON object.
+static void PrintPerfCounters(const Measurement *measurement, int repetitions);
+
+// Prints min, p10, median, p90 and max of `values` as a JSON object.
+static void PrintStatistics(const char *name, double *values, int count);
+
+// Returns a monotonic timestamp in nanoseconds.
+static uint64_t NowNs();
+
+// Returns the CPU's timestamp counter, or 0 if there is none.
+static uint64_t ReadCycleCounter();
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = {DEFAULT_INSTRUCTIONS, DEFAULT_CYCLES_PER_FRAME,
+                            DEFAULT_REPETITIONS};
+    const char *rom_directory = NULL;
+    bool micro = false;
+    bool perf = false;
+    QuirkProfile quirk_profile = QUIRKS_DEFAULT;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:c:r:d:q:mp")) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            perf = true;
+            break;
+        case 'm':
+            micro = true;
+            break;
+        case 'n':
+            options.instructions = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            options.cycles_per_frame = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            options.repetitions = atoi(optarg);
+            break;
+        case 'd':
+            rom_directory = optarg;
+            break;
+        case 'q':
+            quirk_profile = FindQuirkProfile(optarg);
+            if (quirk_profile == NUM_QUIRK_PROFILES)
+            {
+                Usage();
+            }
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (optind != argc || options.cycles_per_frame == 0 || options.repetitions <= 0)
+    {
+        Usage();
+    }
+
+    if (micro)
+    {
+        RunMicroBenchmarks(options.repetitions);
+        return EXIT_SUCCESS;
+    }
+
+    if (perf)
+    {
+        options.counters = OpenPerfCounters();
+        if (!options.counters)
+        {
+            fprintf(stderr, "Could not open any performance counters.\n");
+        }
+    }
+
+    printf("{\"instructions\":%" PRIu64 ",\"cycles_per_frame\":%" PRIu32
+           ",\"repetitions\":%d,\"quirks\":\"%s\",\"roms\":[",
+           options.instructions, options.cycles_per_frame, options.repetitions,
+           QUIRK_PROFILE_NAMES[quirk_profile]);
+
+    Measurement measurement;
+    measurement.elapsed_ns = (double *)(malloc(options.repetitions * sizeof(double)));
+    bool first = true;
+    for (size_t i = 0; i < NUM_BENCH_ROMS; i++)
+    {
+        Chip *chip = InitializeChip();
+        LoadBenchROM(chip, &BENCH_ROMS[i]);
+        chip->quirk_profile = quirk_profile;
+        MeasureBackends(BENCH_ROMS[i].name, chip, &options, &measurement, &first);
+        FreeChip(chip);
+    }
+
+    DIR *directory = rom_directory ? opendir(rom_directory) : NULL;
+    if (rom_directory && !directory)
+    {
+        fprintf(stderr, "Could not open %s.\n", rom_directory);
+        exit(EXIT_FAILURE);
+    }
+    struct dirent *entry;
+    while (directory && (entry = readdir(directory)))
+    {
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", rom_directory, entry->d_name);
+        Chip *chip = InitializeChip();
+        ROMError error = LoadROM(chip, path);
+        if (error == ROM_OK)
+        {
+            chip->quirk_profile = quirk_profile;
+            MeasureBackends(path, chip, &options, &measurement, &first);
+        }
+        else if (error != ROM_NOT_A_FILE)
+        {
+            fprintf(stderr, "Skipping %s: %s.\n", path, ROM_ERROR_NAMES[error]);
+        }
+        FreeChip(chip);
+    }
+    if (directory)
+    {
+        closedir(directory);
+    }
+
+    printf("]}\n");
+    free(measurement.elapsed_ns);
+    if (options.counters)
+    {
+        ClosePerfCounters(options.counters);
+    }
+    return EXIT_SUCCESS;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: ./ninechip-bench [-n instructions per run] "
+                    "[-c cycles per frame] [-r repetitions] [-d rom directory] "
+                    "[-q quirk profile] [-p] [-m]\n");
+    exit(EXIT_FAILURE);
+}
+
+static void Measure(const Chip *prototype, const BenchOptions *options,
+                    Measurement *measurement)
+{
+    Chip *chip = CloneChip(prototype);
+    measurement->allocations = 0;
+    memset(&measurement->perf, 0, sizeof(PerfSample));
+    for (int r = 0; r < options->repetitions; r++)
+    {
+        CopyChip(chip, prototype);
+        uint64_t frames = options->instructions / options->cycles_per_frame;
+        uint64_t frame = 0;
+        StopReason reason = STOP_BUDGET_EXHAUSTED;
+
+        size_t allocations_before = atomic_load(&allocations);
+        if (options->counters)
+        {
+            StartPerfCounters(options->counters);
+        }
+        uint64_t start = NowNs();
+        for (; frame < frames && reason != STOP_TRAPPED; frame++)
+        {
+            reason = RunCyclesWithBackend(chip, options->cycles_per_frame,
+                                          options->backend);
+            if (reason != STOP_TRAPPED)
+            {
+                TickTimers(chip);
+            }
+        }
+        if (reason != STOP_TRAPPED)
+        {
+            RunCyclesWithBackend(chip, options->instructions % options->cycles_per_frame,
+                                 options->backend);
+        }
+        uint64_t elapsed = NowNs() - start;
+        if (options->counters)
+        {
+            PerfSample sample;
+            StopPerfCounters(options->counters, &sample);
+            for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+            {
+                measurement->perf.values[i] += sample.values[i];
+                measurement->perf.valid[i] = sample.valid[i];
+            }
+        }
+        measurement->allocations += atomic_load(&allocations) - allocations_before;
+
+        measurement->elapsed_ns[r] = elapsed ? elapsed : 1;
+        measurement->instructions = chip->cycle_count - prototype->cycle_count;
+        measurement->frames = frame;
+        measurement->trapped = chip->trap != TRAP_NONE;
+    }
+    FreeChip(chip);
+}
+
+static void MeasureBackends(const char *name, const Chip *prototype,
+                            BenchOptions *options, Measurement *measurement,
+                            bool *first)
+{
+    for (Backend backend = 0; backend < NUM_BACKENDS; backend++)
+    {
+        options->backend = backend;
+        Measure(prototype, options, measurement);
+        PrintMeasurement(name, backend, measurement, options->repetitions, *first);
+        *first = false;
+    }
+}
+
+static void PrintMeasurement(const char *name, Backend backend,
+                             const Measurement *measurement, int repetitions,
+                             bool first)
+{
+    double *values = (double *)(malloc(repetitions * sizeof(double)));
+
+    printf("%s{\"name\":\"%s\",\"backend\":\"%s\",\"instructions\":%" PRIu64
+           ",\"frames\":%" PRIu64 ",\"trapped\":%s,",
+           first ? "" : ",", name, BACKEND_NAMES[backend], measurement->instructions,
+           measurement->frames, measurement->trapped ? "true" : "false");
+    if (COUNTS_ALLOCATIONS)
+    {
+        printf("\"allocations\":%zu,", measurement->allocations);
+    }
+    else
+    {
+        printf("\"allocations\":null,");
+    }
+
+    PrintStatistics("elapsed_ns", measurement->elapsed_ns, repetitions);
+    printf(",");
+    for (int r = 0; r < repetitions; r++)
+    {
+        values[r] = measurement->elapsed_ns[r] / (measurement->instructions ? measurement->instructions : 1);
+    }
+    PrintStatistics("ns_per_instruction", values, repetitions);
+    printf(",");
+    for (int r = 0; r < repetitions; r++)
+    {
+        values[r] = measurement->instructions * 1e3 / measurement->elapsed_ns[r];
+    }
+    PrintStatistics("mips", values, repetitions);
+    printf(",");
+    for (int r = 0; r < repetitions; r++)
+    {
+        values[r] = measurement->frames * 1e9 / measurement->elapsed_ns[r];
+    }
+    PrintStatistics("frames_per_second", values, repetitions);
+    printf(",");
+    PrintPerfCounters(measurement, repetitions);
+    printf("}");
+    free(values);
+}
+
+static void PrintPerfCounters(const Measurement *measurement, int repetitions)
+{
+    const PerfSample *perf = &measurement->perf;
+    bool any = false;
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        any |= perf->valid[i];
+    }
+    if (!any)
+    {
+        printf("\"perf\":null");
+        return;
+    }
+
+    double instructions = (double)measurement->instructions * repetitions;
+    instructions = instructions ? instructions : 1;
+    printf("\"perf\":{");
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        printf("%s\"host_%s_per_instruction\":", i ? "," : "", PERF_COUNTER_NAMES[i]);
+        if (perf->valid[i])
+        {
+            printf("%.4g", perf->values[i] / instructions);
+        }
+        else
+        {
+            printf("null");
+        }
+    }
+    printf(",\"branch_miss_rate\":");
+    if (perf->valid[PERF_BRANCHES] && perf->valid[PERF_BRANCH_MISSES] &&
+        perf->values[PERF_BRANCHES])
+    {
+        printf("%.4g", (double)perf->values[PERF_BRANCH_MISSES] / perf->values[PERF_BRANCHES]);
+    }
+    else
+    {
+        printf("null");
+    }
+    printf("}");
+}
+
+static void RunMicroBenchmarks(int repetitions)
+{
+    Chip *chip = InitializeChip();
+    opcode *ops = (opcode *)(malloc(MICRO_SAMPLES * sizeof(opcode)));
+    uint16_t *addresses = (uint16_t *)(malloc(MICRO_SAMPLES * sizeof(uint16_t)));
+    double *ns = (double *)(malloc(repetitions * sizeof(double)));
+    double *cycles = (double *)(malloc(repetitions * sizeof(double)));
+    uint32_t random_state = 0x9e3779b9;
+
+    printf("{\"samples\":%d,\"repetitions\":%d,\"handlers\":[", MICRO_SAMPLES,
+           repetitions);
+    for (size_t b = 0; b < NUM_MICRO_BENCHMARKS; b++)
+    {
+        const MicroBenchmark *benchmark = &MICRO_BENCHMARKS[b];
+        // Random operands, registers, memory and keypad. I stays low
+        // enough that Fx55/Fx65/Dxyn stay inside memory, and the stack
+        // pointer is reset before every call so 2nnn/00EE stay inside
+        // the stack.
+        for (int i = 0; i < MICRO_SAMPLES; i++)
+        {
+            ops[i] = benchmark->base | (NextRandom(&random_state) & benchmark->operands);
+            addresses[i] = MEMORY_START + NextRandom(&random_state) % (MEMORY_SIZE - MEMORY_START - 0x20);
+        }
+        for (int i = 0; i < NUM_REGISTERS; i++)
+        {
+            chip->registers[i] = NextRandom(&random_state);
+        }
+        for (int i = MEMORY_START; i < MEMORY_SIZE; i++)
+        {
+            chip->memory[i] = NextRandom(&random_state);
+        }
+        for (int i = 0; i < STACK_SIZE; i++)
+        {
+            chip->stack[i] = MEMORY_START + 2 * (NextRandom(&random_state) % 0x700);
+        }
+        chip->keypad = NextRandom(&random_state) | 1;
+
+        for (int r = 0; r < repetitions; r++)
+        {
+            uint64_t start = NowNs();
+            uint64_t start_cycles = ReadCycleCounter();
+            for (int i = 0; i < MICRO_SAMPLES; i++)
+            {
+                chip->stack_pointer = STACK_SIZE / 2;
+                chip->address_register = addresses[i];
+                benchmark->handler(chip, ops[i]);
+            }
+            cycles[r] = (double)(ReadCycleCounter() - start_cycles) / MICRO_SAMPLES;
+            ns[r] = (double)(NowNs() - start) / MICRO_SAMPLES;
+        }
+
+        printf("%s{\"name\":\"%s\",\"pattern\":\"%s\",", b ? "," : "",
+               benchmark->name, benchmark->pattern);
+        PrintStatistics("ns_per_op", ns, repetitions);
+        printf(",");
+        if (HAS_CYCLE_COUNTER)
+        {
+            PrintStatistics("cycles_per_op", cycles, repetitions);
+        }
+        else
+        {
+            printf("\"cycles_per_op\":null");
+        }
+        printf("}");
+    }
+    printf("]}\n");
+
+    free(cycles);
+    free(ns);
+    free(addresses);
+    free(ops);
+    FreeChip(chip);
+}
+
+static uint32_t NextRandom(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int CompareDoubles(const void *lhs, const void *rhs)
+{
+    double a = *(const double *)lhs;
+    double b = *(const double *)rhs;
+    return (a > b) - (a < b);
+}
+
+static void PrintStatistics(const char *name, double *values, int count)
+{
+    double *sorted = (double *)(malloc(count * sizeof(double)));
+    memcpy(sorted, values, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), CompareDoubles);
+    // Nearest-rank percentiles
+    printf("\"%s\":{\"min\":%.4g,\"p10\":%.4g,\"median\":%.4g,\"p90\":%.4g,\"max\":%.4g}",
+           name, sorted[0], sorted[(count - 1) / 10], sorted[(count - 1) / 2],
+           sorted[(count - 1) * 9 / 10], sorted[count - 1]);
+    free(sorted);
+}
+
+static uint64_t NowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t ReadCycleCounter()
+{
+#if HAS_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,358 @@
+// Checks that every backend and the lockstep engine run opcodes as
+// they should, and the same way.
+//
+// First, short programs with known answers (VF as the destination of
+// arithmetic, stack overflow and underflow, 16x16 sprites, scrolls,
+// planes and the four-byte F000 nnnn) run on every backend and on the
+// lockstep engine under every quirk profile, and their final state is
+// compared to what they must compute.
+//
+// Then each bundled synthetic ROM, plus a ROM that rewrites its own
+// code in only some instances, runs in lockstep under every quirk
+// profile with a different seed and keypad per instance, and the final
+// state of each instance is compared to a scalar run.
+//
+// Prints one line per mismatch and exits with failure if there are any.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../benchroms.h"
+#include "../chip.h"
+#include "../lockstep.h"
+#include "../opcodes.h"
+
+// Enough for two full lockstep groups and a partial third
+#define NUM_INSTANCES (2 * LOCKSTEP_LANES + 3)
+#define NUM_FRAMES 2000
+#define CYCLES_PER_FRAME 10
+
+// Parts of a Chip-8's final state that a known answer can check
+typedef enum
+{
+    EXPECT_NOTHING, // ends a list of expectations
+    EXPECT_REGISTER,
+    EXPECT_ADDRESS_REGISTER,
+    EXPECT_PROGRAM_COUNTER,
+    EXPECT_STACK_POINTER,
+    EXPECT_TRAP,
+    EXPECT_ROW, // the leftmost 64 pixels of a row, with index plane * 64 + y
+} ExpectedField;
+
+typedef struct
+{
+    ExpectedField field;
+    int index;
+    uint64_t value;
+} Expectation;
+
+#define MAX_EXPECTATIONS 4
+
+// A program loaded at MEMORY_START, the number of opcodes to run, and
+// the state it must end in under every quirk profile.
+typedef struct
+{
+    const char *name;
+    const uint8_t *program;
+    size_t size;
+    uint64_t cycles;
+    Expectation expected[MAX_EXPECTATIONS];
+} KnownAnswer;
+
+#define PROGRAM(...) (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__})
+#define REGISTER(x, value) {EXPECT_REGISTER, x, value}
+#define ROW(plane, y, value) {EXPECT_ROW, (plane) * HIRES_DISPLAY_HEIGHT_IN_PIXELS + (y), value}
+
+// Sixteen rows of F00F, a 16x16 sprite
+#define WIDE_SPRITE                                                                         \
+    0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, \
+        0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, \
+        0xF0, 0x0F, 0xF0, 0x0F
+
+static const KnownAnswer KNOWN_ANSWERS[] =
+    {
+        // The flag is written after the result, so it wins when x is F.
+        {"8xy4 into VF with a carry", PROGRAM(0x6F, 0xF0, 0x61, 0x20, 0x8F, 0x14), 3,
+         {REGISTER(0xF, 1)}},
+        {"8xy4 into VF without a carry", PROGRAM(0x6F, 0x10, 0x61, 0x20, 0x8F, 0x14), 3,
+         {REGISTER(0xF, 0)}},
+        {"8xy4 from VF", PROGRAM(0x60, 0x05, 0x6F, 0xFF, 0x80, 0xF4), 3,
+         {REGISTER(0x0, 0x04), REGISTER(0xF, 1)}},
+        {"8xy5 into VF with a borrow", PROGRAM(0x6F, 0x10, 0x61, 0x20, 0x8F, 0x15), 3,
+         {REGISTER(0xF, 0)}},
+        {"8xy5 into VF without a borrow", PROGRAM(0x6F, 0x30, 0x61, 0x20, 0x8F, 0x15), 3,
+         {REGISTER(0xF, 1)}},
+        {"8xy7 into VF with a borrow", PROGRAM(0x6F, 0x30, 0x61, 0x20, 0x8F, 0x17), 3,
+         {REGISTER(0xF, 0)}},
+        {"8xy7 into VF without a borrow", PROGRAM(0x6F, 0x10, 0x61, 0x20, 0x8F, 0x17), 3,
+         {REGISTER(0xF, 1)}},
+        // y is also F, so every shift quirk shifts VF.
+        {"8xyE into VF shifting out 1", PROGRAM(0x6F, 0x81, 0x8F, 0xFE), 2,
+         {REGISTER(0xF, 1)}},
+        {"8xyE into VF shifting out 0", PROGRAM(0x6F, 0x41, 0x8F, 0xFE), 2,
+         {REGISTER(0xF, 0)}},
+        {"8xy6 into VF shifting out 1", PROGRAM(0x6F, 0x81, 0x8F, 0xF6), 2,
+         {REGISTER(0xF, 1)}},
+        {"8xy6 into VF shifting out 0", PROGRAM(0x6F, 0x80, 0x8F, 0xF6), 2,
+         {REGISTER(0xF, 0)}},
+
+        {"2nnn past the top of the stack", PROGRAM(0x22, 0x00), 100,
+         {{EXPECT_TRAP, 0, TRAP_STACK_OVERFLOW},
+          {EXPECT_STACK_POINTER, 0, STACK_SIZE - 1},
+          {EXPECT_PROGRAM_COUNTER, 0, MEMORY_START}}},
+        {"00EE with an empty stack", PROGRAM(0x00, 0xEE), 100,
+         {{EXPECT_TRAP, 0, TRAP_STACK_UNDERFLOW},
+          {EXPECT_STACK_POINTER, 0, 0},
+          {EXPECT_PROGRAM_COUNTER, 0, MEMORY_START}}},
+        {"2nnn then 00EE", PROGRAM(0x22, 0x06, 0x60, 0x01, 0x12, 0x04, 0x00, 0xEE), 4,
+         {{EXPECT_TRAP, 0, TRAP_NONE},
+          {EXPECT_STACK_POINTER, 0, 0},
+          {EXPECT_PROGRAM_COUNTER, 0, 0x204},
+          REGISTER(0x0, 1)}},
+
+        {"Dxy0 at high resolution",
+         PROGRAM(0x00, 0xFF, 0xA2, 0x0C, 0x60, 0x00, 0x61, 0x00, 0xD0, 0x10, 0x12, 0x0A,
+                 WIDE_SPRITE),
+         6, {ROW(0, 0, 0xF00F000000000000), ROW(0, 15, 0xF00F000000000000), ROW(0, 16, 0),
+             REGISTER(0xF, 0)}},
+        {"Dxy0 twice at high resolution",
+         PROGRAM(0x00, 0xFF, 0xA2, 0x0E, 0x60, 0x00, 0x61, 0x00, 0xD0, 0x10, 0xD0, 0x10,
+                 0x12, 0x0C, WIDE_SPRITE),
+         7, {ROW(0, 0, 0), ROW(0, 15, 0), REGISTER(0xF, 1)}},
+
+        {"00Cn", PROGRAM(0xA2, 0x0A, 0x60, 0x00, 0xD0, 0x01, 0x00, 0xC2, 0x12, 0x08, 0xFF), 5,
+         {ROW(0, 0, 0), ROW(0, 2, 0xFF00000000000000)}},
+        {"00Dn",
+         PROGRAM(0xA2, 0x0C, 0x60, 0x00, 0x61, 0x02, 0xD0, 0x11, 0x00, 0xD1, 0x12, 0x0A, 0xFF),
+         6, {ROW(0, 1, 0xFF00000000000000), ROW(0, 2, 0)}},
+        {"00FB at the right edge",
+         PROGRAM(0xA2, 0x0C, 0x60, 0x38, 0x61, 0x00, 0xD0, 0x11, 0x00, 0xFB, 0x12, 0x0A, 0xFF),
+         6, {ROW(0, 0, 0x000000000000000F)}},
+        {"00FC at the left edge",
+         PROGRAM(0xA2, 0x0A, 0x60, 0x00, 0xD0, 0x01, 0x00, 0xFC, 0x12, 0x08, 0xFF), 5,
+         {ROW(0, 0, 0xF000000000000000)}},
+
+        {"F201 then Dxyn", PROGRAM(0xF2, 0x01, 0xA2, 0x0A, 0x60, 0x00, 0xD0, 0x01, 0x12, 0x08,
+                                   0xFF),
+         5, {ROW(0, 0, 0), ROW(1, 0, 0xFF00000000000000)}},
+        {"F301 then Dxyn", PROGRAM(0xF3, 0x01, 0xA2, 0x0A, 0x60, 0x00, 0xD0, 0x01, 0x12, 0x08,
+                                   0xF0, 0x0F),
+         5, {ROW(0, 0, 0xF000000000000000), ROW(1, 0, 0x0F00000000000000)}},
+        {"F101 then 00E0",
+         PROGRAM(0xF3, 0x01, 0xA2, 0x0E, 0x60, 0x00, 0xD0, 0x01, 0xF1, 0x01, 0x00, 0xE0,
+                 0x12, 0x0C, 0xF0, 0x0F),
+         7, {ROW(0, 0, 0), ROW(1, 0, 0x0F00000000000000)}},
+
+        // 1234 would jump to 0x234 if only half of F000 1234 were skipped.
+        {"3xkk skipping F000 nnnn",
+         PROGRAM(0x60, 0x01, 0x30, 0x01, 0xF0, 0x00, 0x12, 0x34, 0x61, 0x02, 0x12, 0x0A), 5,
+         {REGISTER(0x1, 2), {EXPECT_ADDRESS_REGISTER, 0, 0}, {EXPECT_PROGRAM_COUNTER, 0, 0x20A}}},
+        {"F000 nnnn not skipped",
+         PROGRAM(0x60, 0x00, 0x30, 0x01, 0xF0, 0x00, 0x12, 0x34, 0x61, 0x02, 0x12, 0x0A), 5,
+         {REGISTER(0x1, 2), {EXPECT_ADDRESS_REGISTER, 0, 0x1234},
+          {EXPECT_PROGRAM_COUNTER, 0, 0x20A}}},
+};
+
+#define NUM_KNOWN_ANSWERS (sizeof(KNOWN_ANSWERS) / sizeof(KNOWN_ANSWERS[0]))
+
+// Instances holding key 1 store V0..V1 over the opcode at 0x300, so
+// they load V0 = 0x55 where the others load V0 = 0x11. Both paths take
+// the same number of steps, so every instance reaches 0x300 together.
+static const uint8_t SELF_MODIFYING_ROM[] =
+    {
+        0x60, 0x60, // 6060 - V0 = 0x60
+        0x61, 0x55, // 6155 - V1 = 0x55
+        0xA3, 0x00, // A300 - I = 0x300
+        0x62, 0x01, // 6201 - V2 = 1
+        0xE2, 0xA1, // E2A1 - skip unless key V2 is held
+        0x12, 0x10, // 1210 - jump to the store
+        0x63, 0x00, // 6300 - V3 = 0, keeping both paths three opcodes long
+        0x12, 0x12, // 1212 - jump past the store
+        0xF1, 0x55, // F155 - store V0..V1 at I
+        0x60, 0x00, // 6000 - V0 = 0
+        0x13, 0x00, // 1300 - jump to 0x300
+};
+static const uint8_t SELF_MODIFIED_CODE[] =
+    {
+        0x60, 0x11, // 6011 - V0 = 0x11
+        0x13, 0x02, // 1302 - halt
+};
+
+// Returns the keypad state of the given instance: key 1 is held by
+// every instance but the second of each group, so in every group both
+// the lockstep leader and a follower rewrite the code while another
+// does not.
+static uint16_t InstanceKeypad(size_t index);
+
+// Returns the part of the Chip-8's state that the expectation checks.
+static uint64_t GetExpectedField(const Chip *chip, const Expectation *expectation);
+
+// Runs the known answer under the profile on every backend, and on
+// the lockstep engine, printing a line for each value that differs
+// from the expected one. Returns the number of mismatches.
+static int CheckKnownAnswer(const KnownAnswer *answer, QuirkProfile profile);
+
+// Runs the loaded Chip-8 in lockstep and on the scalar core, printing
+// a line for each instance whose state differs. Returns the number of
+// mismatches.
+static int Check(const Chip *prototype, const char *name);
+
+int main()
+{
+    int mismatches = 0;
+    for (QuirkProfile profile = 0; profile < NUM_QUIRK_PROFILES; profile++)
+    {
+        for (size_t i = 0; i < NUM_KNOWN_ANSWERS; i++)
+        {
+            mismatches += CheckKnownAnswer(&KNOWN_ANSWERS[i], profile);
+        }
+        for (size_t i = 0; i <= NUM_BENCH_ROMS; i++)
+        {
+            Chip *chip = InitializeChip();
+            chip->quirk_profile = profile;
+            if (i < NUM_BENCH_ROMS)
+            {
+                LoadBenchROM(chip, &BENCH_ROMS[i]);
+                mismatches += Check(chip, BENCH_ROMS[i].name);
+            }
+            else
+            {
+                LoadROMFromBuffer(chip, SELF_MODIFYING_ROM, sizeof(SELF_MODIFYING_ROM));
+                memcpy(&chip->memory[0x300], SELF_MODIFIED_CODE, sizeof(SELF_MODIFIED_CODE));
+                mismatches += Check(chip, "self-modifying");
+            }
+            FreeChip(chip);
+        }
+    }
+    if (mismatches)
+    {
+        fprintf(stderr, "%d mismatches.\n", mismatches);
+        return EXIT_FAILURE;
+    }
+    printf("Every backend gives the known answers, and lockstep matches the scalar core.\n");
+    return EXIT_SUCCESS;
+}
+
+static uint16_t InstanceKeypad(size_t index)
+{
+    return index % LOCKSTEP_LANES == 1 ? 0 : 1 << 1;
+}
+
+static uint64_t GetExpectedField(const Chip *chip, const Expectation *expectation)
+{
+    int index = expectation->index;
+    switch (expectation->field)
+    {
+    case EXPECT_REGISTER:
+        return chip->registers[index];
+    case EXPECT_ADDRESS_REGISTER:
+        return chip->address_register;
+    case EXPECT_PROGRAM_COUNTER:
+        return chip->program_counter;
+    case EXPECT_STACK_POINTER:
+        return chip->stack_pointer;
+    case EXPECT_TRAP:
+        return chip->trap;
+    case EXPECT_ROW:
+        return chip->screen[index / HIRES_DISPLAY_HEIGHT_IN_PIXELS]
+                           [index % HIRES_DISPLAY_HEIGHT_IN_PIXELS] >> 64;
+    default:
+        return 0;
+    }
+}
+
+static int CheckKnownAnswer(const KnownAnswer *answer, QuirkProfile profile)
+{
+    static const char *FIELD_NAMES[] =
+        {"nothing", "a register", "I", "the program counter", "the stack pointer", "the trap",
+         "a row"};
+
+    int mismatches = 0;
+    // Every backend, then the lockstep engine
+    for (int runner = 0; runner <= NUM_BACKENDS; runner++)
+    {
+        Chip *chip = InitializeChip();
+        chip->quirk_profile = profile;
+        LoadROMFromBuffer(chip, answer->program, answer->size);
+        LockstepEngine *engine = NULL;
+        const Chip *result = chip;
+        if (runner < NUM_BACKENDS)
+        {
+            RunCyclesWithBackend(chip, answer->cycles, runner);
+        }
+        else
+        {
+            engine = CreateLockstepEngine(chip, 1);
+            if (!engine)
+            {
+                fprintf(stderr, "Could not create a lockstep engine.\n");
+                exit(EXIT_FAILURE);
+            }
+            RunLockstepCycles(engine, answer->cycles);
+            result = GetLockstepInstance(engine, 0);
+        }
+
+        for (int i = 0; i < MAX_EXPECTATIONS && answer->expected[i].field != EXPECT_NOTHING; i++)
+        {
+            const Expectation *expectation = &answer->expected[i];
+            uint64_t value = GetExpectedField(result, expectation);
+            if (value != expectation->value)
+            {
+                printf("%s under %s on %s: %s (%d) is %" PRIx64 ", expected %" PRIx64 "\n",
+                       answer->name, QUIRK_PROFILE_NAMES[profile],
+                       runner < NUM_BACKENDS ? BACKEND_NAMES[runner] : "lockstep",
+                       FIELD_NAMES[expectation->field], expectation->index, value,
+                       expectation->value);
+                mismatches++;
+            }
+        }
+        if (engine)
+        {
+            FreeLockstepEngine(engine);
+        }
+        FreeChip(chip);
+    }
+    return mismatches;
+}
+
+static int Check(const Chip *prototype, const char *name)
+{
+    LockstepEngine *engine = CreateLockstepEngine(prototype, NUM_INSTANCES);
+    if (!engine)
+    {
+        fprintf(stderr, "Could not create a lockstep engine.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < NUM_INSTANCES; i++)
+    {
+        SeedLockstepInstance(engine, i, i + 1);
+        SetLockstepKeypad(engine, i, InstanceKeypad(i));
+    }
+    for (int frame = 0; frame < NUM_FRAMES; frame++)
+    {
+        RunLockstepFrame(engine, CYCLES_PER_FRAME);
+    }
+
+    int mismatches = 0;
+    for (size_t i = 0; i < NUM_INSTANCES; i++)
+    {
+        Chip *chip = CloneChip(prototype);
+        SeedChip(chip, i + 1);
+        chip->keypad = InstanceKeypad(i);
+        for (int frame = 0; frame < NUM_FRAMES && chip->trap == TRAP_NONE; frame++)
+        {
+            RunFrame(chip, CYCLES_PER_FRAME);
+        }
+        if (HashChipState(chip) != HashChipState(GetLockstepInstance(engine, i)))
+        {
+            printf("%s under %s: instance %zu differs from the scalar core\n", name,
+                   QUIRK_PROFILE_NAMES[prototype->quirk_profile], i);
+            mismatches++;
+        }
+        FreeChip(chip);
+    }
+    FreeLockstepEngine(engine);
+    return mismatches;
+}
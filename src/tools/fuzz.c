@@ -0,0 +1,520 @@
+// Fuzzes the core with inputs holding a ROM and a keypad movie (see
+// fuzzer.h), reporting crashes: opcodes fetched or memory accessed past
+// the end of memory, and stack overflows and underflows.
+//
+// Under afl-fuzz, e.g.
+//     afl-fuzz -i seeds -o findings -- ./bin/ninechip-fuzz @@
+// no compiler instrumentation is needed. Coverage is the guest's
+// (previous PC, PC) edges, written into AFL's shared memory bitmap, and
+// a single process serves every testcase through AFL's fork server
+// protocol without forking, restoring the Chip-8 from a snapshot. Keep
+// -n low enough that a run never reaches AFL's timeout, which would
+// kill the whole server.
+//
+// Without AFL, runs each testcase once and prints its result, or with
+// -R, runs a small built-in coverage-guided fuzzer seeded with the
+// testcases, saving new crashes into the -o directory.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../fuzzer.h"
+
+#define DEFAULT_CYCLE_BUDGET 100000
+#define MAX_INPUT_SIZE 65536
+
+// File descriptors AFL's fork server protocol uses: control messages
+// from afl-fuzz, and status messages to it
+#define FORKSRV_CONTROL_FD 198
+#define FORKSRV_STATUS_FD 199
+
+// Mutations applied per built-in fuzzer run are 1 to this many
+#define MAX_MUTATIONS 4
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+} Testcase;
+
+typedef struct
+{
+    Testcase *entries;
+    size_t count;
+    size_t capacity;
+} Queue;
+
+// Crashes program and prints error to stderr upon incorrect invocation
+static void Usage();
+
+// Serves testcases to afl-fuzz until it goes away. Reads each testcase
+// from `path`, or stdin if it is NULL.
+static void ServeAFL(FuzzTarget *target, const char *path);
+
+// Runs each testcase once, printing its result. Returns the number
+// of crashes.
+static int RunTestcases(FuzzTarget *target, uint8_t *coverage, char **paths, int count);
+
+// Runs the built-in fuzzer for `runs` inputs, saving crashes into
+// `crash_dir` if it is not NULL.
+static void RunBuiltInFuzzer(FuzzTarget *target, uint8_t *coverage, char **paths,
+                             int count, uint64_t runs, uint32_t seed,
+                             const char *crash_dir);
+
+// Reads up to MAX_INPUT_SIZE bytes of `path`, or of stdin if it is NULL,
+// into `buffer`. Returns the size read, or -1 on failure.
+static long ReadInput(const char *path, uint8_t *buffer);
+
+// Adds a copy of the input to the queue.
+static void Enqueue(Queue *queue, const uint8_t *data, size_t size);
+
+// Folds the run's coverage into `seen`, AFL-style: hit counts are
+// bucketed into powers of two. Returns true if it covered anything new.
+static bool MergeCoverage(uint8_t *seen, const uint8_t *coverage);
+
+// Applies 1 to MAX_MUTATIONS random mutations to the input in place.
+// Returns its new size, at most MAX_INPUT_SIZE.
+static size_t Mutate(uint8_t *data, size_t size, uint32_t *random);
+
+// Returns true if the input contains MOVIE_MARKER.
+static bool HasMovie(const uint8_t *data, size_t size);
+
+// Returns the next value of a xorshift32 generator.
+static uint32_t NextRandom(uint32_t *state);
+
+// Returns a monotonic timestamp in nanoseconds.
+static uint64_t NowNs();
+
+int main(int argc, char *argv[])
+{
+    uint64_t cycle_budget = DEFAULT_CYCLE_BUDGET;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    uint64_t runs = 0;
+    uint32_t seed = 1;
+    const char *crash_dir = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:c:R:s:o:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            cycle_budget = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            cycles_per_frame = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            runs = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            crash_dir = optarg;
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (cycles_per_frame == 0 || seed == 0)
+    {
+        Usage();
+    }
+
+    const char *shm_id = getenv("__AFL_SHM_ID");
+    uint8_t *coverage = NULL;
+    if (shm_id)
+    {
+        coverage = (uint8_t *)(shmat(atoi(shm_id), NULL, 0));
+        if (coverage == (void *)-1)
+        {
+            fprintf(stderr, "Could not attach AFL's bitmap: %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        coverage = (uint8_t *)(calloc(COVERAGE_MAP_SIZE, 1));
+    }
+    FuzzTarget *target = CreateFuzzTarget(coverage, cycle_budget, cycles_per_frame);
+    if (!coverage || !target)
+    {
+        fprintf(stderr, "Could not allocate fuzz target.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    if (shm_id)
+    {
+        if (argc - optind > 1)
+        {
+            Usage();
+        }
+        ServeAFL(target, optind < argc ? argv[optind] : NULL);
+    }
+    else if (runs > 0)
+    {
+        RunBuiltInFuzzer(target, coverage, argv + optind, argc - optind, runs, seed,
+                         crash_dir);
+    }
+    else
+    {
+        if (optind == argc)
+        {
+            Usage();
+        }
+        status = RunTestcases(target, coverage, argv + optind, argc - optind) > 0
+                     ? EXIT_FAILURE
+                     : EXIT_SUCCESS;
+    }
+
+    FreeFuzzTarget(target);
+    if (!shm_id)
+    {
+        free(coverage);
+    }
+    return status;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: ./ninechip-fuzz [-n cycle budget] [-c cycles per frame] "
+                    "[-R runs] [-s seed] [-o crash dir] [testcase ...]\n");
+    exit(EXIT_FAILURE);
+}
+
+static void ServeAFL(FuzzTarget *target, const char *path)
+{
+    static uint8_t buffer[MAX_INPUT_SIZE];
+    FuzzReport report;
+
+    // Without a fork server, e.g. under afl-showmap, run once and crash
+    // like an uninstrumented target would.
+    uint32_t message = 0;
+    if (write(FORKSRV_STATUS_FD, &message, sizeof(message)) != sizeof(message))
+    {
+        long size = ReadInput(path, buffer);
+        if (size < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        RunFuzzInput(target, buffer, size, &report);
+        if (IS_FUZZ_CRASH(report.result))
+        {
+            abort();
+        }
+        return;
+    }
+
+    // Each run, afl-fuzz sends whether it killed the previous child;
+    // we answer with the "child" pid, then its wait status once done.
+    int32_t pid = getpid();
+    while (read(FORKSRV_CONTROL_FD, &message, sizeof(message)) == sizeof(message))
+    {
+        if (write(FORKSRV_STATUS_FD, &pid, sizeof(pid)) != sizeof(pid))
+        {
+            break;
+        }
+        long size = ReadInput(path, buffer);
+        int32_t status = 0;
+        if (size >= 0)
+        {
+            RunFuzzInput(target, buffer, size, &report);
+            // Crashes look like the child died of SIGABRT.
+            status = IS_FUZZ_CRASH(report.result) ? SIGABRT : 0;
+        }
+        if (write(FORKSRV_STATUS_FD, &status, sizeof(status)) != sizeof(status))
+        {
+            break;
+        }
+    }
+}
+
+static int RunTestcases(FuzzTarget *target, uint8_t *coverage, char **paths, int count)
+{
+    static uint8_t buffer[MAX_INPUT_SIZE];
+    int crashes = 0;
+    for (int i = 0; i < count; i++)
+    {
+        long size = ReadInput(paths[i], buffer);
+        if (size < 0)
+        {
+            fprintf(stderr, "Could not read %s.\n", paths[i]);
+            exit(EXIT_FAILURE);
+        }
+        memset(coverage, 0, COVERAGE_MAP_SIZE);
+        FuzzReport report;
+        RunFuzzInput(target, buffer, size, &report);
+
+        size_t edges = 0;
+        for (size_t e = 0; e < COVERAGE_MAP_SIZE; e++)
+        {
+            edges += coverage[e] != 0;
+        }
+        printf("%s: %s at 0x%03X (opcode %04X) after %" PRIu64 " opcodes, %zu edges\n",
+               paths[i], FUZZ_RESULT_NAMES[report.result], report.pc, report.op,
+               report.cycles, edges);
+        crashes += IS_FUZZ_CRASH(report.result);
+    }
+    return crashes;
+}
+
+static void RunBuiltInFuzzer(FuzzTarget *target, uint8_t *coverage, char **paths,
+                             int count, uint64_t runs, uint32_t seed,
+                             const char *crash_dir)
+{
+    static uint8_t buffer[MAX_INPUT_SIZE];
+    static uint8_t seen[COVERAGE_MAP_SIZE];
+    // Crashes are saved once per kind and program counter.
+    static bool crashed[NUM_FUZZ_RESULTS][MEMORY_SIZE];
+    uint64_t results[NUM_FUZZ_RESULTS] = {0};
+    uint64_t saved = 0;
+    Queue queue = {NULL, 0, 0};
+    FuzzReport report;
+
+    for (int i = 0; i < count; i++)
+    {
+        long size = ReadInput(paths[i], buffer);
+        if (size < 0)
+        {
+            fprintf(stderr, "Could not read %s.\n", paths[i]);
+            exit(EXIT_FAILURE);
+        }
+        memset(coverage, 0, COVERAGE_MAP_SIZE);
+        RunFuzzInput(target, buffer, size, &report);
+        MergeCoverage(seen, coverage);
+        Enqueue(&queue, buffer, size);
+    }
+    if (queue.count == 0)
+    {
+        // An empty ROM, which halts on its first opcode
+        static const uint8_t HALT[] = {0x12, 0x00};
+        Enqueue(&queue, HALT, sizeof(HALT));
+    }
+
+    uint32_t random = seed;
+    uint64_t start = NowNs();
+    for (uint64_t run = 0; run < runs; run++)
+    {
+        const Testcase *parent = &queue.entries[NextRandom(&random) % queue.count];
+        memcpy(buffer, parent->data, parent->size);
+        size_t size = Mutate(buffer, parent->size, &random);
+
+        memset(coverage, 0, COVERAGE_MAP_SIZE);
+        RunFuzzInput(target, buffer, size, &report);
+        results[report.result]++;
+        if (MergeCoverage(seen, coverage))
+        {
+            Enqueue(&queue, buffer, size);
+        }
+        if (!IS_FUZZ_CRASH(report.result) || crashed[report.result][report.pc % MEMORY_SIZE])
+        {
+            continue;
+        }
+        crashed[report.result][report.pc % MEMORY_SIZE] = true;
+        saved++;
+        fprintf(stderr, "%s at 0x%03X (opcode %04X)\n", FUZZ_RESULT_NAMES[report.result],
+                report.pc, report.op);
+        if (crash_dir)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s-%03X.bin", crash_dir,
+                     FUZZ_RESULT_NAMES[report.result], report.pc);
+            FILE *file = fopen(path, "wb");
+            if (!file || fwrite(buffer, 1, size, file) != size)
+            {
+                fprintf(stderr, "Could not write %s.\n", path);
+            }
+            if (file)
+            {
+                fclose(file);
+            }
+        }
+    }
+    double seconds = (NowNs() - start) / 1e9;
+
+    size_t edges = 0;
+    for (size_t e = 0; e < COVERAGE_MAP_SIZE; e++)
+    {
+        edges += seen[e] != 0;
+    }
+    printf("%" PRIu64 " runs in %.2f s (%.0f/s), %zu queued, %zu edges, %" PRIu64
+           " unique crashes\n",
+           runs, seconds, seconds > 0 ? runs / seconds : 0, queue.count, edges, saved);
+    for (int r = 0; r < NUM_FUZZ_RESULTS; r++)
+    {
+        printf("%-20s %" PRIu64 "\n", FUZZ_RESULT_NAMES[r], results[r]);
+    }
+
+    for (size_t i = 0; i < queue.count; i++)
+    {
+        free(queue.entries[i].data);
+    }
+    free(queue.entries);
+}
+
+static long ReadInput(const char *path, uint8_t *buffer)
+{
+    FILE *file = stdin;
+    if (path)
+    {
+        file = fopen(path, "rb");
+        if (!file)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        // afl-fuzz rewrites the same stdin file for every testcase.
+        rewind(file);
+    }
+    size_t size = fread(buffer, 1, MAX_INPUT_SIZE, file);
+    bool failed = ferror(file);
+    if (path)
+    {
+        fclose(file);
+    }
+    return failed ? -1 : (long)size;
+}
+
+static void Enqueue(Queue *queue, const uint8_t *data, size_t size)
+{
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? 2 * queue->capacity : 64;
+        queue->entries = (Testcase *)(realloc(queue->entries,
+                                              queue->capacity * sizeof(Testcase)));
+    }
+    Testcase *entry = &queue->entries[queue->count++];
+    entry->data = (uint8_t *)(malloc(size ? size : 1));
+    memcpy(entry->data, data, size);
+    entry->size = size;
+}
+
+static bool MergeCoverage(uint8_t *seen, const uint8_t *coverage)
+{
+    bool found = false;
+    for (size_t e = 0; e < COVERAGE_MAP_SIZE; e++)
+    {
+        uint8_t count = coverage[e];
+        if (!count)
+        {
+            continue;
+        }
+        // Buckets 1, 2, 3, 4-7, 8-15, 16-31, 32-127 and 128-255
+        uint8_t bucket = count >= 128  ? 0x80
+                         : count >= 32 ? 0x40
+                         : count >= 16 ? 0x20
+                         : count >= 8  ? 0x10
+                         : count >= 4  ? 0x08
+                         : count == 3  ? 0x04
+                         : count == 2  ? 0x02
+                                       : 0x01;
+        if (!(seen[e] & bucket))
+        {
+            seen[e] |= bucket;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static size_t Mutate(uint8_t *data, size_t size, uint32_t *random)
+{
+    int mutations = 1 + NextRandom(random) % MAX_MUTATIONS;
+    for (int m = 0; m < mutations; m++)
+    {
+        uint32_t value = NextRandom(random);
+        size_t position = size ? NextRandom(random) % size : 0;
+        switch (value % 6)
+        {
+        case 0: // flip a bit
+            if (size)
+            {
+                data[position] ^= 1 << (value >> 8) % 8;
+            }
+            break;
+        case 1: // replace a byte
+            if (size)
+            {
+                data[position] = value >> 8;
+            }
+            break;
+        case 2: // replace an aligned opcode
+            if (size >= 2)
+            {
+                position &= ~(size_t)1;
+                position -= position + 1 >= size ? 2 : 0;
+                data[position] = value >> 8;
+                data[position + 1] = value >> 16;
+            }
+            break;
+        case 3: // insert a byte
+            if (size < MAX_INPUT_SIZE)
+            {
+                memmove(data + position + 1, data + position, size - position);
+                data[position] = value >> 8;
+                size++;
+            }
+            break;
+        case 4: // delete a byte
+            if (size)
+            {
+                memmove(data + position, data + position + 1, size - position - 1);
+                size--;
+            }
+            break;
+        case 5: // append a movie event, starting the movie if needed
+            if (!HasMovie(data, size) && size + MOVIE_MARKER_LENGTH <= MAX_INPUT_SIZE)
+            {
+                memcpy(data + size, MOVIE_MARKER, MOVIE_MARKER_LENGTH);
+                size += MOVIE_MARKER_LENGTH;
+            }
+            if (size + MOVIE_EVENT_SIZE <= MAX_INPUT_SIZE)
+            {
+                data[size++] = value >> 8;
+                data[size++] = value >> 16;
+                data[size++] = value >> 24;
+            }
+            break;
+        }
+    }
+    return size;
+}
+
+static bool HasMovie(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i + MOVIE_MARKER_LENGTH <= size; i++)
+    {
+        if (memcmp(data + i, MOVIE_MARKER, MOVIE_MARKER_LENGTH) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t NextRandom(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static uint64_t NowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -0,0 +1,137 @@
+// Packs every ROM in a directory into a single archive, indexed by
+// content hash and by file name, for ninechip-batch -a or anything
+// else using romarchive.h. With -l, instead lists an archive's ROMs in
+// hash order, one "<hash> <size> <name>" line each.
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../chip.h"
+#include "../romarchive.h"
+
+#define MAX_PATH_LENGTH 4096
+
+// Crashes program and prints error to stderr upon incorrect invocation
+static void Usage();
+
+// Packs the regular files in the directory into the archive.
+static void Pack(const char *directory_path, const char *archive_path);
+
+// Prints every ROM in the archive.
+static void List(const char *archive_path);
+
+int main(int argc, char *argv[])
+{
+    bool list = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "l")) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            list = true;
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (list && optind == argc - 1)
+    {
+        List(argv[optind]);
+    }
+    else if (!list && optind == argc - 2)
+    {
+        Pack(argv[optind], argv[optind + 1]);
+    }
+    else
+    {
+        Usage();
+    }
+    return EXIT_SUCCESS;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: ./ninechip-pack <rom directory> <archive>\n"
+                    "       ./ninechip-pack -l <archive>\n");
+    exit(EXIT_FAILURE);
+}
+
+static void Pack(const char *directory_path, const char *archive_path)
+{
+    DIR *directory = opendir(directory_path);
+    if (!directory)
+    {
+        fprintf(stderr, "Could not open %s.\n", directory_path);
+        exit(EXIT_FAILURE);
+    }
+
+    ROMImage *images = NULL;
+    PackedROM *roms = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)))
+    {
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            images = realloc(images, capacity * sizeof(ROMImage));
+            roms = realloc(roms, capacity * sizeof(PackedROM));
+        }
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", directory_path, entry->d_name);
+        ROMError error = ReadROMImage(&images[count], path);
+        if (error == ROM_OK)
+        {
+            roms[count].name = strdup(entry->d_name);
+            count++;
+        }
+        else if (error != ROM_NOT_A_FILE)
+        {
+            fprintf(stderr, "Skipping %s: %s.\n", path, ROM_ERROR_NAMES[error]);
+        }
+    }
+    closedir(directory);
+
+    // The images only stop moving once they have all been read.
+    for (size_t i = 0; i < count; i++)
+    {
+        roms[i].data = images[i].data;
+        roms[i].size = images[i].size;
+    }
+    if (!WriteROMArchive(archive_path, roms, count))
+    {
+        fprintf(stderr, "Could not write %s.\n", archive_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("Packed %zu ROMs into %s.\n", count, archive_path);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free((char *)roms[i].name);
+    }
+    free(roms);
+    free(images);
+}
+
+static void List(const char *archive_path)
+{
+    ROMArchive *archive = OpenROMArchive(archive_path);
+    if (!archive)
+    {
+        fprintf(stderr, "Could not open archive %s.\n", archive_path);
+        exit(EXIT_FAILURE);
+    }
+    ArchivedROM rom;
+    for (size_t i = 0; GetArchivedROM(archive, i, &rom); i++)
+    {
+        printf("%016" PRIx64 " %zu %s\n", rom.hash, rom.size, rom.name);
+    }
+    CloseROMArchive(archive);
+}
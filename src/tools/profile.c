@@ -0,0 +1,141 @@
+// Runs one ROM headless with profiling on, then prints the opcode class
+// counts and the hottest program counters to stdout. With -f, also
+// writes the guest call stacks in folded format, e.g. for
+//     ./bin/ninechip-profile -f out.folded game.ch8 && flamegraph.pl out.folded
+//
+// The run lasts -n opcodes (default 10 million) and replays an optional
+// input movie given with -m, under the quirk profile given with -q.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../chip.h"
+#include "../movie.h"
+#include "../opcodes.h"
+#include "../profiler.h"
+
+#define DEFAULT_INSTRUCTIONS 10000000ULL
+#define DEFAULT_HOT_ROWS 32
+
+// Crashes program and prints error to stderr upon incorrect invocation
+static void Usage();
+
+int main(int argc, char *argv[])
+{
+    uint64_t instructions = DEFAULT_INSTRUCTIONS;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    uint32_t seed = 0;
+    size_t hot_rows = DEFAULT_HOT_ROWS;
+    const char *movie_path = NULL;
+    const char *folded_path = NULL;
+    QuirkProfile quirk_profile = QUIRKS_DEFAULT;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:c:s:m:f:t:q:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            instructions = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            cycles_per_frame = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            movie_path = optarg;
+            break;
+        case 'f':
+            folded_path = optarg;
+            break;
+        case 't':
+            hot_rows = strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            quirk_profile = FindQuirkProfile(optarg);
+            if (quirk_profile == NUM_QUIRK_PROFILES)
+            {
+                Usage();
+            }
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (optind != argc - 1 || cycles_per_frame == 0)
+    {
+        Usage();
+    }
+
+    InputMovie movie = {NULL, 0};
+    if (movie_path && !LoadInputMovie(&movie, movie_path))
+    {
+        fprintf(stderr, "Could not read movie %s.\n", movie_path);
+        exit(EXIT_FAILURE);
+    }
+    Profile *profile = CreateProfile();
+    if (!profile)
+    {
+        fprintf(stderr, "Could not allocate profile.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Chip *chip = InitializeChip();
+    ROMError error = LoadROM(chip, argv[optind]);
+    if (error != ROM_OK)
+    {
+        fprintf(stderr, "Could not load %s: %s.\n", argv[optind], ROM_ERROR_NAMES[error]);
+        exit(EXIT_FAILURE);
+    }
+    chip->quirk_profile = quirk_profile;
+    if (seed)
+    {
+        SeedChip(chip, seed);
+    }
+
+    // A ROM waiting for a key it will never get still uses up frames,
+    // like it would in the frontend.
+    size_t cursor = 0;
+    StopReason reason = STOP_BUDGET_EXHAUSTED;
+    uint32_t frame = 0;
+    uint64_t frames = instructions / cycles_per_frame;
+    for (; frame < frames && reason != STOP_TRAPPED; frame++)
+    {
+        ApplyInputMovie(&movie, &cursor, frame, chip);
+        reason = RunProfiledFrame(profile, chip, cycles_per_frame);
+    }
+
+    printf("# %s: %" PRIu64 " opcodes over %" PRIu32 " frames%s\n\n", argv[optind],
+           GetProfiledInstructionCount(profile), frame,
+           reason == STOP_TRAPPED ? ", trapped" : "");
+    WriteHotPCs(profile, stdout, hot_rows);
+
+    if (folded_path)
+    {
+        FILE *file = fopen(folded_path, "w");
+        if (!file)
+        {
+            fprintf(stderr, "Could not write %s.\n", folded_path);
+            exit(EXIT_FAILURE);
+        }
+        WriteFoldedStacks(profile, file);
+        fclose(file);
+    }
+
+    FreeChip(chip);
+    FreeProfile(profile);
+    FreeInputMovie(&movie);
+    return EXIT_SUCCESS;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: ./ninechip-profile [-n instructions] [-c cycles per frame] "
+                    "[-s seed] [-m movie] [-f folded stacks output] [-t hot rows] "
+                    "[-q quirk profile] <rom>\n");
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,63 @@
+#include "triplebuffer.h"
+
+#include <stdlib.h>
+#include <SDL2/SDL_atomic.h>
+
+// The shared middle index carries this bit while it holds a frame
+// the consumer has not seen.
+#define FRESH_BIT 0x4
+#define INDEX_MASK 0x3
+
+struct TripleBuffer
+{
+    unsigned char *buffers[3];
+    int back;            // owned by the producer
+    int front;           // owned by the consumer
+    SDL_atomic_t middle; // swapped between them
+};
+
+TripleBuffer *CreateTripleBuffer(size_t size)
+{
+    TripleBuffer *buffer = (TripleBuffer *)(malloc(sizeof(TripleBuffer)));
+    for (int i = 0; i < 3; i++)
+    {
+        buffer->buffers[i] = calloc(1, size);
+    }
+    buffer->back = 0;
+    buffer->front = 1;
+    SDL_AtomicSet(&buffer->middle, 2);
+    return buffer;
+}
+
+void FreeTripleBuffer(TripleBuffer *buffer)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        free(buffer->buffers[i]);
+    }
+    free(buffer);
+}
+
+void *GetBackBuffer(TripleBuffer *buffer)
+{
+    return buffer->buffers[buffer->back];
+}
+
+void PublishBackBuffer(TripleBuffer *buffer)
+{
+    // SDL_AtomicSet is a full-barrier exchange.
+    int previous = SDL_AtomicSet(&buffer->middle, buffer->back | FRESH_BIT);
+    buffer->back = previous & INDEX_MASK;
+}
+
+bool AcquireFrontBuffer(TripleBuffer *buffer, const void **front)
+{
+    bool fresh = SDL_AtomicGet(&buffer->middle) & FRESH_BIT;
+    if (fresh)
+    {
+        int previous = SDL_AtomicSet(&buffer->middle, buffer->front);
+        buffer->front = previous & INDEX_MASK;
+    }
+    *front = buffer->buffers[buffer->front];
+    return fresh;
+}
@@ -0,0 +1,33 @@
+#ifndef _TRIPLEBUFFER_H
+#define _TRIPLEBUFFER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// A lock-free triple buffer for handing frames from one producer
+// thread to one consumer thread. The producer always has a back buffer
+// to write into and the consumer always has a front buffer to read
+// from; publishing and acquiring only swap buffer indices, so neither
+// side ever waits on the other. The consumer sees the most recently
+// published frame, and frames published in between are dropped.
+
+typedef struct TripleBuffer TripleBuffer;
+
+// Creates a triple buffer of three zeroed buffers of `size` bytes.
+TripleBuffer *CreateTripleBuffer(size_t size);
+
+// Frees the triple buffer.
+void FreeTripleBuffer(TripleBuffer *buffer);
+
+// Returns the buffer the producer should write the next frame into.
+void *GetBackBuffer(TripleBuffer *buffer);
+
+// Publishes the back buffer as the latest frame and gives the
+// producer a new back buffer.
+void PublishBackBuffer(TripleBuffer *buffer);
+
+// If a frame was published since the last call, makes it the front
+// buffer and returns true. The front buffer is returned either way.
+bool AcquireFrontBuffer(TripleBuffer *buffer, const void **front);
+
+#endif
@@ -0,0 +1,247 @@
+#include "vecenv.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+
+struct VecEnv
+{
+    VecEnvConfig config;
+    Chip *initial_state;
+    Chip **chips;
+    size_t num_envs;
+    uint32_t *episode_frames;
+    uint8_t *reward_bytes; // probe value after the previous step, for REWARD_DELTA
+    uint8_t *observations;
+    float *rewards;
+    bool *dones;
+};
+
+// Restores environment i to the initial state, keeping its random state.
+static void _reset_env(VecEnv *envs, size_t index);
+
+// Writes environment i's screen into its observation slot.
+static void _write_observation(VecEnv *envs, size_t index);
+
+// Returns true if environment i's episode has finished.
+static bool _is_done(const VecEnv *envs, size_t index, StopReason reason);
+
+VecEnv *CreateVecEnv(const Chip *initial_state, size_t num_envs,
+                     const VecEnvConfig *config)
+{
+    VecEnv *envs = (VecEnv *)(calloc(1, sizeof(VecEnv)));
+    if (!envs)
+    {
+        return NULL;
+    }
+    envs->config = *config;
+    envs->initial_state = CloneChip(initial_state);
+    envs->chips = (Chip **)(calloc(num_envs, sizeof(Chip *)));
+    envs->episode_frames = (uint32_t *)(calloc(num_envs, sizeof(uint32_t)));
+    envs->reward_bytes = (uint8_t *)(calloc(num_envs, sizeof(uint8_t)));
+    envs->observations = (uint8_t *)(calloc(num_envs, GetObservationSize(envs)));
+    envs->rewards = (float *)(calloc(num_envs, sizeof(float)));
+    envs->dones = (bool *)(calloc(num_envs, sizeof(bool)));
+    if (!envs->initial_state || !envs->chips || !envs->episode_frames ||
+        !envs->reward_bytes || !envs->observations || !envs->rewards || !envs->dones)
+    {
+        FreeVecEnv(envs);
+        return NULL;
+    }
+    // num_envs counts the chips cloned so far, so FreeVecEnv frees
+    // exactly those if a clone fails.
+    for (size_t i = 0; i < num_envs; i++)
+    {
+        envs->chips[i] = CloneChip(initial_state);
+        if (!envs->chips[i])
+        {
+            FreeVecEnv(envs);
+            return NULL;
+        }
+        envs->num_envs++;
+    }
+    ResetVecEnv(envs);
+    return envs;
+}
+
+void FreeVecEnv(VecEnv *envs)
+{
+    for (size_t i = 0; i < envs->num_envs; i++)
+    {
+        FreeChip(envs->chips[i]);
+    }
+    if (envs->initial_state)
+    {
+        FreeChip(envs->initial_state);
+    }
+    free(envs->chips);
+    free(envs->episode_frames);
+    free(envs->reward_bytes);
+    free(envs->observations);
+    free(envs->rewards);
+    free(envs->dones);
+    free(envs);
+}
+
+void SeedVecEnv(VecEnv *envs, uint32_t seed)
+{
+    for (size_t i = 0; i < envs->num_envs; i++)
+    {
+        SeedChip(envs->chips[i], seed + i);
+    }
+}
+
+void ResetVecEnv(VecEnv *envs)
+{
+    for (size_t i = 0; i < envs->num_envs; i++)
+    {
+        _reset_env(envs, i);
+        _write_observation(envs, i);
+        envs->rewards[i] = 0;
+        envs->dones[i] = false;
+    }
+}
+
+void StepVecEnv(VecEnv *envs, const uint16_t actions[], size_t n)
+{
+    const VecEnvConfig *config = &envs->config;
+    for (size_t i = 0; i < n && i < envs->num_envs; i++)
+    {
+        Chip *chip = envs->chips[i];
+        chip->keypad = actions[i];
+        StopReason reason = RunFrame(chip, config->cycles_per_frame);
+        envs->episode_frames[i]++;
+
+        uint8_t probe = chip->memory[MEMORY_ADDRESS(config->reward_address)];
+        switch (config->reward_mode)
+        {
+        case REWARD_NONE:
+            envs->rewards[i] = 0;
+            break;
+        case REWARD_VALUE:
+            envs->rewards[i] = probe;
+            break;
+        case REWARD_DELTA:
+            envs->rewards[i] = (float)probe - envs->reward_bytes[i];
+            break;
+        }
+        envs->reward_bytes[i] = probe;
+
+        envs->dones[i] = _is_done(envs, i, reason);
+        if (envs->dones[i])
+        {
+            _reset_env(envs, i);
+        }
+        _write_observation(envs, i);
+    }
+}
+
+size_t GetObservationSize(const VecEnv *envs)
+{
+    const VecEnvConfig *config = &envs->config;
+    bool high_resolution = config->observation_resolution == OBSERVATION_HIGH_RESOLUTION;
+    size_t height = high_resolution ? HIRES_DISPLAY_HEIGHT_IN_PIXELS : DISPLAY_HEIGHT_IN_PIXELS;
+    size_t width = high_resolution ? HIRES_DISPLAY_WIDTH_IN_PIXELS : DISPLAY_WIDTH_IN_PIXELS;
+    if (config->observation_format == OBSERVATION_PACKED)
+    {
+        return (config->observe_all_planes ? NUM_PLANES : 1) * height * width / 8;
+    }
+    return height * width;
+}
+
+const uint8_t *GetVecEnvObservations(const VecEnv *envs)
+{
+    return envs->observations;
+}
+
+const float *GetVecEnvRewards(const VecEnv *envs)
+{
+    return envs->rewards;
+}
+
+const bool *GetVecEnvDones(const VecEnv *envs)
+{
+    return envs->dones;
+}
+
+Chip *GetVecEnvChip(VecEnv *envs, size_t index)
+{
+    return envs->chips[index];
+}
+
+static void _reset_env(VecEnv *envs, size_t index)
+{
+    Chip *chip = envs->chips[index];
+    uint32_t rng_state = chip->rng_state;
+    CopyChip(chip, envs->initial_state);
+    chip->rng_state = rng_state;
+    envs->episode_frames[index] = 0;
+    envs->reward_bytes[index] = chip->memory[MEMORY_ADDRESS(envs->config.reward_address)];
+}
+
+static void _write_observation(VecEnv *envs, size_t index)
+{
+    const VecEnvConfig *config = &envs->config;
+    const Chip *chip = envs->chips[index];
+    uint8_t *observation = envs->observations + index * GetObservationSize(envs);
+    bool high_resolution = config->observation_resolution == OBSERVATION_HIGH_RESOLUTION;
+    if (config->observation_format == OBSERVATION_BYTES)
+    {
+        if (high_resolution)
+        {
+            UnpackScreen(chip, (uint8_t (*)[HIRES_DISPLAY_WIDTH_IN_PIXELS])observation);
+            return;
+        }
+        memset(observation, 0, DISPLAY_HEIGHT_IN_PIXELS * DISPLAY_WIDTH_IN_PIXELS);
+        for (int plane = 0; plane < NUM_PLANES; plane++)
+        {
+            uint8_t *pixel = observation;
+            for (int i = 0; i < DISPLAY_HEIGHT_IN_PIXELS; i++)
+            {
+                uint64_t row = GetLowResolutionRow(chip, plane, i);
+                for (int j = DISPLAY_WIDTH_IN_PIXELS - 1; j >= 0; j--)
+                {
+                    *pixel++ |= ((row >> j) & 1) << plane;
+                }
+            }
+        }
+        return;
+    }
+
+    uint64_t *words = (uint64_t *)observation;
+    int num_planes = config->observe_all_planes ? NUM_PLANES : 1;
+    for (int plane = 0; plane < num_planes; plane++)
+    {
+        if (!high_resolution)
+        {
+            for (int i = 0; i < DISPLAY_HEIGHT_IN_PIXELS; i++)
+            {
+                *words++ = GetLowResolutionRow(chip, plane, i);
+            }
+            continue;
+        }
+        for (int i = 0; i < HIRES_DISPLAY_HEIGHT_IN_PIXELS; i++)
+        {
+            ScreenRow row = GetDisplayRow(chip, plane, i);
+            *words++ = row >> 64;
+            *words++ = row;
+        }
+    }
+}
+
+static bool _is_done(const VecEnv *envs, size_t index, StopReason reason)
+{
+    const VecEnvConfig *config = &envs->config;
+    const Chip *chip = envs->chips[index];
+    if (reason == STOP_TRAPPED)
+    {
+        return true;
+    }
+    if (config->max_frames && envs->episode_frames[index] >= config->max_frames)
+    {
+        return true;
+    }
+    return config->done_probe &&
+           (chip->memory[MEMORY_ADDRESS(config->done_address)] & config->done_mask) == config->done_value;
+}
@@ -0,0 +1,97 @@
+#ifndef _VECENV_H
+#define _VECENV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip.h"
+
+// A batch of Chip-8 environments stepped together, one frame at a time,
+// for reinforcement learning. Observations, rewards and done flags are
+// written into buffers owned by the VecEnv, allocated once up front, so
+// a step never allocates or copies per-instance screens around.
+
+typedef enum
+{
+    // One byte per pixel, its color (0-3, bit p set if lit in plane p):
+    // n x height x width bytes.
+    OBSERVATION_BYTES,
+    // One bit per pixel, the leftmost in the most significant bit:
+    // one uint64_t per row at low resolution and two at high, for
+    // plane 0 and then, with observe_all_planes, plane 1.
+    OBSERVATION_PACKED,
+} ObservationFormat;
+
+typedef enum
+{
+    // 64x32, plain CHIP-8's screen. High-resolution screens are
+    // sampled at every other pixel in both directions.
+    OBSERVATION_LOW_RESOLUTION,
+    // 128x64, SUPER-CHIP's. Low-resolution pixels are doubled.
+    OBSERVATION_HIGH_RESOLUTION,
+} ObservationResolution;
+
+typedef enum
+{
+    REWARD_NONE,
+    REWARD_VALUE, // reward is the byte at the probe address
+    REWARD_DELTA, // reward is the signed change of that byte since the last step
+} RewardMode;
+
+typedef struct
+{
+    uint32_t cycles_per_frame;
+    ObservationFormat observation_format;
+    ObservationResolution observation_resolution;
+    bool observe_all_planes; // packed observations only
+
+    RewardMode reward_mode;
+    uint16_t reward_address;
+
+    // An episode is done once (memory[done_address] & done_mask) == done_value,
+    // when the Chip-8 traps, or after max_frames frames (if nonzero).
+    bool done_probe;
+    uint16_t done_address;
+    uint8_t done_mask;
+    uint8_t done_value;
+    uint32_t max_frames;
+} VecEnvConfig;
+
+typedef struct VecEnv VecEnv;
+
+// Creates `num_envs` environments that start, and reset to, the given
+// Chip-8 state, typically one that has just had a ROM loaded.
+// Returns NULL on failure.
+VecEnv *CreateVecEnv(const Chip *initial_state, size_t num_envs,
+                     const VecEnvConfig *config);
+
+// Frees the environments and their buffers.
+void FreeVecEnv(VecEnv *envs);
+
+// Seeds environment i with `seed + i`. Random state carries over
+// resets, so successive episodes differ.
+void SeedVecEnv(VecEnv *envs, uint32_t seed);
+
+// Resets every environment and writes their observations.
+void ResetVecEnv(VecEnv *envs);
+
+// Advances environments 0 to n - 1 by one frame each, with actions[i]
+// as the keypad mask held by environment i. Writes observations,
+// rewards and done flags. Finished environments are reset from the
+// initial state, and their observation is that of the new episode.
+void StepVecEnv(VecEnv *envs, const uint16_t actions[], size_t n);
+
+// Returns the size in bytes of one environment's observation.
+size_t GetObservationSize(const VecEnv *envs);
+
+// Buffers written by ResetVecEnv and StepVecEnv. Observation i starts
+// at byte i * GetObservationSize(envs).
+const uint8_t *GetVecEnvObservations(const VecEnv *envs);
+const float *GetVecEnvRewards(const VecEnv *envs);
+const bool *GetVecEnvDones(const VecEnv *envs);
+
+// Returns environment i's Chip-8.
+Chip *GetVecEnvChip(VecEnv *envs, size_t index);
+
+#endif